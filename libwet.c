@@ -0,0 +1,219 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libwet.h"
+
+/* An asynchronous fetch of one location's weather, which W holds once
+   it has been parsed. Like their fetches, requests are recycled through
+   request_slab. */
+struct wet_request {
+  struct wet_context *ctx;
+  struct wet_net_async *fetch;
+  char location_id[WET_DATA_MAX];
+  wet_request_func func;
+  void *arg;
+  bool parsed;
+  struct weather w;
+};
+
+static struct wet_slab request_slab =
+  WET_SLAB_INITIALIZER (sizeof (struct wet_request), 256);
+
+/* the code a call returns: ERR's if OK is false */
+#define __status(__ctx, __ok) \
+  ((__ok) ? WET_ESUCCESS : (__ctx)->error.code)
+
+/* Sets CTX up with the defaults: metric units, WET_FORECAST_DAYS of
+   forecasts, documents from malloc() and no error. */
+void
+wet_context_init (struct wet_context *ctx)
+{
+  ctx->metric = true;
+  ctx->forecast_days = WET_FORECAST_DAYS;
+  ctx->allocator = NULL;
+  ctx->error.code = WET_ESUCCESS;
+  ctx->error.text[0] = '\0';
+}
+
+/* Looks up the location ID of each of the N LOCATIONS (names, or
+   coordinates as "@LAT,LON"), writing them to the WET_DATA_MAX sized
+   buffers in IDS. */
+int
+wet_locate (struct wet_context *ctx, char **ids, const char **locations,
+            size_t n)
+{
+  return __status (ctx, wet_weather_locate (ids, locations, n,
+                                            &ctx->error));
+}
+
+/* Whether CTX asks for a number of forecast days that can be fetched. */
+static bool
+valid_days (struct wet_context *ctx)
+{
+  if ((ctx->forecast_days < 1) ||
+      (ctx->forecast_days > WET_FORECAST_DAYS_MAX))
+    return wet_fail (&ctx->error, WET_EOP,
+                     "invalid number of forecast days -- %u (1-%u)",
+                     ctx->forecast_days, WET_FORECAST_DAYS_MAX);
+  return true;
+}
+
+/* Fetches the weather data documents of the N location IDS, handing each
+   one to FUNC as it arrives (see wet_net_fetch_weather_data()); FUNC
+   owns the body it is given, which comes from CTX's allocator. On
+   failure FUNC may have been given some of the documents already. */
+int
+wet_fetch_documents (struct wet_context *ctx, const char **ids, size_t n,
+                     wet_net_body_func func, void *arg)
+{
+  return __status (ctx, valid_days (ctx) &&
+                       wet_net_fetch_weather_data (ids, n,
+                                                   ctx->forecast_days, func,
+                                                   arg, ctx->allocator,
+                                                   &ctx->error));
+}
+
+/* Looks up LOCATION and fetches its weather into W, in CTX's units.
+   Release W with wet_weather_release() once done with it (only after
+   success: a failed call leaves nothing behind). */
+int
+wet_fetch (struct wet_context *ctx, const char *location, struct weather *w)
+{
+  return __status (ctx, valid_days (ctx) &&
+                       wet_weather (w, location, ctx->metric,
+                                    ctx->forecast_days, ctx->allocator,
+                                    &ctx->error));
+}
+
+/* Parses CONTENT, the weather data document fetched for LOCATION_ID,
+   into W, in CTX's units. W takes CONTENT over either way; release W
+   with wet_weather_release() once done with it (only after success). */
+int
+wet_parse (struct wet_context *ctx, const char *location_id,
+           struct wet_buffer *content, struct weather *w)
+{
+  if (!wet_weather_parse (w, location_id, content, ctx->allocator,
+                          &ctx->error)) {
+    wet_weather_release (w);
+    return ctx->error.code;
+  }
+  wet_weather_convert (w, ctx->metric);
+  return WET_ESUCCESS;
+}
+
+/* Writes the parts of W that X asks for to OUT, the way wet shows them.
+   Use open_memstream() to format into memory. */
+int
+wet_format (struct wet_context *ctx, FILE *out, const struct weather *w,
+            const struct wet_display *x)
+{
+  wet_display (out, w, x);
+  if (ferror (out)) {
+    wet_fail (&ctx->error, WET_ESYS, "failed to write weather: %s",
+              strerror (errno));
+    return ctx->error.code;
+  }
+  return WET_ESUCCESS;
+}
+
+/* Starts fetching the weather of LOCATION_ID into a new request, stored
+   in REQUEST, that calls FUNC (with ARG) once it has finished; see the
+   description in libwet.h. Looking up the server's address is the only
+   part of a request that can block, and only if WET_SERVER names it by
+   host name. CTX has to outlast the request. */
+int
+wet_request_start (struct wet_context *ctx, struct wet_request **request,
+                   const char *location_id, wet_request_func func,
+                   void *arg)
+{
+  struct wet_request *r;
+
+  if (!valid_days (ctx))
+    return ctx->error.code;
+  r = (struct wet_request *) wet_slab_get (&request_slab);
+  if (!r)
+    return __status (ctx, wet_fail (&ctx->error, WET_ESYS,
+                                    "failed to allocate memory"));
+  r->fetch = wet_net_async_start (location_id, ctx->forecast_days,
+                                  ctx->allocator, &ctx->error);
+  if (!r->fetch) {
+    wet_slab_put (&request_slab, r);
+    return ctx->error.code;
+  }
+  r->ctx = ctx;
+  snprintf (r->location_id, WET_DATA_MAX, "%s", location_id);
+  r->func = func;
+  r->arg = arg;
+  r->parsed = false;
+  *request = r;
+  return WET_ESUCCESS;
+}
+
+/* the descriptor to poll for R, or -1 once it has finished */
+int
+wet_request_fd (const struct wet_request *r)
+{
+  return wet_net_async_fd (r->fetch);
+}
+
+/* what R's descriptor is to be polled for, or 0 once it has finished */
+int
+wet_request_events (const struct wet_request *r)
+{
+  return wet_net_async_events (r->fetch);
+}
+
+/* Does whatever R can do without blocking, calling its function if that
+   finishes it. Calling it when the descriptor is not ready, or after R
+   has finished, does no harm. */
+void
+wet_request_process (struct wet_request *r)
+{
+  struct wet_buffer b;
+  int status;
+
+  if (!wet_net_async_events (r->fetch))
+    return;
+  if (!wet_net_async_process (r->fetch, &b, &r->ctx->error))
+    status = r->ctx->error.code;
+  else if (!b.p)
+    return;
+  else {
+    status = wet_parse (r->ctx, r->location_id, &b, &r->w);
+    r->parsed = (status == WET_ESUCCESS);
+  }
+  r->func (r, status, (r->parsed) ? &r->w : NULL, r->arg);
+}
+
+/* Frees R and its weather, abandoning it if it has not finished yet. */
+void
+wet_request_free (struct wet_request *r)
+{
+  wet_net_async_free (r->fetch);
+  if (r->parsed)
+    wet_weather_release (&r->w);
+  wet_slab_put (&request_slab, r);
+}
+
+#undef __status
@@ -0,0 +1,99 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBWET_H
+#define LIBWET_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "wet.h"
+#include "wet-arena.h"
+#include "wet-display.h"
+#include "wet-net.h"
+#include "wet-util.h"
+#include "wet-weather.h"
+
+/*
+ * libwet is wet's fetch, parse and format engine, for programs that want
+ * weather data without running the wet command.
+ *
+ * Every call takes a context, which holds the caller's settings and the
+ * error of its last failed call; nothing else is kept between calls, and
+ * no call prints anything or exits. Each returns WET_ESUCCESS or one of
+ * the other WET_E* codes, in which case the context's error says what
+ * went wrong. Contexts are independent of each other, so any number of
+ * threads can make calls at once as long as each uses its own. (Threads
+ * that happen to fetch the same document at the same time still share
+ * the request; see http_get_request().)
+ */
+
+struct wet_context {
+  bool metric;            /* the units to convert weather into */
+  /* how many days of forecasts to fetch, 1 to WET_FORECAST_DAYS_MAX;
+     fewer days are fewer bytes to transfer, parse and keep */
+  unsigned int forecast_days;
+  struct wet_error error; /* why the last call failed */
+  /* where fetched documents, the scratch of a fetch and the forecasts
+     of parsed weather are allocated (NULL for malloc()); see wet-arena.h
+     for a bump allocator that can be reset between documents */
+  const struct wet_allocator *allocator;
+};
+
+/*
+ * Requests are the asynchronous counterpart of wet_fetch(), for programs
+ * that run their own event loop (epoll, libuv, libevent...) and cannot
+ * block in it. wet_request_start() starts fetching the weather of one
+ * location ID (see wet_locate()) and returns straight away. From then on
+ * the program polls wet_request_fd() for whichever WET_NET_WANT_* event
+ * wet_request_events() names (both change as the request goes along) and
+ * calls wet_request_process() once it is ready, so any number of
+ * requests can be in flight at once, each on its own descriptor. When a
+ * request finishes, wet_request_process() calls its function with the
+ * outcome, and after that the request has nothing left to poll for.
+ * Requests share their context, so they must all be driven from the
+ * thread that owns it.
+ */
+
+struct wet_request;
+
+/* Called once a request has finished: with WET_ESUCCESS and its weather,
+   which lasts until the request is freed, or with the code it failed
+   with (the context's error says why) and NULL. It may free the
+   request. */
+typedef void (*wet_request_func) (struct wet_request *, int,
+                                  const struct weather *, void *);
+
+void wet_context_init (struct wet_context *);
+int wet_locate (struct wet_context *, char **, const char **, size_t);
+int wet_fetch_documents (struct wet_context *, const char **, size_t,
+                         wet_net_body_func, void *);
+int wet_fetch (struct wet_context *, const char *, struct weather *);
+int wet_parse (struct wet_context *, const char *, struct wet_buffer *,
+               struct weather *);
+int wet_format (struct wet_context *, FILE *, const struct weather *,
+                const struct wet_display *);
+int wet_request_start (struct wet_context *, struct wet_request **,
+                       const char *, wet_request_func, void *);
+int wet_request_fd (const struct wet_request *);
+int wet_request_events (const struct wet_request *);
+void wet_request_process (struct wet_request *);
+void wet_request_free (struct wet_request *);
+
+#endif /* LIBWET_H */
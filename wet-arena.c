@@ -0,0 +1,183 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdint.h> /* SIZE_MAX */
+#include <stdlib.h>
+
+#include "wet-arena.h"
+
+#define ARENA_CHUNK_SIZE 65536
+/* every allocation is aligned for any type */
+#define ARENA_ALIGN      (2 * sizeof (void *))
+
+#define __align(__n) (((__n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+/* A block of arena memory. Its first USED bytes after the (aligned)
+   header have been handed out. */
+struct __arena_chunk {
+  struct __arena_chunk *next;
+  size_t size;
+  size_t used;
+};
+
+#define __chunk_data(__c) ((char *) (__c) + __align (sizeof (*(__c))))
+
+static void *
+arena_alloc (size_t n, void *arg)
+{
+  return wet_arena_alloc ((struct wet_arena *) arg, n);
+}
+
+static void
+arena_release (void *p, void *arg)
+{
+  /* given back by the next wet_arena_reset() */
+}
+
+/* Sets up A with no memory yet, holding at most LIMIT bytes (or any
+   amount if LIMIT is 0). */
+void
+wet_arena_init (struct wet_arena *a, size_t limit)
+{
+  a->allocator.alloc = arena_alloc;
+  a->allocator.release = arena_release;
+  a->allocator.arg = a;
+  a->chunks = NULL;
+  a->current = NULL;
+  a->size = 0;
+  a->limit = limit;
+}
+
+/* Returns N bytes from A, or NULL (with errno set to ENOMEM) if they
+   would take A over its limit or there is no memory for them. */
+void *
+wet_arena_alloc (struct wet_arena *a, size_t n)
+{
+  struct __arena_chunk *c;
+  struct __arena_chunk **tail;
+  size_t size;
+  void *p;
+
+  if (n > SIZE_MAX / 2) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  n = __align (n);
+  for (c = a->current; c; c = c->next)
+    if (c->size - c->used >= n)
+      break;
+
+  if (!c) {
+    /* near the limit, the last chunk takes whatever is left */
+    size = ARENA_CHUNK_SIZE;
+    if (a->limit && (a->limit - a->size < size))
+      size = a->limit - a->size;
+    if (size < n)
+      size = n;
+    if (a->limit && (a->size + size > a->limit)) {
+      errno = ENOMEM;
+      return NULL;
+    }
+    c = (struct __arena_chunk *) malloc (__align (sizeof (*c)) + size);
+    if (!c)
+      return NULL;
+    c->next = NULL;
+    c->size = size;
+    c->used = 0;
+    for (tail = &a->chunks; *tail; tail = &(*tail)->next)
+      ;
+    *tail = c;
+    a->size += size;
+  }
+
+  a->current = c;
+  p = __chunk_data (c) + c->used;
+  c->used += n;
+  return p;
+}
+
+/* Takes back everything A has handed out, keeping its chunks. */
+void
+wet_arena_reset (struct wet_arena *a)
+{
+  struct __arena_chunk *c;
+
+  for (c = a->chunks; c; c = c->next)
+    c->used = 0;
+  a->current = a->chunks;
+}
+
+/* Frees A's chunks. */
+void
+wet_arena_destroy (struct wet_arena *a)
+{
+  struct __arena_chunk *c;
+
+  while (a->chunks) {
+    c = a->chunks;
+    a->chunks = c->next;
+    free (c);
+  }
+  a->current = NULL;
+  a->size = 0;
+}
+
+/* Returns an object of S's size, or NULL if there is no memory for
+   one. Its contents are whatever they were last. */
+void *
+wet_slab_get (struct wet_slab *s)
+{
+  void *p;
+
+  pthread_mutex_lock (&s->lock);
+  p = s->free_list;
+  if (p) {
+    s->free_list = *(void **) p;
+    s->n_free--;
+  }
+  pthread_mutex_unlock (&s->lock);
+  if (!p)
+    p = malloc ((s->size > sizeof (void *)) ? s->size : sizeof (void *));
+  return p;
+}
+
+/* Gives P, which came from S, back to it. */
+void
+wet_slab_put (struct wet_slab *s, void *p)
+{
+  if (!p)
+    return;
+  pthread_mutex_lock (&s->lock);
+  if (s->n_free < s->max_free) {
+    *(void **) p = s->free_list;
+    s->free_list = p;
+    s->n_free++;
+    p = NULL;
+  }
+  pthread_mutex_unlock (&s->lock);
+  free (p);
+}
+
+#undef __chunk_data
+#undef __align
@@ -0,0 +1,75 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WET_ARENA_H
+#define WET_ARENA_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-util.h"
+
+struct __arena_chunk;
+
+/* A bump allocator: memory is handed out in order from large chunks and
+   only given back all at once, by wet_arena_reset(), which keeps the
+   chunks for the next round. Releasing a single allocation does nothing,
+   so freeing a document taken from an arena costs nothing either. LIMIT
+   caps the bytes of chunk an arena holds (0 for no cap), so that an
+   oversized document fails to allocate rather than growing the process.
+   ALLOCATOR hands out the arena's memory to anything that takes a
+   struct wet_allocator. An arena is not thread safe. */
+struct wet_arena {
+  struct wet_allocator allocator;
+  struct __arena_chunk *chunks;
+  struct __arena_chunk *current;
+  size_t size;
+  size_t limit;
+};
+
+/* A free list of objects of SIZE bytes, for those that come and go all
+   the time: an object put back is handed out again by the next get
+   rather than freed, keeping up to MAX_FREE of them. Slabs are thread
+   safe, and can be set up statically with WET_SLAB_INITIALIZER. */
+struct wet_slab {
+  pthread_mutex_t lock;
+  size_t size;
+  size_t max_free;
+  size_t n_free;
+  void *free_list;
+};
+
+#define WET_SLAB_INITIALIZER(size, max_free) \
+  { PTHREAD_MUTEX_INITIALIZER, (size), (max_free), 0, NULL }
+
+/* what an arena that holds one weather data document at a time (and
+   what parsing it takes) is capped at: many times what a real document
+   needs, so that only a broken or hostile server runs into it */
+#define WET_ARENA_DOCUMENT_LIMIT (4 * 1024 * 1024)
+
+void wet_arena_init (struct wet_arena *, size_t);
+void *wet_arena_alloc (struct wet_arena *, size_t);
+void wet_arena_reset (struct wet_arena *);
+void wet_arena_destroy (struct wet_arena *);
+
+void *wet_slab_get (struct wet_slab *);
+void wet_slab_put (struct wet_slab *, void *);
+
+#endif /* WET_ARENA_H */
@@ -0,0 +1,671 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * `wet batch SOURCE' fetches the weather of every location query read
+ * from SOURCE (`-' for standard input), one per line, for station lists
+ * far too long to give as arguments or to hold in memory at once.
+ *
+ * Queries are read as they arrive and at most a window of them are
+ * outstanding at any time: each one holds a slot from being read until
+ * its result has been written out. The fetches are libwet requests
+ * (wet_request_start()) driven from one poll() loop together with the
+ * input, so a slow producer never holds up the fetches in flight, nor
+ * they the producer. Each result is rendered as soon as its document has
+ * been parsed, and then written out straight away (--unordered) or once
+ * every query before it has been; the slots are the reorder buffer, so
+ * memory stays the same however long the input is. Every slot fetches
+ * and parses into an arena of its own, which is reset once the result
+ * has been rendered, so no document can take more than
+ * WET_ARENA_DOCUMENT_LIMIT either.
+ *
+ * Queries are looked up (wet_locate()) on a thread of their own, so a
+ * name that has to be searched for never holds up the fetches in flight
+ * either. The lookup thread takes everything read since its last lookup
+ * as one group, so that searches cost a round trip per group rather than
+ * per line, and hands the group back to the poll() loop through a pipe.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libwet.h"
+#include "wet-arena.h"
+#include "wet-batch.h"
+#include "wet-history.h"
+#include "wet-util.h"
+
+#define INPUT_MAX     (4 * WET_DATA_MAX)
+/* seconds without any request making progress before those in flight
+   are given up */
+#define STALL_TIMEOUT 60
+
+enum slot_state {
+  SLOT_FREE,
+  SLOT_LOCATING,
+  SLOT_RUNNING,
+  SLOT_DONE
+};
+
+/* one query, from being read until its result has been written out;
+   its request allocates from ARENA through CTX */
+struct slot {
+  int state;
+  struct slot *next; /* in the lookup queues */
+  size_t seq;
+  char query[WET_DATA_MAX];
+  char id[WET_DATA_MAX];
+  struct wet_context ctx;
+  struct wet_arena arena;
+  struct wet_request *request;
+  bool failed;
+  struct wet_error error;
+  char *text;
+  size_t len;
+};
+
+/* the input, read as it becomes available */
+struct input {
+  int fd;
+  char buf[INPUT_MAX];
+  size_t start;
+  size_t end;
+  bool eof;
+  bool skipping; /* dropping the rest of a line too long to keep */
+};
+
+static const struct wet_batch_options *options;
+static struct slot *slots;
+/* in input order, the slot of query SEQ is order[SEQ % window] */
+static struct slot **order;
+static struct slot **free_slots;
+static size_t n_free;
+static size_t n_locating;
+static size_t n_running;
+static size_t next_seq;
+static size_t next_emit;
+static size_t n_emitted;
+static bool record_history;
+static int status;
+
+/* the slots waiting for the lookup thread, and those it has looked up
+   (their query failed if FAILED is set), in the order they were read;
+   the thread writes a byte to located_pipe[1] whenever it adds some */
+static pthread_mutex_t lookup_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lookup_cond = PTHREAD_COND_INITIALIZER;
+static struct slot *to_locate;
+static struct slot *located;
+static bool lookups_over;
+static int located_pipe[2];
+
+/* Writes the N bytes at S as a JSON string. */
+static void
+put_string (FILE *out, const char *s, size_t n)
+{
+  size_t i;
+  unsigned char c;
+
+  fputc ('"', out);
+  for (i = 0; i < n; ++i) {
+    c = (unsigned char) s[i];
+    if ((c == '"') || (c == '\\'))
+      fprintf (out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf (out, "\\u%04x", c);
+    else
+      fputc (c, out);
+  }
+  fputc ('"', out);
+}
+
+/* JSON has no NaN or infinity: an unknown value, and an unlimited one,
+   are both written as null. */
+static void
+put_number (FILE *out, const char *key, double value)
+{
+  if (isnan (value) || isinf (value))
+    fprintf (out, ",\"%s\":null", key);
+  else
+    fprintf (out, ",\"%s\":%.10g", key, value);
+}
+
+static double
+view_number (struct wet_view v)
+{
+  double d;
+
+  return wet_view2double (v, &d) ? d : NAN;
+}
+
+/* Writes W, fetched for QUERY, as one NDJSON object. The measurements
+   are always metric, with the unit in their names, as serve-metrics
+   gives them. */
+static void
+render_ndjson (FILE *out, const char *query, const struct weather *w)
+{
+  const struct weather_values *v;
+
+  v = &w->values;
+  fputs ("{\"query\":", out);
+  put_string (out, query, strlen (query));
+  fputs (",\"id\":", out);
+  put_string (out, w->location_id, strlen (w->location_id));
+  fputs (",\"name\":", out);
+  put_string (out, w->location.name.p, w->location.name.n);
+  put_number (out, "latitude", view_number (w->location.lat));
+  put_number (out, "longitude", view_number (w->location.lon));
+  put_number (out, "observed", (v->last_updated == WET_NO_TIME) ?
+              NAN : (double) v->last_updated);
+  fputs (",\"text\":", out);
+  put_string (out, w->current_conditions.text.p,
+              w->current_conditions.text.n);
+  put_number (out, "condition", wet_weather_byte (v->condition));
+  put_number (out, "temperature_celsius", wet_weather_tenths (v->temperature));
+  put_number (out, "feels_like_celsius", wet_weather_tenths (v->feels_like));
+  put_number (out, "dewpoint_celsius", wet_weather_tenths (v->dewpoint));
+  put_number (out, "humidity_percent", wet_weather_byte (v->humidity));
+  put_number (out, "pressure_hectopascals", wet_weather_tenths (v->pressure));
+  put_number (out, "visibility_kilometers",
+              wet_weather_tenths (v->visibility));
+  put_number (out, "wind_speed_kilometers_per_hour",
+              wet_weather_tenths (v->wind.speed));
+  put_number (out, "wind_gust_kilometers_per_hour",
+              wet_weather_tenths (v->wind.gust));
+  put_number (out, "wind_direction_degrees",
+              (v->wind.direction == WET_NO_VALUE) ?
+              NAN : (double) v->wind.direction);
+  put_number (out, "uv_index", wet_weather_byte (v->uv_index));
+  put_number (out, "high_celsius", wet_weather_tenths (v->forecasts[0].high));
+  put_number (out, "low_celsius", wet_weather_tenths (v->forecasts[0].low));
+  fputs ("}\n", out);
+}
+
+/* Writes out the result of S and frees S. */
+static void
+emit (struct slot *s)
+{
+  if (s->failed) {
+    if (!status)
+      status = s->error.code;
+    if (options->ndjson) {
+      fputs ("{\"query\":", stdout);
+      put_string (stdout, s->query, strlen (s->query));
+      fputs (",\"error\":", stdout);
+      put_string (stdout, s->error.text, strlen (s->error.text));
+      fputs ("}\n", stdout);
+    } else {
+      /* keep the error where it belongs among the results */
+      fflush (stdout);
+      wet_error ("%s: %s", s->query, s->error.text);
+    }
+  } else {
+    /* anything but NDJSON and templates is separated by a blank line */
+    if (n_emitted && !options->ndjson && !options->template)
+      wet_putc ('\n');
+    fwrite (s->text, 1, s->len, stdout);
+    n_emitted++;
+  }
+  free (s->text);
+  s->text = NULL;
+  s->state = SLOT_FREE;
+  free_slots[n_free++] = s;
+}
+
+/* Writes out every finished result whose turn has come. */
+static void
+flush_results (void)
+{
+  struct slot *s;
+
+  while (next_emit < next_seq) {
+    s = order[next_emit % options->window];
+    if (s->state != SLOT_DONE)
+      break;
+    emit (s);
+    next_emit++;
+  }
+}
+
+static void
+complete (struct slot *s)
+{
+  s->state = SLOT_DONE;
+  if (options->unordered)
+    emit (s);
+  else
+    flush_results ();
+}
+
+static void
+fail (struct slot *s, const struct wet_error *err)
+{
+  s->failed = true;
+  s->error = *err;
+  complete (s);
+}
+
+/* Called once the request of the slot ARG has finished. */
+static void
+finished (struct wet_request *r, int code, const struct weather *w,
+          void *arg)
+{
+  struct slot *s;
+  FILE *out;
+
+  s = (struct slot *) arg;
+  s->request = NULL;
+  n_running--;
+  if (code) {
+    wet_request_free (r);
+    wet_arena_reset (&s->arena);
+    fail (s, &s->ctx.error);
+    return;
+  }
+
+  if (record_history && !wet_history_append (w, time (NULL)))
+    wet_debug ("failed to record the history of %s", w->location_id);
+  out = open_memstream (&s->text, &s->len);
+  if (!out)
+    wet_die (WET_ESYS, "failed to open memory stream");
+  if (options->ndjson)
+    render_ndjson (out, s->query, w);
+  else if (options->template) {
+    wet_template_render (options->template, out, w);
+    fputc ('\n', out);
+  } else
+    wet_display (out, w, options->display);
+  fclose (out);
+  wet_request_free (r);
+  wet_arena_reset (&s->arena);
+  complete (s);
+}
+
+/* Reads whatever the input has to give without blocking for more. */
+static void
+fill (struct input *in)
+{
+  ssize_t n;
+
+  if (in->start) {
+    memmove (in->buf, in->buf + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+  }
+  n = read (in->fd, in->buf + in->end, INPUT_MAX - in->end);
+  if (n > 0)
+    in->end += n;
+  else if ((n == 0) || ((errno != EINTR) && (errno != EAGAIN)))
+    in->eof = true;
+}
+
+/* Takes the next whole line out of IN into LINE (WET_DATA_MAX bytes, and
+   truncated to fit), or returns false if none has been read yet. */
+static bool
+take_line (struct input *in, char *line)
+{
+  const char *p;
+  const char *nl;
+  size_t n;
+
+  for (;;) {
+    p = in->buf + in->start;
+    n = in->end - in->start;
+    nl = (const char *) memchr (p, '\n', n);
+    if (in->skipping) {
+      if (!nl) {
+        in->start = in->end;
+        return false;
+      }
+      in->skipping = false;
+      in->start += nl - p + 1;
+      continue;
+    }
+    if (nl)
+      n = nl - p;
+    else if (!n || (!in->eof && (n < INPUT_MAX)))
+      return false;
+    else if (!in->eof)
+      in->skipping = true; /* a whole buffer without a line break */
+    if (n >= WET_DATA_MAX)
+      n = WET_DATA_MAX - 1;
+    memcpy (line, p, n);
+    line[n] = '\0';
+    in->start = nl ? (size_t) (nl - in->buf + 1) : in->end;
+    return true;
+  }
+}
+
+/* Strips LINE of surrounding white space, returning whether there is a
+   query left: blank lines and lines starting with `#' are skipped. */
+static bool
+trim (char *line)
+{
+  char *p;
+  size_t n;
+
+  for (p = line; isspace ((unsigned char) *p); ++p)
+    ;
+  n = strlen (p);
+  while (n && isspace ((unsigned char) p[n - 1]))
+    n--;
+  memmove (line, p, n);
+  line[n] = '\0';
+  return n && (*line != '#');
+}
+
+/* Appends the list LIST to the list at HEAD. */
+static void
+append_slots (struct slot **head, struct slot *list)
+{
+  while (*head)
+    head = &(*head)->next;
+  *head = list;
+}
+
+/* Looks up the N queries of the slots in GROUP, setting FAILED on those
+   that cannot be found. */
+static void
+locate_group (struct wet_context *ctx, struct slot **group, size_t n)
+{
+  char *ids[WET_BATCH_WINDOW_MAX];
+  const char *queries[WET_BATCH_WINDOW_MAX];
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    ids[i] = group[i]->id;
+    queries[i] = group[i]->query;
+  }
+  if (!wet_locate (ctx, ids, queries, n))
+    return;
+  /* a query that cannot be found fails its whole group, so the group is
+     looked up again one by one to tell which it was */
+  for (i = 0; i < n; ++i) {
+    if ((n == 1) || wet_locate (ctx, &ids[i], &queries[i], 1)) {
+      group[i]->failed = true;
+      group[i]->error = ctx->error;
+    }
+  }
+}
+
+/* The lookup thread: looks up whatever is waiting in to_locate, as one
+   group, until wet_batch_run() is done. */
+static void *
+locator (void *arg)
+{
+  struct wet_context ctx;
+  struct slot *group[WET_BATCH_WINDOW_MAX];
+  struct slot *list;
+  size_t n;
+  char c;
+
+  wet_context_init (&ctx);
+  for (;;) {
+    pthread_mutex_lock (&lookup_lock);
+    while (!to_locate && !lookups_over)
+      pthread_cond_wait (&lookup_cond, &lookup_lock);
+    list = to_locate;
+    to_locate = NULL;
+    pthread_mutex_unlock (&lookup_lock);
+    if (!list)
+      break;
+
+    for (n = 0; list; list = list->next)
+      group[n++] = list;
+    locate_group (&ctx, group, n);
+
+    pthread_mutex_lock (&lookup_lock);
+    append_slots (&located, group[0]);
+    pthread_mutex_unlock (&lookup_lock);
+    c = 0;
+    while ((write (located_pipe[1], &c, 1) == -1) && (errno == EINTR))
+      ;
+  }
+  return arg;
+}
+
+/* Starts the requests of the slots the lookup thread has handed back. */
+static void
+start_located (void)
+{
+  struct slot *list;
+  struct slot *s;
+  char buf[64];
+
+  while (read (located_pipe[0], buf, sizeof (buf)) > 0)
+    ;
+  pthread_mutex_lock (&lookup_lock);
+  list = located;
+  located = NULL;
+  pthread_mutex_unlock (&lookup_lock);
+
+  while (list) {
+    s = list;
+    list = list->next;
+    n_locating--;
+    if (s->failed) {
+      complete (s);
+      continue;
+    }
+    if (wet_request_start (&s->ctx, &s->request, s->id, finished, s)) {
+      wet_arena_reset (&s->arena);
+      fail (s, &s->ctx.error);
+      continue;
+    }
+    s->state = SLOT_RUNNING;
+    n_running++;
+  }
+}
+
+/* Hands the queries that have been read to the lookup thread, as far as
+   the window allows. */
+static void
+start_queries (struct input *in)
+{
+  struct slot *list;
+  struct slot **tail;
+  struct slot *s;
+
+  list = NULL;
+  tail = &list;
+  while (n_free) {
+    s = free_slots[n_free - 1];
+    if (!take_line (in, s->query))
+      break;
+    if (!trim (s->query))
+      continue;
+    n_free--;
+    s->seq = next_seq++;
+    s->failed = false;
+    s->text = NULL;
+    s->len = 0;
+    s->state = SLOT_LOCATING;
+    s->next = NULL;
+    order[s->seq % options->window] = s;
+    *tail = s;
+    tail = &s->next;
+    n_locating++;
+  }
+  if (list) {
+    pthread_mutex_lock (&lookup_lock);
+    append_slots (&to_locate, list);
+    pthread_cond_signal (&lookup_cond);
+    pthread_mutex_unlock (&lookup_lock);
+  }
+}
+
+/* Gives up every request in flight, which has stopped making progress. */
+static void
+give_up (void)
+{
+  struct wet_error err;
+  size_t i;
+
+  wet_fail (&err, WET_ESYS, "timed out after %d seconds", STALL_TIMEOUT);
+  for (i = 0; i < options->window; ++i) {
+    if (!slots[i].request)
+      continue;
+    wet_request_free (slots[i].request);
+    wet_arena_reset (&slots[i].arena);
+    slots[i].request = NULL;
+    n_running--;
+    fail (&slots[i], &err);
+  }
+}
+
+/* Fetches the weather of every query in SOURCE and writes it out as
+   O says. Returns the exit status: that of the first query that failed,
+   if any did. */
+int
+wet_batch_run (const char *source, const struct wet_batch_options *o)
+{
+  struct input *in;
+  struct pollfd *fds;
+  struct slot **polled;
+  pthread_t thread;
+  size_t refill;
+  size_t i;
+  size_t n;
+  size_t n_requests;
+  size_t input_index;
+  int events;
+  int ready;
+
+  options = o;
+  in = (struct input *) calloc (1, sizeof (struct input));
+  slots = (struct slot *) calloc (o->window, sizeof (struct slot));
+  order = (struct slot **) calloc (o->window, sizeof (struct slot *));
+  free_slots = (struct slot **) calloc (o->window, sizeof (struct slot *));
+  fds = (struct pollfd *) calloc (o->window + 2, sizeof (struct pollfd));
+  polled = (struct slot **) calloc (o->window, sizeof (struct slot *));
+  if (!in || !slots || !order || !free_slots || !fds || !polled)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  in->fd = wet_streq (source, "-") ? STDIN_FILENO : open (source, O_RDONLY);
+  if (in->fd == -1)
+    wet_die (WET_ESYS, "failed to open `%s': %s", source, strerror (errno));
+  for (i = 0; i < o->window; ++i) {
+    free_slots[i] = &slots[o->window - 1 - i];
+    wet_arena_init (&slots[i].arena, WET_ARENA_DOCUMENT_LIMIT);
+    wet_context_init (&slots[i].ctx);
+    slots[i].ctx.metric = o->metric;
+    slots[i].ctx.forecast_days = o->forecast_days;
+    slots[i].ctx.allocator = &slots[i].arena.allocator;
+  }
+  n_free = o->window;
+
+  record_history = wet_history_enabled ();
+  refill = (o->window + 3) / 4;
+
+  if (pipe (located_pipe) == -1)
+    wet_die (WET_ESYS, "failed to create pipe: %s", strerror (errno));
+  fcntl (located_pipe[0], F_SETFL,
+         fcntl (located_pipe[0], F_GETFL) | O_NONBLOCK);
+  if (pthread_create (&thread, NULL, locator, NULL) != 0)
+    wet_die (WET_ESYS, "failed to start the lookup thread");
+
+  for (;;) {
+    if ((n_free >= refill) || (!n_running && !n_locating))
+      start_queries (in);
+    if (in->eof && !n_running && !n_locating && (in->start == in->end))
+      break;
+
+    n = 0;
+    for (i = 0; i < o->window; ++i) {
+      if (!slots[i].request)
+        continue;
+      events = wet_request_events (slots[i].request);
+      fds[n].fd = wet_request_fd (slots[i].request);
+      fds[n].events = ((events & WET_NET_WANT_READ) ? POLLIN : 0) |
+                      ((events & WET_NET_WANT_WRITE) ? POLLOUT : 0);
+      fds[n].revents = 0;
+      polled[n++] = &slots[i];
+    }
+    n_requests = n;
+    /* read more only once what has been read is used up */
+    input_index = SIZE_MAX;
+    if (!in->eof && n_free && (in->end - in->start < INPUT_MAX)) {
+      fds[n].fd = in->fd;
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
+      input_index = n++;
+    }
+    if (n_locating) {
+      fds[n].fd = located_pipe[0];
+      fds[n].events = POLLIN;
+      fds[n].revents = 0;
+      ++n;
+    }
+    /* nothing to wait for: the input has queries left to start */
+    if (!n)
+      continue;
+
+    fflush (stdout);
+    ready = poll (fds, n, n_running ? STALL_TIMEOUT * 1000 : -1);
+    if ((ready == -1) && (errno == EINTR))
+      continue;
+    if (ready == -1)
+      wet_die (WET_ESYS, "poll() failed: %s", strerror (errno));
+    if (!ready) {
+      give_up ();
+      continue;
+    }
+    for (i = 0; i < n_requests; ++i)
+      if (fds[i].revents && polled[i]->request)
+        wet_request_process (polled[i]->request);
+    if ((input_index != SIZE_MAX) && fds[input_index].revents)
+      fill (in);
+    if (n_locating && fds[n - 1].revents)
+      start_located ();
+  }
+
+  pthread_mutex_lock (&lookup_lock);
+  lookups_over = true;
+  pthread_cond_signal (&lookup_cond);
+  pthread_mutex_unlock (&lookup_lock);
+  pthread_join (thread, NULL);
+  close (located_pipe[0]);
+  close (located_pipe[1]);
+
+  fflush (stdout);
+  if (in->fd != STDIN_FILENO)
+    close (in->fd);
+  free (in);
+  for (i = 0; i < o->window; ++i)
+    wet_arena_destroy (&slots[i].arena);
+  free (slots);
+  free (order);
+  free (free_slots);
+  free (fds);
+  free (polled);
+  return status;
+}
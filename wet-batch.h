@@ -0,0 +1,51 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_BATCH_H
+#define WET_BATCH_H
+
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-display.h"
+#include "wet-template.h"
+
+/* how many locations are in flight (or waiting for their turn to be
+   shown) at once, unless --window says otherwise, and the most it can
+   say */
+#define WET_BATCH_WINDOW     64
+#define WET_BATCH_WINDOW_MAX 4096
+
+/* How `wet batch' shows what it fetches: as NDJSON objects, or as text,
+   through TEMPLATE if there is one and DISPLAY otherwise. Results come
+   out in input order unless UNORDERED. */
+struct wet_batch_options {
+  size_t window;
+  bool unordered;
+  bool ndjson;
+  bool metric;
+  unsigned int forecast_days;
+  const struct wet_display *display;
+  const struct wet_template *template;
+};
+
+int wet_batch_run (const char *, const struct wet_batch_options *);
+
+#endif /* WET_BATCH_H */
@@ -0,0 +1,289 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * wet-bench - times repeated invocations of wet against a fixture server.
+ *
+ *   wet-bench [-n RUNS] [-w WARMUP] [-p PORT] -- WET [ARGS...]
+ *
+ * Waits for wet-fixtured to accept connections on 127.0.0.1:PORT, runs
+ * WET with WET_SERVER pointing at it WARMUP times untimed and then RUNS
+ * times timed, and reports the wall time per invocation. Every run gets
+ * an empty data directory of its own and no history, so none of them is
+ * answered from what an earlier one (or the user) left behind.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define DEFAULT_RUNS   100
+#define DEFAULT_WARMUP   3
+#define DEFAULT_PORT  8053
+#define SERVERMAX       32
+#define DIRMAX        1024
+#define CONNECT_TRIES  100
+
+static const char *program_name;
+
+static void
+die (const char *fmt, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "%s: ", program_name);
+  va_start (args, fmt);
+  vfprintf (stderr, fmt, args);
+  va_end (args);
+  fputc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+static long
+parse_number (const char *s, char opt)
+{
+  long n;
+  char *end;
+
+  errno = 0;
+  n = strtol (s, &end, 10);
+  if (errno || end == s || *end || n < 0)
+    die ("invalid argument for -%c: `%s'", opt, s);
+  return n;
+}
+
+static double
+now_ms (void)
+{
+  struct timespec t;
+
+  clock_gettime (CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+/* Gives the fixture server started alongside us time to start listening. */
+static void
+wait_for_server (unsigned short port)
+{
+  int i;
+  int sock;
+  struct sockaddr_in a;
+  struct timespec pause;
+
+  memset (&a, 0, sizeof (a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  a.sin_port = htons (port);
+  pause.tv_sec = 0;
+  pause.tv_nsec = 50000000L;
+
+  for (i = 0; i < CONNECT_TRIES; ++i) {
+    sock = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == -1)
+      die ("failed to create socket: %s", strerror (errno));
+    if (connect (sock, (struct sockaddr *) &a, sizeof (a)) == 0) {
+      close (sock);
+      return;
+    }
+    close (sock);
+    nanosleep (&pause, NULL);
+  }
+  die ("no fixture server listening on 127.0.0.1:%u", port);
+}
+
+/* Creates a fresh, empty directory for one run of wet to keep its data
+   in and writes its path to DIR (DIRMAX bytes). */
+static void
+make_data_dir (char *dir)
+{
+  const char *tmp;
+
+  tmp = getenv ("TMPDIR");
+  if (!tmp || !*tmp)
+    tmp = "/tmp";
+  snprintf (dir, DIRMAX, "%s/wet-bench.XXXXXX", tmp);
+  if (!mkdtemp (dir))
+    die ("failed to create a directory in `%s': %s", tmp, strerror (errno));
+}
+
+/* Removes DIR and whatever the run left in it. */
+static void
+remove_data_dir (const char *dir)
+{
+  DIR *d;
+  struct dirent *e;
+  struct stat st;
+  char path[DIRMAX];
+
+  d = opendir (dir);
+  if (!d)
+    die ("failed to open `%s': %s", dir, strerror (errno));
+  while ((e = readdir (d)) != NULL) {
+    if (!strcmp (e->d_name, ".") || !strcmp (e->d_name, ".."))
+      continue;
+    snprintf (path, DIRMAX, "%s/%s", dir, e->d_name);
+    if (lstat (path, &st) == 0 && S_ISDIR (st.st_mode))
+      remove_data_dir (path);
+    else if (unlink (path) == -1)
+      die ("failed to remove `%s': %s", path, strerror (errno));
+  }
+  closedir (d);
+  if (rmdir (dir) == -1)
+    die ("failed to remove `%s': %s", dir, strerror (errno));
+}
+
+/* Runs ARGV to completion, keeping its data in DIR, with its output
+   discarded and returns whether it exited successfully. */
+static int
+run (char **argv, const char *dir)
+{
+  pid_t pid;
+  int status;
+  int null;
+
+  pid = fork ();
+  if (pid == -1)
+    die ("failed to fork: %s", strerror (errno));
+  if (pid == 0) {
+    null = open ("/dev/null", O_WRONLY);
+    if (null != -1) {
+      dup2 (null, STDOUT_FILENO);
+      dup2 (null, STDERR_FILENO);
+    }
+    setenv ("WET_DATA_DIR", dir, 1);
+    execv (argv[0], argv);
+    _exit (127);
+  }
+  while (waitpid (pid, &status, 0) == -1)
+    if (errno != EINTR)
+      die ("failed to wait for `%s': %s", argv[0], strerror (errno));
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile P of the N sorted samples in S. */
+static double
+percentile (const double *s, size_t n, double p)
+{
+  size_t rank;
+
+  rank = (size_t) (p / 100.0 * n + 0.999999);
+  if (rank < 1)
+    rank = 1;
+  return s[rank - 1];
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  size_t i;
+  size_t runs;
+  size_t warmup;
+  size_t failed;
+  unsigned short port;
+  double start;
+  double *samples;
+  char server[SERVERMAX];
+  char dir[DIRMAX];
+
+  program_name = argv[0];
+  runs = DEFAULT_RUNS;
+  warmup = DEFAULT_WARMUP;
+  port = DEFAULT_PORT;
+  while ((opt = getopt (argc, argv, "n:w:p:")) != -1) {
+    switch (opt) {
+    case 'n':
+      runs = (size_t) parse_number (optarg, opt);
+      break;
+    case 'w':
+      warmup = (size_t) parse_number (optarg, opt);
+      break;
+    case 'p':
+      port = (unsigned short) parse_number (optarg, opt);
+      break;
+    default:
+      fprintf (stderr,
+               "usage: %s [-n RUNS] [-w WARMUP] [-p PORT] -- WET [ARGS...]\n",
+               program_name);
+      return EXIT_FAILURE;
+    }
+  }
+  if (optind == argc || runs == 0)
+    die ("nothing to run");
+
+  snprintf (server, SERVERMAX, "127.0.0.1:%u", port);
+  setenv ("WET_SERVER", server, 1);
+  unsetenv ("WET_HISTORY");
+  wait_for_server (port);
+
+  samples = (double *) malloc (runs * sizeof (double));
+  if (!samples)
+    die ("failed to allocate memory");
+
+  for (i = 0; i < warmup; ++i) {
+    make_data_dir (dir);
+    run (argv + optind, dir);
+    remove_data_dir (dir);
+  }
+
+  failed = 0;
+  for (i = 0; i < runs; ++i) {
+    make_data_dir (dir);
+    start = now_ms ();
+    if (!run (argv + optind, dir))
+      failed++;
+    samples[i] = now_ms () - start;
+    remove_data_dir (dir);
+  }
+  qsort (samples, runs, sizeof (double), compare_double);
+
+  printf ("%zu runs, %zu failed\n", runs, failed);
+  printf ("min %.3f ms  p50 %.3f ms  p99 %.3f ms  max %.3f ms\n",
+          samples[0], percentile (samples, runs, 50.0),
+          percentile (samples, runs, 99.0), samples[runs - 1]);
+  free (samples);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,378 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h> /* memset() */
+
+#include "wet.h"
+#include "wet-display.h"
+#include "wet-util.h"
+#include "wet-weather.h"
+
+/* the arguments for printing a struct wet_view with "%.*s" */
+#define __v(__x) (int) (__x).n, (__x).p
+
+/* Shows nothing; set the fields for what should be shown. */
+void
+wet_display_init (struct wet_display *x)
+{
+  memset (x, 0, sizeof (struct wet_display));
+}
+
+static void
+print_forecast_data (FILE *out, const struct weather *w, size_t day,
+                     bool night, const char *text, ...)
+{
+  va_list ap;
+
+  if (day == 0) {
+    if (night)
+      wet_fputs (out, "tonight");
+    else
+      wet_fputs (out, "today");
+  } else {
+    wet_fputs (out, "%.*s", __v (w->forecasts[day].day_of_week));
+    if (night)
+      wet_fputs (out, " night");
+  }
+  wet_fputs (out, "'s ");
+
+  va_start (ap, text);
+  vfprintf (out, text, ap);
+  va_end (ap);
+  fputc ('\n', out);
+}
+
+/* Writes the parts of W that X asks for to OUT. */
+void
+wet_display (FILE *out, const struct weather *w, const struct wet_display *x)
+{
+  size_t day;
+
+#define __display_uv(__u) \
+  do { \
+    wet_fputs (out, "%.*s", __v (__u.index)); \
+    if (__u.text.n) \
+      wet_fputs (out, " (%.*s)", __v (__u.text)); \
+    fputc ('\n', out); \
+  } while (0)
+
+#define __display_barometer(__b) \
+  do { \
+    wet_fputs (out, "%.*s%.*s", __v (__b.reading), __v (w->units.rainfall)); \
+    if (__b.direction.n) \
+      wet_fputs (out, " (%.*s)", __v (__b.direction)); \
+    fputc ('\n', out); \
+  } while (0)
+
+#define __display_wind(__w, __values) \
+  do { \
+    wet_fputs (out, "%.*sº %.*s", __v (__w.direction), __v (__w.text)); \
+    if (__values.speed > 0) \
+      wet_fputs (out, " %.*s%.*s", __v (__w.speed), __v (w->units.speed)); \
+    if (!wet_view_streqi (__w.gust, "n/a")) \
+      wet_fputs (out, " (%.*s%.*s gusts)", \
+                 __v (__w.gust), __v (w->units.speed)); \
+    fputc ('\n', out); \
+  } while (0)
+
+  if (x->summary) {
+    wet_fputs (out,
+               "%.*s (%.*s, %.*s)\n"
+               "%.*sº%.*s and %.*s (feels like %.*sº%.*s)\n"
+               "today's high    - %.*sº%.*s\n"
+               "today's low     - %.*sº%.*s\n"
+               "visibility      - %.*s%.*s\n"
+               "humidity        - %.*s%%\n"
+               "dew point       - %.*sº%.*s\n"
+               "sunrise         - %.*s\n"
+               "sunset          - %.*s\n",
+               __v (w->location.name), __v (w->location.lat),
+               __v (w->location.lon), __v (w->current_conditions.temperature),
+               __v (w->units.temperature), __v (w->current_conditions.text),
+               __v (w->current_conditions.feels_like),
+               __v (w->units.temperature), __v (w->forecasts[0].high),
+               __v (w->units.temperature), __v (w->forecasts[0].low),
+               __v (w->units.temperature),
+               __v (w->current_conditions.visibility), __v (w->units.distance),
+               __v (w->current_conditions.humidity),
+               __v (w->current_conditions.dewpoint),
+               __v (w->units.temperature), __v (w->forecasts[0].sunrise),
+               __v (w->forecasts[0].sunset));
+    wet_fputs (out, "uv index        - ");
+    __display_uv (w->current_conditions.uv);
+    wet_fputs (out, "pressure        - ");
+    __display_barometer (w->current_conditions.barometer);
+    wet_fputs (out, "wind conditions - ");
+    __display_wind (w->current_conditions.wind, w->values.wind);
+    if (w->severe_weather_alert.text.n) {
+      wet_fputs (out, "\nALERT: %.*s\n\n", __v (w->severe_weather_alert.text));
+      if (w->severe_weather_alert.link.n)
+        wet_fputs (out, "For more info visit:\n%.*s\n",
+                   __v (w->severe_weather_alert.link));
+    }
+    return;
+  }
+
+  if (x->severe_weather_alert) {
+    if (!w->severe_weather_alert.text.n) {
+      wet_fputs (out, "no severe weather alerts\n");
+      return;
+    }
+    wet_fputs (out, "%.*s\n", __v (w->severe_weather_alert.text));
+    wet_fputs (out, "For more info visit:\n%.*s\n",
+               __v (w->severe_weather_alert.link));
+  }
+
+  if (x->current_conditions.all) {
+    wet_fputs (out,
+               "Current Conditions for %.*s\n"
+               "%.*s\n"
+               "----------------\n"
+               "last updated        - %.*s\n"
+               "temperature         - %.*sº%.*s\n"
+               "dew point           - %.*sº%.*s\n"
+               "visibility          - %.*s%.*s\n"
+               "humidity            - %.*s%%\n"
+               "local station       - %.*s\n"
+               "feels like          - %.*sº%.*s\n"
+               "moon                - %.*s\n",
+               __v (w->location.name), __v (w->current_conditions.text),
+               __v (w->current_conditions.last_updated),
+               __v (w->current_conditions.temperature),
+               __v (w->units.temperature),
+               __v (w->current_conditions.dewpoint),
+               __v (w->units.temperature),
+               __v (w->current_conditions.visibility), __v (w->units.distance),
+               __v (w->current_conditions.humidity),
+               __v (w->current_conditions.station),
+               __v (w->current_conditions.feels_like),
+               __v (w->units.temperature),
+               __v (w->current_conditions.moon_phase.text));
+    wet_fputs (out, "uv index            - ");
+    __display_uv (w->current_conditions.uv);
+    wet_fputs (out, "barometric pressure - ");
+    __display_barometer (w->current_conditions.barometer);
+    wet_fputs (out, "wind                - ");
+    __display_wind (w->current_conditions.wind, w->values.wind);
+  }
+
+  if (x->location.all)
+    wet_fputs (out,
+               "%.*s\n"
+               "----------------\n"
+               "latitude  - %.*s\n"
+               "longitude - %.*s\n",
+               __v (w->location.name), __v (w->location.lat),
+               __v (w->location.lon));
+
+  if (x->current_conditions.last_updated)
+    wet_fputs (out, "last updated - %.*s\n",
+               __v (w->current_conditions.last_updated));
+
+  if (x->current_conditions.temperature)
+    wet_fputs (out, "current temperature - %.*sº%.*s\n",
+               __v (w->current_conditions.temperature),
+               __v (w->units.temperature));
+
+  if (x->current_conditions.dewpoint)
+    wet_fputs (out, "current dew point - %.*sº%.*s\n",
+               __v (w->current_conditions.dewpoint),
+               __v (w->units.temperature));
+
+  if (x->current_conditions.text)
+    wet_fputs (out, "%.*s\n", __v (w->current_conditions.text));
+
+  if (x->current_conditions.visibility)
+    wet_fputs (out, "current visibility - %.*s%.*s\n",
+               __v (w->current_conditions.visibility),
+               __v (w->units.distance));
+
+  if (x->current_conditions.humidity)
+    wet_fputs (out, "current humidity - %.*s%%\n",
+               __v (w->current_conditions.humidity));
+
+  if (x->current_conditions.station)
+    wet_fputs (out, "current local station - %.*s\n",
+               __v (w->current_conditions.station));
+
+  if (x->current_conditions.feels_like)
+    wet_fputs (out, "currently feels like - %.*sº%.*s\n",
+               __v (w->current_conditions.feels_like),
+               __v (w->units.temperature));
+
+  if (x->current_conditions.wind) {
+    wet_fputs (out, "current wind conditions - ");
+    __display_wind (w->current_conditions.wind, w->values.wind);
+  }
+
+  if (x->current_conditions.moon_phase)
+    wet_fputs (out, "current moon phase - %.*s\n",
+               __v (w->current_conditions.moon_phase.text));
+
+  if (x->current_conditions.uv) {
+    wet_fputs (out, "current uv index - ");
+    __display_uv (w->current_conditions.uv);
+  }
+
+  if (x->current_conditions.barometer) {
+    wet_fputs (out, "current barometric pressure - ");
+    __display_barometer (w->current_conditions.barometer);
+  }
+
+  if (x->location.lat)
+    wet_fputs (out, "latitude - %.*s\n", __v (w->location.lat));
+
+  if (x->location.lon)
+    wet_fputs (out, "longitude - %.*s\n", __v (w->location.lon));
+
+  if (x->location.name)
+    wet_fputs (out, "location name - %.*s\n", __v (w->location.name));
+
+  /* days the document does not have are not shown */
+  for (day = 0; (day < w->n_forecasts) && (day < WET_FORECAST_DAYS_MAX);
+       ++day) {
+    if (x->forecasts[day].all) {
+      wet_fputs (out, "Forecast for ");
+      if (day == 0)
+        wet_fputs (out, "today (%.*s)", __v (w->forecasts[day].day_of_week));
+      else if (day == 1)
+        wet_fputs (out, "tomorrow (%.*s)",
+                   __v (w->forecasts[day].day_of_week));
+      else
+        wet_fputs (out, "%.*s", __v (w->forecasts[day].day_of_week));
+      if (w->forecasts[day].text.n)
+        wet_fputs (out, " - %.*s", __v (w->forecasts[day].text));
+      wet_fputs (out,
+                 "\n--------------\n"
+                 "high                    - %.*sº%.*s\n"
+                 "low                     - %.*sº%.*s\n"
+                 "sunset                  - %.*s\n"
+                 "sunrise                 - %.*s\n"
+                 "chance of precipitation - %.*s%%\n"
+                 "humidity                - %.*s%%\n"
+                 "wind                    - ",
+                 __v (w->forecasts[day].high), __v (w->units.temperature),
+                 __v (w->forecasts[day].low), __v (w->units.temperature),
+                 __v (w->forecasts[day].sunset),
+                 __v (w->forecasts[day].sunrise),
+                 __v (w->forecasts[day].chance_precip),
+                 __v (w->forecasts[day].humidity));
+      __display_wind (w->forecasts[day].wind, w->values.forecasts[day].wind);
+      fputc ('\n', out);
+      if (day == 0)
+        wet_fputs (out, "  Tonight");
+      else if (day == 1)
+        wet_fputs (out, "  Tomorrow night");
+      else
+        wet_fputs (out, "  %.*s night", __v (w->forecasts[day].day_of_week));
+      if (w->forecasts[day].night.text.n)
+        wet_fputs (out, " - %.*s", __v (w->forecasts[day].night.text));
+      wet_fputs (out,
+                 "\n  --------------\n"
+                 "  chance of precipitation - %.*s%%\n"
+                 "  humidity                - %.*s%%\n"
+                 "  wind                    - ",
+                 __v (w->forecasts[day].night.chance_precip),
+                 __v (w->forecasts[day].night.humidity));
+      __display_wind (w->forecasts[day].night.wind,
+                      w->values.forecasts[day].night.wind);
+      fputc ('\n', out);
+      continue;
+    }
+    if (x->forecasts[day].day_of_week)
+      wet_fputs (out, "%.*s\n", __v (w->forecasts[day].day_of_week));
+    if (x->forecasts[day].high)
+      print_forecast_data (out, w, day, false, "high - %.*sº%.*s",
+                           __v (w->forecasts[day].high),
+                           __v (w->units.temperature));
+    if (x->forecasts[day].low)
+      print_forecast_data (out, w, day, false, "low - %.*sº%.*s",
+                           __v (w->forecasts[day].low),
+                           __v (w->units.temperature));
+    if (x->forecasts[day].sunset)
+      print_forecast_data (out, w, day, false, "sunset - %.*s",
+                           __v (w->forecasts[day].sunset));
+    if (x->forecasts[day].sunrise)
+      print_forecast_data (out, w, day, false, "sunrise - %.*s",
+                           __v (w->forecasts[day].sunrise));
+    if (x->forecasts[day].text)
+      print_forecast_data (out, w, day, false, "%.*s",
+                           __v (w->forecasts[day].text));
+    if (x->forecasts[day].chance_precip)
+      print_forecast_data (out, w, day, false,
+                           "chance of precipitation - %.*s%%",
+                           __v (w->forecasts[day].chance_precip));
+    if (x->forecasts[day].humidity)
+      print_forecast_data (out, w, day, false, "humidity - %.*s%%",
+                           __v (w->forecasts[day].humidity));
+    if (x->forecasts[day].wind) {
+      if (day == 0)
+        wet_fputs (out, "today's wind - ");
+      else
+        wet_fputs (out, "%.*s's wind - ", __v (w->forecasts[day].day_of_week));
+      __display_wind (w->forecasts[day].wind, w->values.forecasts[day].wind);
+    }
+    if (x->forecasts[day].night.all) {
+      wet_fputs (out, "Forecast for ");
+      if (day == 0)
+        wet_fputs (out, "tonight");
+      else if (day == 1)
+        wet_fputs (out, "tomorrow night");
+      else
+        wet_fputs (out, "%.*s night", __v (w->forecasts[day].day_of_week));
+      if (w->forecasts[day].night.text.n)
+        wet_fputs (out, " - %.*s\n", __v (w->forecasts[day].night.text));
+      wet_fputs (out,
+                 "--------------\n"
+                 "chance of precipitation - %.*s%%\n"
+                 "humidity                - %.*s%%\n"
+                 "wind                    - ",
+                 __v (w->forecasts[day].night.chance_precip),
+                 __v (w->forecasts[day].night.humidity));
+      __display_wind (w->forecasts[day].night.wind,
+                      w->values.forecasts[day].night.wind);
+      continue;
+    }
+    if (x->forecasts[day].night.text)
+      print_forecast_data (out, w, day, true, "%.*s",
+                           __v (w->forecasts[day].night.text));
+    if (x->forecasts[day].night.chance_precip)
+      print_forecast_data (out, w, day, true,
+                           "chance of precipitation - %.*s%%",
+                           __v (w->forecasts[day].night.chance_precip));
+    if (x->forecasts[day].night.humidity)
+      print_forecast_data (out, w, day, true, "humidity - %.*s%%",
+                           __v (w->forecasts[day].night.humidity));
+    if (x->forecasts[day].night.wind) {
+      if (day == 0)
+        wet_fputs (out, "tonight");
+      else if (day == 1)
+        wet_fputs (out, "tomorrow night");
+      else
+        wet_fputs (out, "%.*s night", __v (w->forecasts[day].day_of_week));
+      wet_fputs (out, "'s wind - ");
+      __display_wind (w->forecasts[day].night.wind,
+                      w->values.forecasts[day].night.wind);
+    }
+  }
+
+#undef __display_wind
+}
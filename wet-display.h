@@ -0,0 +1,83 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WET_DISPLAY_H
+#define WET_DISPLAY_H
+
+#include <stdio.h>
+
+#include "wet.h"
+#include "wet-weather.h"
+
+/* Which parts of a struct weather to show, an almost mirror image of it.
+   SUMMARY shows the default overview instead of any of the rest. */
+struct wet_display {
+  bool summary;
+  bool location_id;
+  bool severe_weather_alert;
+
+  struct {
+    bool all;
+    bool last_updated;
+    bool temperature;
+    bool dewpoint;
+    bool text;
+    bool visibility;
+    bool humidity;
+    bool station;
+    bool feels_like;
+    bool wind;
+    bool moon_phase;
+    bool uv;
+    bool barometer;
+  } current_conditions;
+
+  struct {
+    bool all;
+    bool lat;
+    bool lon;
+    bool name;
+  } location;
+
+  struct {
+    bool all;
+    bool day_of_week;
+    bool high;
+    bool sunset;
+    bool low;
+    bool sunrise;
+    bool text;
+    bool chance_precip;
+    bool humidity;
+    bool wind;
+
+    struct {
+      bool all;
+      bool text;
+      bool chance_precip;
+      bool humidity;
+      bool wind;
+    } night;
+  } forecasts[WET_FORECAST_DAYS_MAX];
+};
+
+void wet_display_init (struct wet_display *);
+void wet_display (FILE *, const struct weather *, const struct wet_display *);
+
+#endif /* WET_DISPLAY_H */
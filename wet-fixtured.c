@@ -0,0 +1,347 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * wet-fixtured - a loopback HTTP server for exercising wet end to end.
+ *
+ * Serves the recorded documents in DIR (search.xml for search requests,
+ * weather.xml for weather requests) over HTTP/1.1 keep-alive connections,
+ * answering pipelined requests in order. Point wet at it with
+ * WET_SERVER=127.0.0.1:PORT. The network can be made worse on purpose:
+ *
+ *   -l MS     sleep MS milliseconds before each response
+ *   -b BYTES  limit each connection to BYTES bytes per second
+ *   -c BYTES  write responses BYTES at a time (one segment per write)
+ *   -C        close the connection after every response
+ *
+ * Only meant for tests and benchmarks: it listens on 127.0.0.1 only.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define DEFAULT_PORT 8053
+#define DEFAULT_DIR  "fixtures"
+#define REQUESTMAX   8192
+#define HEADERMAX     256
+#define PATHMAX       512
+
+struct fixture {
+  const char *prefix;
+  const char *file;
+  char *data;
+  size_t n;
+};
+
+static const char *program_name;
+static const char *fixture_dir = DEFAULT_DIR;
+static unsigned short port = DEFAULT_PORT;
+static long latency;
+static long bandwidth;
+static size_t chunk;
+static bool close_each;
+
+static struct fixture fixtures[] = {
+  { "/wxdata/search/search", "search.xml", NULL, 0 },
+  { "/wxdata/weather/local/", "weather.xml", NULL, 0 }
+};
+
+#define N_FIXTURES (sizeof (fixtures) / sizeof (fixtures[0]))
+
+static void
+die (const char *fmt, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "%s: ", program_name);
+  va_start (args, fmt);
+  vfprintf (stderr, fmt, args);
+  va_end (args);
+  fputc ('\n', stderr);
+  exit (EXIT_FAILURE);
+}
+
+static long
+parse_number (const char *s, char opt)
+{
+  long n;
+  char *end;
+
+  errno = 0;
+  n = strtol (s, &end, 10);
+  if (errno || end == s || *end || n < 0)
+    die ("invalid argument for -%c: `%s'", opt, s);
+  return n;
+}
+
+static void
+sleep_ns (long long ns)
+{
+  struct timespec t;
+
+  t.tv_sec = ns / 1000000000LL;
+  t.tv_nsec = ns % 1000000000LL;
+  while (nanosleep (&t, &t) == -1 && errno == EINTR)
+    ;
+}
+
+static void
+load_fixture (struct fixture *f)
+{
+  char path[PATHMAX];
+  FILE *fp;
+  long n;
+
+  snprintf (path, PATHMAX, "%s/%s", fixture_dir, f->file);
+  fp = fopen (path, "rb");
+  if (!fp)
+    die ("failed to open `%s': %s", path, strerror (errno));
+  if (fseek (fp, 0, SEEK_END) == -1 || (n = ftell (fp)) < 0)
+    die ("failed to read `%s': %s", path, strerror (errno));
+  rewind (fp);
+  f->data = (char *) malloc (n ? n : 1);
+  if (!f->data)
+    die ("failed to allocate memory");
+  if (fread (f->data, 1, n, fp) != (size_t) n)
+    die ("failed to read `%s'", path);
+  f->n = (size_t) n;
+  fclose (fp);
+}
+
+/* Writes N bytes of P, at most CHUNK bytes per write() and no faster
+   than BANDWIDTH bytes per second. */
+static bool
+send_paced (int fd, const char *p, size_t n)
+{
+  size_t step;
+  size_t k;
+  ssize_t n_write;
+
+  if (chunk)
+    step = chunk;
+  else if (bandwidth)
+    step = bandwidth / 100 ? bandwidth / 100 : 1;
+  else
+    step = n;
+
+  while (n) {
+    k = n < step ? n : step;
+    n -= k;
+    while (k) {
+      n_write = write (fd, p, k);
+      if (n_write < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      p += n_write;
+      k -= n_write;
+    }
+    if (bandwidth && n)
+      sleep_ns ((long long) step * 1000000000LL / bandwidth);
+  }
+  return true;
+}
+
+static const struct fixture *
+find_fixture (const char *path)
+{
+  size_t i;
+
+  for (i = 0; i < N_FIXTURES; ++i)
+    if (strncmp (path, fixtures[i].prefix, strlen (fixtures[i].prefix)) == 0)
+      return &fixtures[i];
+  return NULL;
+}
+
+static bool
+respond (int fd, const char *request)
+{
+  char path[PATHMAX];
+  char header[HEADERMAX];
+  const struct fixture *f;
+  int n;
+
+  if (sscanf (request, "GET %511s HTTP/1.", path) != 1)
+    f = NULL;
+  else
+    f = find_fixture (path);
+
+  n = snprintf (header, HEADERMAX,
+                "HTTP/1.1 %s\r\n"
+                "Content-Type: text/xml\r\n"
+                "Content-Length: %zu\r\n"
+                "%s\r\n",
+                f ? "200 OK" : "404 Not Found",
+                f ? f->n : 0,
+                close_each ? "Connection: close\r\n" : "");
+
+  if (latency)
+    sleep_ns ((long long) latency * 1000000LL);
+  if (!send_paced (fd, header, n))
+    return false;
+  return !f || send_paced (fd, f->data, f->n);
+}
+
+/* Answers requests on FD, in order, until the client hangs up. */
+static void
+serve (int fd)
+{
+  char buf[REQUESTMAX + 1];
+  size_t len;
+  ssize_t n_read;
+  char *end;
+  int one;
+
+  one = 1;
+  setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+  len = 0;
+  for (;;) {
+    buf[len] = '\0';
+    end = strstr (buf, "\r\n\r\n");
+    if (!end) {
+      if (len == REQUESTMAX)
+        return;
+      n_read = read (fd, buf + len, REQUESTMAX - len);
+      if (n_read < 0 && errno == EINTR)
+        continue;
+      if (n_read <= 0)
+        return;
+      len += n_read;
+      continue;
+    }
+    end += 4;
+    if (!respond (fd, buf) || close_each)
+      return;
+    len -= end - buf;
+    memmove (buf, end, len);
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  int opt;
+  int sock;
+  int client;
+  pid_t pid;
+  int one;
+  size_t i;
+  struct sockaddr_in a;
+  socklen_t a_len;
+  struct sigaction sa;
+
+  program_name = argv[0];
+  while ((opt = getopt (argc, argv, "p:d:l:b:c:C")) != -1) {
+    switch (opt) {
+    case 'p':
+      port = (unsigned short) parse_number (optarg, opt);
+      break;
+    case 'd':
+      fixture_dir = optarg;
+      break;
+    case 'l':
+      latency = parse_number (optarg, opt);
+      break;
+    case 'b':
+      bandwidth = parse_number (optarg, opt);
+      break;
+    case 'c':
+      chunk = (size_t) parse_number (optarg, opt);
+      break;
+    case 'C':
+      close_each = true;
+      break;
+    default:
+      fprintf (stderr,
+               "usage: %s [-p PORT] [-d DIR] [-l MS] [-b BYTES] [-c BYTES] "
+               "[-C]\n", program_name);
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < N_FIXTURES; ++i)
+    load_fixture (&fixtures[i]);
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = SIG_IGN;
+  sa.sa_flags = SA_NOCLDWAIT;
+  sigaction (SIGCHLD, &sa, NULL);
+  sa.sa_flags = 0;
+  sigaction (SIGPIPE, &sa, NULL);
+
+  sock = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock == -1)
+    die ("failed to create socket: %s", strerror (errno));
+  one = 1;
+  setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+  memset (&a, 0, sizeof (a));
+  a.sin_family = AF_INET;
+  a.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  a.sin_port = htons (port);
+  if (bind (sock, (struct sockaddr *) &a, sizeof (a)) == -1)
+    die ("failed to bind port %u: %s", port, strerror (errno));
+  if (listen (sock, SOMAXCONN) == -1)
+    die ("failed to listen: %s", strerror (errno));
+
+  a_len = sizeof (a);
+  getsockname (sock, (struct sockaddr *) &a, &a_len);
+  printf ("%s: listening on 127.0.0.1:%u\n",
+          program_name, ntohs (a.sin_port));
+  fflush (stdout);
+
+  for (;;) {
+    client = accept (sock, NULL, NULL);
+    if (client == -1) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      die ("failed to accept: %s", strerror (errno));
+    }
+    pid = fork ();
+    if (pid == -1)
+      die ("failed to fork: %s", strerror (errno));
+    if (pid == 0) {
+      close (sock);
+      serve (client);
+      close (client);
+      _exit (EXIT_SUCCESS);
+    }
+    close (client);
+  }
+}
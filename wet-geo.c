@@ -0,0 +1,430 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The nearest-location index lets `wet @LAT,LON' pick a location ID
+ * without a search request. It lives in INDEX_FILE in the data directory
+ * and is laid out so that it can be mapped and searched in place:
+ *
+ *   struct geo_header, then `n' struct geo_node
+ *
+ * The nodes form an implicit k-d tree over each location's position on
+ * the unit sphere: the root of any range of nodes is its middle node,
+ * split on axis (depth % 3), with the nodes before it on the low side
+ * and the ones after it on the high side. Straight-line distance between
+ * points on the sphere grows with great-circle distance, so the nearest
+ * node in 3-space is also the nearest location on the globe.
+ *
+ * The file is native-endian; it is a local cache, not an exchange format.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "wet-geo.h"
+#include "wet-util.h"
+
+#define INDEX_FILE  "locations.kdt"
+#define INDEX_MAGIC "WETKDT1"
+#define LINEMAX     512
+
+#define DEG2RAD(__d) ((__d) * 3.14159265358979323846 / 180.0)
+
+struct geo_header {
+  char magic[8];
+  size_t n;
+  size_t reserved;
+};
+
+struct geo_node {
+  double p[3];
+  struct wet_place place;
+};
+
+static void
+place_to_node (const struct wet_place *place, struct geo_node *node)
+{
+  double lat;
+  double lon;
+
+  lat = DEG2RAD (place->lat);
+  lon = DEG2RAD (place->lon);
+  node->p[0] = cos (lat) * cos (lon);
+  node->p[1] = cos (lat) * sin (lon);
+  node->p[2] = sin (lat);
+  node->place = *place;
+}
+
+static double
+distance2 (const double *a, const double *b)
+{
+  double dx;
+  double dy;
+  double dz;
+
+  dx = a[0] - b[0];
+  dy = a[1] - b[1];
+  dz = a[2] - b[2];
+  return dx * dx + dy * dy + dz * dz;
+}
+
+/* Maps the index into B and returns its nodes, or returns NULL (with B
+   empty) if there is no usable index yet. */
+static const struct geo_node *
+map_index (struct wet_buffer *b, size_t *n)
+{
+  char *path;
+  const struct geo_header *h;
+  size_t max;
+
+  b->p = NULL;
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = NULL;
+  *n = 0;
+
+  path = wet_data_path (INDEX_FILE);
+  if (!path)
+    return NULL;
+  if ((access (path, R_OK) == -1) || !wet_buffer_map (b, path)) {
+    free (path);
+    return NULL;
+  }
+  free (path);
+
+  h = (const struct geo_header *) b->p;
+  max = (b->n - sizeof (struct geo_header)) / sizeof (struct geo_node);
+  if ((b->n < sizeof (struct geo_header)) ||
+      (memcmp (h->magic, INDEX_MAGIC, sizeof (h->magic)) != 0) ||
+      (h->n > max)) {
+    wet_debug ("ignoring unreadable location index");
+    wet_buffer_free (b);
+    return NULL;
+  }
+  *n = h->n;
+  return (const struct geo_node *) (b->p + sizeof (struct geo_header));
+}
+
+static void
+search (const struct geo_node *nodes, size_t n, int axis, const double *q,
+        const struct geo_node **best, double *best_d)
+{
+  size_t mid;
+  double d;
+  double diff;
+
+  while (n) {
+    mid = n / 2;
+    d = distance2 (nodes[mid].p, q);
+    if (d < *best_d) {
+      *best = &nodes[mid];
+      *best_d = d;
+    }
+    diff = q[axis] - nodes[mid].p[axis];
+    axis = (axis + 1) % 3;
+    /* descend into the near side first, so that the best match is
+       already close by the time the far side is considered, and only
+       look at the far side if the splitting plane is closer than it */
+    if (diff < 0) {
+      search (nodes, mid, axis, q, best, best_d);
+      if (diff * diff >= *best_d)
+        return;
+      nodes += mid + 1;
+      n -= mid + 1;
+    } else {
+      search (nodes + mid + 1, n - mid - 1, axis, q, best, best_d);
+      if (diff * diff >= *best_d)
+        return;
+      n = mid;
+    }
+  }
+}
+
+/* Parses "@LAT,LON" (decimal degrees) into LAT and LON. */
+bool
+wet_geo_parse_coordinates (const char *s, double *lat, double *lon)
+{
+  char *end;
+
+  if (*s++ != '@')
+    return false;
+  errno = 0;
+  *lat = strtod (s, &end);
+  if (errno || end == s || *end != ',')
+    return false;
+  s = end + 1;
+  *lon = strtod (s, &end);
+  if (errno || end == s || *end)
+    return false;
+  return (*lat >= -90.0) && (*lat <= 90.0) &&
+         (*lon >= -180.0) && (*lon <= 180.0);
+}
+
+/* Stores the known location nearest to LAT,LON in PLACE. Returns false if
+   no locations are known yet. */
+bool
+wet_geo_nearest (double lat, double lon, struct wet_place *place)
+{
+  struct wet_buffer b;
+  const struct geo_node *nodes;
+  const struct geo_node *best;
+  struct geo_node q;
+  struct wet_place p;
+  double best_d;
+  size_t n;
+
+  nodes = map_index (&b, &n);
+  if (!n) {
+    wet_buffer_free (&b);
+    return false;
+  }
+
+  p.lat = lat;
+  p.lon = lon;
+  place_to_node (&p, &q);
+  best = NULL;
+  best_d = HUGE_VAL;
+  search (nodes, n, 0, q.p, &best, &best_d);
+  *place = best->place;
+  wet_buffer_free (&b);
+  return true;
+}
+
+static int
+compare_x (const void *a, const void *b)
+{
+  double d = ((const struct geo_node *) a)->p[0] -
+             ((const struct geo_node *) b)->p[0];
+  return (d > 0) - (d < 0);
+}
+
+static int
+compare_y (const void *a, const void *b)
+{
+  double d = ((const struct geo_node *) a)->p[1] -
+             ((const struct geo_node *) b)->p[1];
+  return (d > 0) - (d < 0);
+}
+
+static int
+compare_z (const void *a, const void *b)
+{
+  double d = ((const struct geo_node *) a)->p[2] -
+             ((const struct geo_node *) b)->p[2];
+  return (d > 0) - (d < 0);
+}
+
+static int
+compare_id (const void *a, const void *b)
+{
+  return strcmp (((const struct geo_node *) a)->place.id,
+                 ((const struct geo_node *) b)->place.id);
+}
+
+static void
+build (struct geo_node *nodes, size_t n, int axis)
+{
+  static int (*const compare[3]) (const void *, const void *) = {
+    compare_x, compare_y, compare_z
+  };
+  size_t mid;
+
+  while (n > 1) {
+    qsort (nodes, n, sizeof (struct geo_node), compare[axis]);
+    mid = n / 2;
+    axis = (axis + 1) % 3;
+    build (nodes, mid, axis);
+    nodes += mid + 1;
+    n -= mid + 1;
+  }
+}
+
+/* Adds the N locations in PLACES to the index (replacing any it already
+   has under the same IDs) and rewrites it. The index is left alone if
+   nothing would change, which is the usual case. It stays locked from
+   the time it is read until the new one is in place, so that concurrent
+   writers do not lose each other's locations. */
+bool
+wet_geo_add (const struct wet_place *places, size_t n)
+{
+  struct wet_buffer b;
+  const struct geo_node *old;
+  struct geo_header *h;
+  struct geo_node *nodes;
+  struct geo_node *found;
+  struct geo_node key;
+  size_t n_old;
+  size_t n_nodes;
+  size_t n_unique;
+  size_t i;
+  char *data;
+  char *path;
+  int lock;
+  bool changed;
+  bool ok;
+
+  if (!n)
+    return true;
+
+  path = wet_data_path (INDEX_FILE);
+  if (!path)
+    return false;
+  lock = wet_lock_file (path);
+  if (lock == -1) {
+    free (path);
+    return false;
+  }
+  old = map_index (&b, &n_old);
+  data = (char *) malloc (sizeof (struct geo_header) +
+                          (n_old + n) * sizeof (struct geo_node));
+  if (!data) {
+    wet_buffer_free (&b);
+    wet_unlock_file (lock);
+    free (path);
+    return false;
+  }
+  h = (struct geo_header *) data;
+  nodes = (struct geo_node *) (data + sizeof (struct geo_header));
+  if (n_old)
+    memcpy (nodes, old, n_old * sizeof (struct geo_node));
+  wet_buffer_free (&b);
+
+  qsort (nodes, n_old, sizeof (struct geo_node), compare_id);
+  n_nodes = n_old;
+  changed = false;
+  for (i = 0; i < n; ++i) {
+    if (!*places[i].id)
+      continue;
+    place_to_node (&places[i], &key);
+    found = (struct geo_node *) bsearch (&key, nodes, n_old,
+                                         sizeof (struct geo_node), compare_id);
+    if (found) {
+      if ((found->place.lat == key.place.lat) &&
+          (found->place.lon == key.place.lon) &&
+          wet_streq (found->place.name, key.place.name))
+        continue;
+      *found = key;
+    } else
+      nodes[n_nodes++] = key;
+    changed = true;
+  }
+
+  ok = true;
+  if (changed) {
+    /* collapse any ID that was given more than once in PLACES */
+    qsort (nodes, n_nodes, sizeof (struct geo_node), compare_id);
+    for (i = 1, n_unique = 1; i < n_nodes; ++i)
+      if (!wet_streq (nodes[i].place.id, nodes[n_unique - 1].place.id))
+        nodes[n_unique++] = nodes[i];
+    n_nodes = n_unique;
+    build (nodes, n_nodes, 0);
+
+    memset (h, 0, sizeof (struct geo_header));
+    memcpy (h->magic, INDEX_MAGIC, sizeof (h->magic));
+    h->n = n_nodes;
+    ok = wet_replace_file (path, data, sizeof (struct geo_header) +
+                           n_nodes * sizeof (struct geo_node));
+  }
+  free (data);
+  wet_unlock_file (lock);
+  free (path);
+  return ok;
+}
+
+/* Adds the locations listed in the file at PATH ("-" for standard input)
+   to the index. Each line holds an ID, a latitude, a longitude and a
+   name, separated by whitespace (the name runs to the end of the line);
+   blank lines and lines starting with `#' are skipped. Returns false,
+   with ERR saying why, if the list cannot be read or the index cannot
+   be updated. */
+bool
+wet_geo_import (const char *path, struct wet_error *err)
+{
+  FILE *fp;
+  char line[LINEMAX];
+  struct wet_place *places;
+  struct wet_place *p;
+  size_t n;
+  size_t size;
+  size_t lineno;
+  int name;
+  bool ok;
+
+  fp = wet_streq (path, "-") ? stdin : fopen (path, "r");
+  if (!fp)
+    return wet_fail (err, WET_ESYS, "failed to open `%s': %s", path,
+                     strerror (errno));
+
+  n = 0;
+  size = 256;
+  places = (struct wet_place *) malloc (size * sizeof (struct wet_place));
+  ok = (places != NULL);
+  if (!ok)
+    wet_fail (err, WET_ESYS, "failed to allocate memory");
+
+  for (lineno = 1; ok && fgets (line, LINEMAX, fp); ++lineno) {
+    line[strcspn (line, "\r\n")] = '\0';
+    for (name = 0; isspace ((unsigned char) line[name]); ++name)
+      ;
+    if (!line[name] || line[name] == '#')
+      continue;
+    if (n == size) {
+      size *= 2;
+      p = (struct wet_place *) realloc (places,
+                                        size * sizeof (struct wet_place));
+      if (!p) {
+        ok = wet_fail (err, WET_ESYS, "failed to allocate memory");
+        break;
+      }
+      places = p;
+    }
+    p = &places[n];
+    name = 0;
+    if ((sscanf (line, " %15s %lf %lf %n", p->id, &p->lat, &p->lon,
+                 &name) < 3) ||
+        (p->lat < -90.0) || (p->lat > 90.0) ||
+        (p->lon < -180.0) || (p->lon > 180.0)) {
+      ok = wet_fail (err, WET_EOP,
+                     "%s:%zu: expected `ID LATITUDE LONGITUDE NAME'",
+                     path, lineno);
+      break;
+    }
+    snprintf (p->name, WET_PLACE_NAME_MAX, "%s", line + name);
+    n++;
+  }
+  if (fp != stdin)
+    fclose (fp);
+
+  if (ok && !wet_geo_add (places, n))
+    ok = wet_fail (err, WET_ESYS, "failed to update the location index");
+  free (places);
+  return ok;
+}
@@ -0,0 +1,45 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_GEO_H
+#define WET_GEO_H
+
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-util.h"
+
+#define WET_PLACE_ID_MAX   16
+#define WET_PLACE_NAME_MAX 64
+
+/* A location wet has seen, as stored in the nearest-location index. */
+struct wet_place {
+  char id[WET_PLACE_ID_MAX];
+  char name[WET_PLACE_NAME_MAX];
+  double lat;
+  double lon;
+};
+
+bool wet_geo_parse_coordinates (const char *, double *, double *);
+bool wet_geo_nearest (double, double, struct wet_place *);
+bool wet_geo_add (const struct wet_place *, size_t);
+bool wet_geo_import (const char *, struct wet_error *);
+
+#endif /* WET_GEO_H */
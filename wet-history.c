@@ -0,0 +1,921 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The observation history is kept per location, in HISTORY_DIR/ID inside
+ * the data directory. The newest samples are kept as one append-only
+ * file per column:
+ *
+ *   time.i64         seconds since the epoch, as int64_t
+ *   <column>.f32     one float per sample (see column_names), NaN when
+ *                    the observation did not report it and +Inf when it
+ *                    reported it as unlimited (see wet_weather_tenths())
+ *
+ * These files hold nothing but the native-endian values. Every sample
+ * appends to all of them while holding wet_lock_file() on time.i64 (an
+ * flock on time.i64.lock, which keeps out other threads too and, unlike
+ * a lock on time.i64 itself, is not dropped when a column is mapped and
+ * unmapped), so concurrent writers never interleave, and readers hold
+ * wet_lock_file_shared() on it until they have copied the samples out;
+ * should a writer die half way, readers use only as many samples as
+ * every column has.
+ *
+ * Once BLOCK_SAMPLES samples have piled up, the writer seals them into a
+ * compressed block at the end of BLOCK_FILE and empties the columns. A
+ * block is a struct block_header followed by the encoded time column and
+ * then each value column:
+ *
+ *   time             the delta of the delta between successive times, as
+ *                    zigzag varints (nothing at all for the first time,
+ *                    which is t_min); samples taken at a steady rate
+ *                    cost one byte each
+ *   values           the difference between successive values in tenths,
+ *                    as zigzag varints, with NO_TENTHS standing for NaN;
+ *                    a column holding the same value (or nothing known)
+ *                    throughout is stored as no bytes at all, and one
+ *                    whose values are not all whole tenths as plain floats
+ *
+ * The header carries the time span and each column's range, so that a
+ * reader can skip a block without decoding it. The times of a history
+ * ascend (a sample taken after the clock went back gets a time just past
+ * the last one), which also tells the samples of a seal that was cut
+ * short from new ones: whatever the columns hold up to the last block's
+ * t_max is already in a block.
+ *
+ * Recording is off unless WET_HISTORY is set to a non-empty value.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "wet-history.h"
+
+#define HISTORY_DIR  "history"
+#define TIME_COLUMN  "time.i64"
+#define COLUMN_EXT   ".f32"
+#define BLOCK_FILE   "blocks.whb"
+#define PATHMAX      1024
+#define LANES           8
+
+#define BLOCK_MAGIC   0x31424857 /* "WHB1" */
+#define BLOCK_SAMPLES 1024
+#define NO_TENTHS     ((int64_t) INT32_MIN)
+/* the longest a varint can be */
+#define VARINT_MAX    10
+
+struct block_header {
+  uint32_t magic;
+  uint32_t n;       /* samples */
+  uint32_t size;    /* bytes of encoded columns after the header */
+  uint32_t raw;     /* bit c set: column c is stored as plain floats */
+  uint32_t sizes[WET_HISTORY_COLUMNS + 1]; /* time, then each column */
+  int64_t t_min;
+  int64_t t_max;
+  float min[WET_HISTORY_COLUMNS]; /* NaN when nothing is known */
+  float max[WET_HISTORY_COLUMNS];
+};
+
+static const char *column_names[WET_HISTORY_COLUMNS] = {
+  "temperature",
+  "dewpoint",
+  "humidity",
+  "pressure",
+  "wind-speed",
+  "wind-gust",
+  "visibility"
+};
+
+const char *
+wet_history_column_name (enum wet_history_column c)
+{
+  return column_names[c];
+}
+
+bool
+wet_history_enabled (void)
+{
+  char *e;
+
+  e = wet_getenv ("WET_HISTORY");
+  return e && *e;
+}
+
+/* Writes the path of FILE in the history of location ID to PATH, or
+   returns false if ID cannot be used as a directory name. */
+static bool
+history_path (char *path, const char *id, const char *file)
+{
+  char *dir;
+
+  if (!*id || *id == '.' || strchr (id, '/'))
+    return false;
+  dir = wet_data_path (HISTORY_DIR);
+  if (!dir)
+    return false;
+  snprintf (path, PATHMAX, "%s/%s%s%s", dir, id, *file ? "/" : "", file);
+  free (dir);
+  return true;
+}
+
+static void
+sample_values (const struct weather *w, float *values)
+{
+  const struct weather_values *v;
+
+  v = &w->values;
+  values[WET_HISTORY_TEMPERATURE] =
+    (float) wet_weather_tenths (v->temperature);
+  values[WET_HISTORY_DEWPOINT] = (float) wet_weather_tenths (v->dewpoint);
+  values[WET_HISTORY_HUMIDITY] = (float) wet_weather_byte (v->humidity);
+  values[WET_HISTORY_PRESSURE] = (float) wet_weather_tenths (v->pressure);
+  values[WET_HISTORY_WIND_SPEED] = (float) wet_weather_tenths (v->wind.speed);
+  values[WET_HISTORY_WIND_GUST] = (float) wet_weather_tenths (v->wind.gust);
+  values[WET_HISTORY_VISIBILITY] =
+    (float) wet_weather_tenths (v->visibility);
+}
+
+static bool
+append (int fd, const void *p, size_t n)
+{
+  ssize_t n_write;
+
+  while (n) {
+    n_write = write (fd, p, n);
+    if (n_write < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p = (const char *) p + n_write;
+    n -= n_write;
+  }
+  return true;
+}
+
+/* Makes the column open as FD hold exactly N samples, which it already
+   does unless an earlier writer died half way through a sample (or the
+   column is newer than the history): the excess is dropped and missing
+   samples are filled in as unknown. */
+static bool
+align_column (int fd, size_t n)
+{
+  struct stat st;
+  size_t have;
+  float unknown;
+
+  if (fstat (fd, &st) == -1)
+    return false;
+  have = st.st_size / sizeof (float);
+  if (have > n)
+    have = n;
+  if (((size_t) st.st_size != have * sizeof (float)) &&
+      (ftruncate (fd, have * sizeof (float)) == -1))
+    return false;
+  unknown = NAN;
+  for (; have < n; ++have)
+    if (!append (fd, &unknown, sizeof (float)))
+      return false;
+  return true;
+}
+
+static uint64_t
+zigzag (int64_t v)
+{
+  return ((uint64_t) v << 1) ^ (uint64_t) -(v < 0);
+}
+
+static int64_t
+unzigzag (uint64_t u)
+{
+  return (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+}
+
+static size_t
+put_varint (unsigned char *p, uint64_t u)
+{
+  size_t n;
+
+  for (n = 0; u >= 0x80; u >>= 7)
+    p[n++] = (unsigned char) (u | 0x80);
+  p[n++] = (unsigned char) u;
+  return n;
+}
+
+/* Reads the varint at P into U, or returns NULL if it runs past END. */
+static const unsigned char *
+get_varint (const unsigned char *p, const unsigned char *end, uint64_t *u)
+{
+  uint64_t v;
+  int shift;
+
+  /* nearly every delta fits in one byte */
+  if ((p < end) && (*p < 0x80)) {
+    *u = *p;
+    return p + 1;
+  }
+  v = 0;
+  for (shift = 0; (p < end) && (shift < 64); shift += 7) {
+    v |= (uint64_t) (*p & 0x7f) << shift;
+    if (!(*p++ & 0x80)) {
+      *u = v;
+      return p;
+    }
+  }
+  return NULL;
+}
+
+/* V in tenths, or NO_TENTHS if it is unknown. */
+static int64_t
+tenths_code (float v)
+{
+  if (v != v)
+    return NO_TENTHS;
+  return (int64_t) lrintf (v * 10.0f);
+}
+
+/* The inverse of tenths_code(), computed just as wet_weather_tenths()
+   does. */
+static float
+code_value (int64_t code)
+{
+  if (code == NO_TENTHS)
+    return NAN;
+  return (float) (code / 10.0);
+}
+
+/* Whether every value of X (N of them) comes back bit for bit from its
+   tenths. */
+static bool
+whole_tenths (const float *x, size_t n)
+{
+  float v;
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    if (x[i] != x[i])
+      continue;
+    if (!(fabsf (x[i]) < 1e8f))
+      return false;
+    v = code_value (tenths_code (x[i]));
+    if (memcmp (&v, &x[i], sizeof (float)) != 0)
+      return false;
+  }
+  return true;
+}
+
+/* Whether all N values of X are the same, bit for bit. */
+static bool
+constant (const float *x, size_t n)
+{
+  size_t i;
+
+  for (i = 1; i < n; ++i)
+    if (memcmp (&x[i], &x[0], sizeof (float)) != 0)
+      return false;
+  return true;
+}
+
+/* The most bytes encode_block() writes for N samples. */
+static size_t
+block_bound (size_t n)
+{
+  return sizeof (struct block_header) +
+         n * VARINT_MAX * (WET_HISTORY_COLUMNS + 1);
+}
+
+/* Encodes the N samples at TIME and VALUES into a block at OUT, which
+   must have room for block_bound (N) bytes, and returns its length. */
+static size_t
+encode_block (unsigned char *out, const int64_t *time,
+              const float *const *values, size_t n)
+{
+  struct block_header bh;
+  unsigned char *body;
+  unsigned char *p;
+  unsigned char *start;
+  const float *x;
+  int64_t delta;
+  int64_t prev;
+  int64_t code;
+  size_t known;
+  size_t i;
+  int c;
+
+  memset (&bh, 0, sizeof (struct block_header));
+  bh.magic = BLOCK_MAGIC;
+  bh.n = (uint32_t) n;
+  bh.t_min = time[0];
+  bh.t_max = time[n - 1];
+  body = out + sizeof (struct block_header);
+
+  p = body;
+  prev = 0;
+  for (i = 1; i < n; ++i) {
+    delta = time[i] - time[i - 1];
+    p += put_varint (p, zigzag (delta - prev));
+    prev = delta;
+  }
+  bh.sizes[0] = (uint32_t) (p - body);
+
+  for (c = 0; c < WET_HISTORY_COLUMNS; ++c) {
+    x = values[c];
+    bh.min[c] = INFINITY;
+    bh.max[c] = -INFINITY;
+    known = 0;
+    for (i = 0; i < n; ++i) {
+      bh.min[c] = (x[i] < bh.min[c]) ? x[i] : bh.min[c];
+      bh.max[c] = (x[i] > bh.max[c]) ? x[i] : bh.max[c];
+      known += (x[i] == x[i]);
+    }
+    if (!known)
+      bh.min[c] = bh.max[c] = NAN;
+
+    start = p;
+    if (!known || constant (x, n))
+      ; /* no bytes: every value is bh.min[c] */
+    else if (whole_tenths (x, n)) {
+      prev = 0;
+      for (i = 0; i < n; ++i) {
+        code = tenths_code (x[i]);
+        p += put_varint (p, zigzag (code - prev));
+        prev = code;
+      }
+    } else {
+      bh.raw |= 1u << c;
+      memcpy (p, x, n * sizeof (float));
+      p += n * sizeof (float);
+    }
+    bh.sizes[c + 1] = (uint32_t) (p - start);
+  }
+
+  bh.size = (uint32_t) (p - body);
+  memcpy (out, &bh, sizeof (struct block_header));
+  return (size_t) (p - out);
+}
+
+/* Decodes the block with header BH and encoded columns at BODY into TIME
+   and VALUES, which must have room for BH->n samples. */
+static bool
+decode_block (const struct block_header *bh, const unsigned char *body,
+              int64_t *time, float *const *values)
+{
+  const unsigned char *p;
+  const unsigned char *end;
+  float *x;
+  uint64_t u;
+  int64_t t;
+  int64_t delta;
+  int64_t code;
+  size_t n;
+  size_t i;
+  int c;
+
+  n = bh->n;
+  p = body;
+  end = p + bh->sizes[0];
+  t = bh->t_min;
+  delta = 0;
+  time[0] = t;
+  for (i = 1; i < n; ++i) {
+    p = get_varint (p, end, &u);
+    if (!p)
+      return false;
+    delta += unzigzag (u);
+    t += delta;
+    time[i] = t;
+  }
+  if (p != end)
+    return false;
+
+  for (c = 0; c < WET_HISTORY_COLUMNS; ++c) {
+    x = values[c];
+    end = p + bh->sizes[c + 1];
+    if (bh->raw & (1u << c)) {
+      if (bh->sizes[c + 1] != n * sizeof (float))
+        return false;
+      memcpy (x, p, n * sizeof (float));
+      p = end;
+      continue;
+    }
+    if (p == end) {
+      for (i = 0; i < n; ++i)
+        x[i] = bh->min[c];
+      continue;
+    }
+    code = 0;
+    for (i = 0; i < n; ++i) {
+      p = get_varint (p, end, &u);
+      if (!p)
+        return false;
+      code += unzigzag (u);
+      x[i] = code_value (code);
+    }
+    if (p != end)
+      return false;
+  }
+  return true;
+}
+
+/* Reads the header of the block at P, with N bytes left in the file,
+   into BH. Returns false if no whole block is there. */
+static bool
+read_header (struct block_header *bh, const char *p, size_t n)
+{
+  size_t size;
+  int c;
+
+  if (n < sizeof (struct block_header))
+    return false;
+  memcpy (bh, p, sizeof (struct block_header));
+  if ((bh->magic != BLOCK_MAGIC) || !bh->n ||
+      (bh->size > n - sizeof (struct block_header)))
+    return false;
+  size = 0;
+  for (c = 0; c <= WET_HISTORY_COLUMNS; ++c)
+    size += bh->sizes[c];
+  return size == bh->size;
+}
+
+/* Returns how many bytes of the N at P are whole blocks, and the time of
+   the last sample in them in T_MAX (INT64_MIN if there are none). */
+static size_t
+whole_blocks (const char *p, size_t n, int64_t *t_max)
+{
+  struct block_header bh;
+  size_t off;
+
+  *t_max = INT64_MIN;
+  off = 0;
+  while ((off < n) && read_header (&bh, p + off, n - off)) {
+    *t_max = bh.t_max;
+    off += sizeof (struct block_header) + bh.size;
+  }
+  return off;
+}
+
+static size_t
+map_column (struct wet_buffer *b, const char *path, size_t width)
+{
+  b->p = NULL;
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = NULL;
+  if ((access (path, R_OK) == -1) || !wet_buffer_map (b, path))
+    return 0;
+  return b->n / width;
+}
+
+/* The samples of a location that are not in a block yet, as mapped
+   columns. */
+struct tail {
+  size_t n;
+  struct wet_buffer time_column;
+  struct wet_buffer columns[WET_HISTORY_COLUMNS];
+};
+
+static void
+map_tail (struct tail *tail, const char *id)
+{
+  char path[PATHMAX];
+  char file[64];
+  size_t n;
+  int c;
+
+  history_path (path, id, TIME_COLUMN);
+  tail->n = map_column (&tail->time_column, path, sizeof (int64_t));
+  for (c = 0; c < WET_HISTORY_COLUMNS; ++c) {
+    snprintf (file, sizeof (file), "%s%s", column_names[c], COLUMN_EXT);
+    history_path (path, id, file);
+    n = map_column (&tail->columns[c], path, sizeof (float));
+    if (n < tail->n)
+      tail->n = n;
+  }
+}
+
+static void
+unmap_tail (struct tail *tail)
+{
+  int c;
+
+  wet_buffer_free (&tail->time_column);
+  for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+    wet_buffer_free (&tail->columns[c]);
+}
+
+/* Returns the index of the first of the N times at TIME that is later
+   than T. */
+static size_t
+first_after (const int64_t *time, size_t n, int64_t t)
+{
+  size_t i;
+
+  for (i = 0; (i < n) && (time[i] <= t); ++i)
+    ;
+  return i;
+}
+
+/* Seals the samples in the columns of location ID into blocks, then
+   empties the columns. The caller holds the lock on the time column,
+   open on TIME_FD. */
+static bool
+seal (const char *id, int time_fd)
+{
+  char path[PATHMAX];
+  char file[64];
+  struct wet_buffer blocks;
+  struct tail tail;
+  const float *values[WET_HISTORY_COLUMNS];
+  const int64_t *time;
+  unsigned char *out;
+  int64_t t_max;
+  size_t valid;
+  size_t first;
+  size_t n;
+  int fd;
+  int c;
+  bool ok;
+
+  history_path (path, id, BLOCK_FILE);
+  fd = open (path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd == -1)
+    return false;
+  /* drop whatever a writer that died half way through a block left */
+  map_column (&blocks, path, 1);
+  valid = whole_blocks (blocks.p, blocks.n, &t_max);
+  ok = (valid == blocks.n) || (ftruncate (fd, valid) == 0);
+  wet_buffer_free (&blocks);
+
+  map_tail (&tail, id);
+  time = (const int64_t *) tail.time_column.p;
+  first = first_after (time, tail.n, t_max);
+  out = (unsigned char *) malloc (block_bound (BLOCK_SAMPLES));
+  ok = ok && out;
+  while (ok && (first < tail.n)) {
+    n = tail.n - first;
+    if (n > BLOCK_SAMPLES)
+      n = BLOCK_SAMPLES;
+    for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+      values[c] = (const float *) tail.columns[c].p + first;
+    ok = append (fd, out, encode_block (out, time + first, values, n));
+    first += n;
+  }
+  free (out);
+  unmap_tail (&tail);
+  close (fd);
+
+  /* every sample is in a block now; the time goes first, so that the
+     columns are merely too long should this be cut short */
+  ok = ok && (ftruncate (time_fd, 0) == 0);
+  for (c = 0; c < WET_HISTORY_COLUMNS && ok; ++c) {
+    snprintf (file, sizeof (file), "%s%s", column_names[c], COLUMN_EXT);
+    history_path (path, id, file);
+    ok = truncate (path, 0) == 0;
+  }
+  return ok;
+}
+
+/* Returns the time of the last sample of location ID, whose time column
+   on TIME_FD holds N samples, or INT64_MIN if it has none. The caller
+   holds the lock on the time column. */
+static int64_t
+last_time (const char *id, int time_fd, size_t n)
+{
+  char path[PATHMAX];
+  struct wet_buffer blocks;
+  int64_t t;
+
+  if (n && (pread (time_fd, &t, sizeof (int64_t),
+                   (off_t) ((n - 1) * sizeof (int64_t))) ==
+            (ssize_t) sizeof (int64_t)))
+    return t;
+  history_path (path, id, BLOCK_FILE);
+  map_column (&blocks, path, 1);
+  whole_blocks (blocks.p, blocks.n, &t);
+  wet_buffer_free (&blocks);
+  return t;
+}
+
+/* Appends the current conditions in W, observed at time T, to the
+   history of W's location. Should the clock have gone back, T is taken
+   as a second after the last sample, as the times must ascend. */
+bool
+wet_history_append (const struct weather *w, time_t t)
+{
+  char path[PATHMAX];
+  char file[64];
+  float values[WET_HISTORY_COLUMNS];
+  int64_t t64;
+  int64_t last;
+  struct stat st;
+  size_t n;
+  int time_fd;
+  int lock;
+  int fd;
+  int c;
+  bool ok;
+
+  /* create HISTORY_DIR, then the location's own directory */
+  if (!history_path (path, w->location_id, ""))
+    return false;
+  *strrchr (path, '/') = '\0';
+  if (mkdir (path, 0755) == -1 && errno != EEXIST)
+    return false;
+  history_path (path, w->location_id, "");
+  if (mkdir (path, 0755) == -1 && errno != EEXIST)
+    return false;
+
+  history_path (path, w->location_id, TIME_COLUMN);
+  lock = wet_lock_file (path);
+  if (lock == -1)
+    return false;
+  time_fd = open (path, O_RDWR | O_APPEND | O_CREAT, 0644);
+  if (time_fd == -1) {
+    wet_unlock_file (lock);
+    return false;
+  }
+
+  ok = fstat (time_fd, &st) == 0;
+  n = ok ? st.st_size / sizeof (int64_t) : 0;
+  sample_values (w, values);
+  for (c = 0; c < WET_HISTORY_COLUMNS && ok; ++c) {
+    snprintf (file, sizeof (file), "%s%s", column_names[c], COLUMN_EXT);
+    history_path (path, w->location_id, file);
+    fd = open (path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+    ok = (fd != -1) && align_column (fd, n) &&
+         append (fd, &values[c], sizeof (float));
+    if (fd != -1)
+      close (fd);
+  }
+  /* the time goes last: a sample only exists once its time is there */
+  t64 = (int64_t) t;
+  last = ok ? last_time (w->location_id, time_fd, n) : INT64_MIN;
+  if ((last != INT64_MIN) && (t64 <= last))
+    t64 = last + 1;
+  ok = ok && append (time_fd, &t64, sizeof (int64_t));
+  if (ok && (n + 1 >= BLOCK_SAMPLES))
+    ok = seal (w->location_id, time_fd);
+  close (time_fd);
+  wet_unlock_file (lock);
+  return ok;
+}
+
+/* Reads the history of location ID into H, skipping the blocks that end
+   before SINCE without decoding them; H may still start a little before
+   SINCE. Returns false if there is no history for it. */
+bool
+wet_history_open (struct wet_history *h, const char *id, int64_t since)
+{
+  char path[PATHMAX];
+  struct wet_buffer blocks;
+  struct block_header bh;
+  struct tail tail;
+  int64_t *time;
+  float *values[WET_HISTORY_COLUMNS];
+  int64_t t_max;
+  size_t valid;
+  size_t first;
+  size_t off;
+  size_t n;
+  size_t k;
+  int lock;
+  int c;
+  bool ok;
+
+  memset (h, 0, sizeof (struct wet_history));
+  if (!history_path (path, id, TIME_COLUMN))
+    return false;
+  /* a seal must not move the samples from the columns into a block, or
+     empty the mapped columns, while they are being read (with no
+     location directory to hold the lock, there is no history either) */
+  lock = wet_lock_file_shared (path);
+  history_path (path, id, BLOCK_FILE);
+  map_column (&blocks, path, 1);
+  valid = whole_blocks (blocks.p, blocks.n, &t_max);
+  map_tail (&tail, id);
+  first = first_after ((const int64_t *) tail.time_column.p, tail.n, t_max);
+
+  n = tail.n - first;
+  for (off = 0; off < valid; off += sizeof (struct block_header) + bh.size)
+    if (read_header (&bh, blocks.p + off, valid - off) && (bh.t_max >= since))
+      n += bh.n;
+
+  ok = valid || tail.n;
+  if (ok && n) {
+    h->samples = malloc (n * (sizeof (int64_t) +
+                              WET_HISTORY_COLUMNS * sizeof (float)));
+    ok = h->samples != NULL;
+  }
+  if (ok && n) {
+    time = (int64_t *) h->samples;
+    for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+      values[c] = (float *) (time + n) + c * n;
+    h->time = time;
+    for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+      h->values[c] = values[c];
+
+    k = 0;
+    for (off = 0; ok && (off < valid);
+         off += sizeof (struct block_header) + bh.size) {
+      read_header (&bh, blocks.p + off, valid - off);
+      if (bh.t_max < since)
+        continue;
+      ok = decode_block (&bh, (const unsigned char *) blocks.p + off +
+                         sizeof (struct block_header), time, values);
+      time += bh.n;
+      for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+        values[c] += bh.n;
+      k += bh.n;
+    }
+    if (ok && (k < n)) {
+      memcpy (time, (const int64_t *) tail.time_column.p + first,
+              (n - k) * sizeof (int64_t));
+      for (c = 0; c < WET_HISTORY_COLUMNS; ++c)
+        memcpy (values[c], (const float *) tail.columns[c].p + first,
+                (n - k) * sizeof (float));
+    }
+    h->n = n;
+  }
+  wet_buffer_free (&blocks);
+  unmap_tail (&tail);
+  wet_unlock_file (lock);
+
+  if (!ok) {
+    wet_history_close (h);
+    return false;
+  }
+  return true;
+}
+
+void
+wet_history_close (struct wet_history *h)
+{
+  wet_free (h->samples);
+  h->n = 0;
+}
+
+/* Returns the index of the first sample taken at or after T. */
+size_t
+wet_history_lower_bound (const struct wet_history *h, int64_t t)
+{
+  size_t lo;
+  size_t hi;
+  size_t mid;
+
+  lo = 0;
+  hi = h->n;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (h->time[mid] < t)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Returns the K-th smallest of the N values in V, partially reordering
+   them (Hoare's selection). */
+static float
+select_kth (float *v, size_t n, size_t k)
+{
+  size_t lo;
+  size_t hi;
+  size_t i;
+  size_t j;
+  float pivot;
+  float t;
+
+  lo = 0;
+  hi = n - 1;
+  while (lo < hi) {
+    pivot = v[lo + (hi - lo) / 2];
+    i = lo;
+    j = hi;
+    while (i <= j) {
+      while (v[i] < pivot)
+        i++;
+      while (v[j] > pivot)
+        j--;
+      if (i <= j) {
+        t = v[i];
+        v[i] = v[j];
+        v[j] = t;
+        i++;
+        if (j == 0)
+          break;
+        j--;
+      }
+    }
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break;
+  }
+  return v[k];
+}
+
+/* Computes S over the known values of column C in samples [LO, HI).
+   SCRATCH must have room for HI - LO floats; the percentiles are
+   selected from the known values copied into it.
+
+   The reductions keep LANES independent accumulators and branch on
+   nothing, so the compiler can keep them in vector registers without
+   having to reorder any floating point additions. */
+void
+wet_history_aggregate (const struct wet_history *h, enum wet_history_column c,
+                       size_t lo, size_t hi, float *scratch,
+                       struct wet_history_stats *s)
+{
+  const float *x;
+  float mn[LANES];
+  float mx[LANES];
+  double sum[LANES];
+  size_t cnt[LANES];
+  float v;
+  size_t i;
+  size_t k;
+  size_t n;
+  double total;
+
+  x = h->values[c] + lo;
+  n = hi - lo;
+  for (k = 0; k < LANES; ++k) {
+    mn[k] = INFINITY;
+    mx[k] = -INFINITY;
+    sum[k] = 0.0;
+    cnt[k] = 0;
+  }
+
+  /* NaN (an unknown value) fails every comparison, including v == v */
+  for (i = 0; i + LANES <= n; i += LANES) {
+    for (k = 0; k < LANES; ++k) {
+      v = x[i + k];
+      mn[k] = (v < mn[k]) ? v : mn[k];
+      mx[k] = (v > mx[k]) ? v : mx[k];
+      sum[k] += (v == v) ? v : 0.0;
+      cnt[k] += (v == v);
+    }
+  }
+  for (k = 0; i < n; ++i, ++k) {
+    v = x[i];
+    mn[k] = (v < mn[k]) ? v : mn[k];
+    mx[k] = (v > mx[k]) ? v : mx[k];
+    sum[k] += (v == v) ? v : 0.0;
+    cnt[k] += (v == v);
+  }
+
+  total = 0.0;
+  s->n = 0;
+  for (k = 0; k < LANES; ++k) {
+    mn[0] = (mn[k] < mn[0]) ? mn[k] : mn[0];
+    mx[0] = (mx[k] > mx[0]) ? mx[k] : mx[0];
+    total += sum[k];
+    s->n += cnt[k];
+  }
+  if (!s->n) {
+    s->min = s->max = s->mean = s->p50 = s->p95 = NAN;
+    return;
+  }
+  s->min = mn[0];
+  s->max = mx[0];
+  s->mean = (float) (total / s->n);
+
+  for (i = 0, k = 0; i < n; ++i)
+    if (x[i] == x[i])
+      scratch[k++] = x[i];
+  /* nearest rank */
+  s->p95 = select_kth (scratch, k, (k * 95 + 99) / 100 - 1);
+  s->p50 = select_kth (scratch, k, (k * 50 + 99) / 100 - 1);
+}
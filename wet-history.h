@@ -0,0 +1,74 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_HISTORY_H
+#define WET_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "wet.h"
+#include "wet-util.h"
+#include "wet-weather.h"
+
+/* the observed quantities kept for every sample, always in metric units */
+enum wet_history_column {
+  WET_HISTORY_TEMPERATURE, /* degrees celsius */
+  WET_HISTORY_DEWPOINT,    /* degrees celsius */
+  WET_HISTORY_HUMIDITY,    /* percent */
+  WET_HISTORY_PRESSURE,    /* millibars */
+  WET_HISTORY_WIND_SPEED,  /* km/h */
+  WET_HISTORY_WIND_GUST,   /* km/h */
+  WET_HISTORY_VISIBILITY,  /* km */
+  WET_HISTORY_COLUMNS
+};
+
+/* The stored history of one location, decoded into memory. Sample i was
+   taken at time[i] (seconds since the epoch, ascending) and its values
+   are values[c][i]; a value that was not reported is NaN. */
+struct wet_history {
+  size_t n;
+  const int64_t *time;
+  const float *values[WET_HISTORY_COLUMNS];
+  void *samples;
+};
+
+/* summary statistics of the known values of one column over a range */
+struct wet_history_stats {
+  size_t n;
+  float min;
+  float max;
+  float mean;
+  float p50;
+  float p95;
+};
+
+bool wet_history_enabled (void);
+bool wet_history_append (const struct weather *, time_t);
+bool wet_history_open (struct wet_history *, const char *, int64_t);
+void wet_history_close (struct wet_history *);
+const char *wet_history_column_name (enum wet_history_column);
+size_t wet_history_lower_bound (const struct wet_history *, int64_t);
+void wet_history_aggregate (const struct wet_history *,
+                            enum wet_history_column, size_t, size_t,
+                            float *, struct wet_history_stats *);
+
+#endif /* WET_HISTORY_H */
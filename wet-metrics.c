@@ -0,0 +1,705 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * `wet serve-metrics' exposes the current conditions of a fixed list of
+ * locations as OpenMetrics gauges for Prometheus to scrape.
+ *
+ * Scrapes never reach the weather server. A refresher thread fetches
+ * every location (one pipelined connection) each interval and renders
+ * the gauges into a snapshot, and each scrape is answered from the
+ * latest snapshot on a thread of its own, so any number of scrapers
+ * costs the same upstream traffic as one. A location that cannot be
+ * fetched only has its own wet_up go to 0; a refresh that fetches
+ * nothing at all only costs that refresh: the previous snapshot is
+ * served meanwhile.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "libwet.h"
+#include "wet-arena.h"
+#include "wet-history.h"
+#include "wet-metrics.h"
+#include "wet-net.h"
+#include "wet-util.h"
+#include "wet-weather.h"
+
+#define REQUESTMAX   4096
+#define ADDRESSMAX   64
+#define READ_CHUNK   4096
+#define IO_TIMEOUT   5  /* seconds a scraper gets for its whole scrape */
+#define CLIENTS_MAX  64 /* scrapes answered at once */
+#define CONTENT_TYPE \
+  "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+/* a gauge family, and how to get its value for one location */
+struct family {
+  const char *name;
+  const char *unit;
+  const char *help;
+  double (*value) (const struct weather *);
+};
+
+/* the documents of one refresh, as they arrive */
+struct refresh {
+  const char **ids;
+  size_t n;
+  struct wet_buffer *documents;
+};
+
+/* some of the locations of a refresh, fetched together: the Ith one
+   fetched is location INDEXES[I] of R */
+struct part {
+  struct refresh *r;
+  const char **ids;
+  size_t *indexes;
+  size_t n;
+};
+
+static const char **location_ids;
+static size_t n_locations;
+static unsigned int interval;
+
+/* the latest snapshot and the refresher's own state, under lock */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static char *snapshot = NULL;
+static size_t snapshot_len = 0;
+static time_t last_refresh = 0;
+static unsigned long n_failures = 0;
+
+/* the scrapes being answered, each on a thread of its own */
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int n_clients = 0;
+
+/* everything one refresh fetches and parses, given back all at once
+   when it is over; only the refresher touches it */
+static struct wet_arena arena;
+
+static double
+temperature (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.temperature);
+}
+
+static double
+feels_like (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.feels_like);
+}
+
+static double
+dewpoint (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.dewpoint);
+}
+
+static double
+humidity (const struct weather *w)
+{
+  return wet_weather_byte (w->values.humidity);
+}
+
+static double
+pressure (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.pressure);
+}
+
+static double
+wind_speed (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.wind.speed);
+}
+
+static double
+wind_gust (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.wind.gust);
+}
+
+static double
+wind_direction (const struct weather *w)
+{
+  return (w->values.wind.direction == WET_NO_VALUE) ?
+         NAN : (double) w->values.wind.direction;
+}
+
+static double
+visibility (const struct weather *w)
+{
+  return wet_weather_tenths (w->values.visibility);
+}
+
+static double
+uv_index (const struct weather *w)
+{
+  return wet_weather_byte (w->values.uv_index);
+}
+
+static double
+severe_alert (const struct weather *w)
+{
+  return w->severe_weather_alert.text.n ? 1.0 : 0.0;
+}
+
+static double
+observed (const struct weather *w)
+{
+  return (w->values.last_updated == WET_NO_TIME) ?
+         NAN : (double) w->values.last_updated;
+}
+
+static const struct family families[] = {
+  { "wet_temperature_celsius", "celsius",
+    "Current temperature.", temperature },
+  { "wet_feels_like_celsius", "celsius",
+    "Current apparent temperature.", feels_like },
+  { "wet_dewpoint_celsius", "celsius",
+    "Current dew point.", dewpoint },
+  { "wet_humidity_percent", "percent",
+    "Current relative humidity.", humidity },
+  { "wet_pressure_hectopascals", "hectopascals",
+    "Current barometric pressure.", pressure },
+  { "wet_wind_speed_kilometers_per_hour", "kilometers_per_hour",
+    "Current wind speed.", wind_speed },
+  { "wet_wind_gust_kilometers_per_hour", "kilometers_per_hour",
+    "Current wind gust speed.", wind_gust },
+  { "wet_wind_direction_degrees", "degrees",
+    "Current wind direction.", wind_direction },
+  { "wet_visibility_kilometers", "kilometers",
+    "Current visibility.", visibility },
+  { "wet_uv_index", NULL,
+    "Current UV index.", uv_index },
+  { "wet_severe_alert", NULL,
+    "Whether a severe weather alert is in effect.", severe_alert },
+  { "wet_observation_timestamp_seconds", "seconds",
+    "When the current conditions were observed.", observed },
+  { NULL, NULL, NULL, NULL }
+};
+
+/* Writes S as an OpenMetrics label value (without the quotes). */
+static void
+put_label (FILE *out, const char *s, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; ++i) {
+    if (s[i] == '\\' || s[i] == '"')
+      fputc ('\\', out);
+    if (s[i] == '\n')
+      fputs ("\\n", out);
+    else
+      fputc (s[i], out);
+  }
+}
+
+static void
+put_sample (FILE *out, const char *name, const char *id,
+            struct wet_view location, double value)
+{
+  fprintf (out, "%s{location=\"", name);
+  put_label (out, id, strlen (id));
+  fputs ("\",name=\"", out);
+  put_label (out, location.p, location.n);
+  if (isinf (value))
+    fputs ("\"} +Inf\n", out);
+  else
+    fprintf (out, "\"} %.10g\n", value);
+}
+
+/* Writes every family for the N documents in R to OUT, each family's
+   samples together as OpenMetrics requires. The documents are used up
+   either way. Returns false if there was no memory to parse them. */
+static bool
+render (FILE *out, struct refresh *r, time_t t)
+{
+  struct wet_context ctx;
+  struct weather *w;
+  bool *ok;
+  size_t i;
+  int f;
+  double value;
+
+  w = (struct weather *) wet_arena_alloc (&arena,
+                                          r->n * sizeof (struct weather));
+  ok = (bool *) wet_arena_alloc (&arena, r->n * sizeof (bool));
+  if (!w || !ok) {
+    for (i = 0; i < r->n; ++i)
+      wet_buffer_free (&r->documents[i]);
+    return false;
+  }
+  wet_context_init (&ctx);
+  for (i = 0; i < r->n; ++i) {
+    ok[i] = r->documents[i].p &&
+            !wet_parse (&ctx, r->ids[i], &r->documents[i], &w[i]);
+    if (ok[i] && wet_history_enabled () && !wet_history_append (&w[i], t))
+      wet_debug ("failed to record the history of %s", r->ids[i]);
+  }
+
+  for (f = 0; families[f].name; ++f) {
+    if (families[f].unit)
+      fprintf (out, "# TYPE %s gauge\n# UNIT %s %s\n# HELP %s %s\n",
+               families[f].name, families[f].name, families[f].unit,
+               families[f].name, families[f].help);
+    else
+      fprintf (out, "# TYPE %s gauge\n# HELP %s %s\n",
+               families[f].name, families[f].name, families[f].help);
+    for (i = 0; i < r->n; ++i) {
+      if (!ok[i])
+        continue;
+      value = families[f].value (&w[i]);
+      if (!isnan (value))
+        put_sample (out, families[f].name, r->ids[i], w[i].location.name,
+                    value);
+    }
+  }
+
+  fputs ("# TYPE wet_up gauge\n"
+         "# HELP wet_up Whether the last refresh got weather data.\n", out);
+  for (i = 0; i < r->n; ++i) {
+    fputs ("wet_up{location=\"", out);
+    put_label (out, r->ids[i], strlen (r->ids[i]));
+    fprintf (out, "\"} %d\n", ok[i]);
+    if (ok[i])
+      wet_weather_release (&w[i]);
+  }
+  return true;
+}
+
+static void
+store_document (size_t index, struct wet_buffer *content, void *arg)
+{
+  struct part *p;
+
+  p = (struct part *) arg;
+  p->r->documents[p->indexes[index]] = *content;
+}
+
+/* Fetches the documents of R, all over one connection. Should that
+   fail, the ones still missing are fetched one at a time up to the
+   next one that can be fetched, and the rest over one connection
+   again, so a location the server turns away only loses its own
+   document. Returns false if not one document could be fetched. */
+static bool
+fetch_documents (struct wet_context *ctx, struct refresh *r)
+{
+  struct part p;
+  bool *lost;
+  bool alone;
+  bool any;
+  size_t i;
+
+  p.r = r;
+  p.ids = (const char **) wet_arena_alloc (&arena,
+                                           r->n * sizeof (const char *));
+  p.indexes = (size_t *) wet_arena_alloc (&arena, r->n * sizeof (size_t));
+  lost = (bool *) wet_arena_alloc (&arena, r->n * sizeof (bool));
+  if (!p.ids || !p.indexes || !lost) {
+    wet_error ("failed to allocate memory");
+    return false;
+  }
+  memset (lost, 0, r->n * sizeof (bool));
+
+  alone = false;
+  for (;;) {
+    p.n = 0;
+    for (i = 0; i < r->n; ++i) {
+      if (!r->documents[i].p && !lost[i]) {
+        p.ids[p.n] = r->ids[i];
+        p.indexes[p.n++] = i;
+      }
+    }
+    if (!p.n)
+      break;
+    if (alone)
+      p.n = 1;
+    if (!wet_fetch_documents (ctx, p.ids, p.n, store_document, &p)) {
+      alone = false;
+      continue;
+    }
+    if (alone) {
+      wet_error ("%s: %s", p.ids[0], ctx->error.text);
+      lost[p.indexes[0]] = true;
+    } else
+      wet_debug ("%s; fetching one location at a time",
+                 ctx->error.text);
+    alone = true;
+  }
+
+  any = false;
+  for (i = 0; i < r->n; ++i)
+    any = any || r->documents[i].p;
+  return any;
+}
+
+/* Refreshes the snapshot once. A location that could not be fetched
+   is only down in the new snapshot; a refresh that fetched nothing at
+   all keeps the old one. */
+static void
+refresh (void)
+{
+  struct wet_context ctx;
+  struct refresh r;
+  char *text;
+  size_t len;
+  size_t i;
+  FILE *out;
+  bool ok;
+
+  r.ids = location_ids;
+  r.n = n_locations;
+  r.documents = (struct wet_buffer *)
+    wet_arena_alloc (&arena, n_locations * sizeof (struct wet_buffer));
+  if (!r.documents) {
+    wet_error ("failed to allocate memory");
+    pthread_mutex_lock (&lock);
+    n_failures++;
+    pthread_mutex_unlock (&lock);
+    return;
+  }
+
+  memset (r.documents, 0, n_locations * sizeof (struct wet_buffer));
+  text = NULL;
+  ok = false;
+  wet_context_init (&ctx);
+  ctx.allocator = &arena.allocator;
+  /* the gauges are all current conditions */
+  ctx.forecast_days = 1;
+  if (!fetch_documents (&ctx, &r)) {
+    for (i = 0; i < n_locations; ++i)
+      wet_buffer_free (&r.documents[i]);
+  } else {
+    out = open_memstream (&text, &len);
+    if (!out) {
+      wet_error ("failed to open memory stream");
+      for (i = 0; i < n_locations; ++i)
+        wet_buffer_free (&r.documents[i]);
+    } else {
+      ok = render (out, &r, time (NULL));
+      ok = (fclose (out) == 0) && ok;
+    }
+  }
+  wet_arena_reset (&arena);
+
+  pthread_mutex_lock (&lock);
+  if (ok) {
+    free (snapshot);
+    snapshot = text;
+    snapshot_len = len;
+    last_refresh = time (NULL);
+    text = NULL;
+  } else
+    n_failures++;
+  pthread_mutex_unlock (&lock);
+  free (text);
+}
+
+static void *
+refresher (void *arg)
+{
+  for (;;) {
+    sleep (interval);
+    refresh ();
+  }
+  return NULL;
+}
+
+/* Builds the response to a scrape from the current snapshot. */
+static char *
+scrape_response (size_t *len)
+{
+  char *body;
+  size_t body_len;
+  char *response;
+  FILE *out;
+
+  out = open_memstream (&body, &body_len);
+  if (!out)
+    return NULL;
+  pthread_mutex_lock (&lock);
+  if (snapshot)
+    fwrite (snapshot, 1, snapshot_len, out);
+  fprintf (out,
+           "# TYPE wet_last_refresh_timestamp_seconds gauge\n"
+           "# UNIT wet_last_refresh_timestamp_seconds seconds\n"
+           "# HELP wet_last_refresh_timestamp_seconds When the weather "
+           "data was last fetched.\n"
+           "wet_last_refresh_timestamp_seconds %lld\n"
+           "# TYPE wet_refresh_failures counter\n"
+           "# HELP wet_refresh_failures Refreshes that got no weather "
+           "data.\n"
+           "wet_refresh_failures_total %lu\n"
+           "# EOF\n",
+           (long long) last_refresh, n_failures);
+  pthread_mutex_unlock (&lock);
+  fclose (out);
+
+  out = open_memstream (&response, len);
+  if (!out) {
+    free (body);
+    return NULL;
+  }
+  fprintf (out, "HTTP/1.1 200 OK\r\n"
+                "Content-Type: " CONTENT_TYPE "\r\n"
+                "Content-Length: %zu\r\n"
+                "Connection: close\r\n\r\n", body_len);
+  fwrite (body, 1, body_len, out);
+  fclose (out);
+  free (body);
+  return response;
+}
+
+/* Gives the next recv or send on FD (OPTION says which) whatever is
+   left of the time until DEADLINE. Returns false once there is none. */
+static bool
+time_left (int fd, int option, const struct timespec *deadline)
+{
+  struct timespec now;
+  struct timeval timeout;
+  long usec;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  usec = (deadline->tv_sec - now.tv_sec) * 1000000L +
+         (deadline->tv_nsec - now.tv_nsec) / 1000L;
+  if (usec <= 0)
+    return false;
+  timeout.tv_sec = usec / 1000000L;
+  timeout.tv_usec = usec % 1000000L;
+  return setsockopt (fd, SOL_SOCKET, option, &timeout,
+                     sizeof (timeout)) == 0;
+}
+
+static void
+send_all (int fd, const char *p, size_t n, const struct timespec *deadline)
+{
+  ssize_t n_sent;
+
+  while (n && time_left (fd, SO_SNDTIMEO, deadline)) {
+    n_sent = send (fd, p, n, MSG_NOSIGNAL);
+    if ((n_sent < 0) && (errno == EINTR))
+      continue;
+    if (n_sent <= 0)
+      return;
+    p += n_sent;
+    n -= n_sent;
+  }
+}
+
+/* Answers one scrape on FD: GET /metrics gets the snapshot, anything
+   else an error. The scraper gets IO_TIMEOUT seconds for all of it,
+   however it trickles its request in or its response out. */
+static void
+serve (int fd)
+{
+  static const char not_found[] =
+    "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n"
+    "Connection: close\r\n\r\n";
+  static const char bad_method[] =
+    "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\n"
+    "Content-Length: 0\r\nConnection: close\r\n\r\n";
+  char request[REQUESTMAX];
+  struct timespec deadline;
+  size_t n;
+  ssize_t n_read;
+  char *response;
+  size_t len;
+  const char *path;
+
+  clock_gettime (CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += IO_TIMEOUT;
+  n = 0;
+  while (n < REQUESTMAX - 1) {
+    if (!time_left (fd, SO_RCVTIMEO, &deadline))
+      return;
+    n_read = recv (fd, request + n, REQUESTMAX - 1 - n, 0);
+    if ((n_read < 0) && (errno == EINTR))
+      continue;
+    if (n_read <= 0)
+      return;
+    n += n_read;
+    request[n] = '\0';
+    if (strstr (request, "\r\n\r\n"))
+      break;
+  }
+  request[n] = '\0';
+
+  if (strncmp (request, "GET ", 4) != 0) {
+    send_all (fd, bad_method, sizeof (bad_method) - 1, &deadline);
+    return;
+  }
+  path = request + 4;
+  if ((strncmp (path, "/metrics", 8) != 0) ||
+      !strchr (" ?", path[8])) {
+    send_all (fd, not_found, sizeof (not_found) - 1, &deadline);
+    return;
+  }
+  response = scrape_response (&len);
+  if (response) {
+    send_all (fd, response, len, &deadline);
+    free (response);
+  }
+}
+
+static void *
+client_main (void *arg)
+{
+  int fd;
+
+  fd = (int) (intptr_t) arg;
+  serve (fd);
+  close (fd);
+  pthread_mutex_lock (&clients_lock);
+  n_clients--;
+  pthread_mutex_unlock (&clients_lock);
+  return NULL;
+}
+
+/* Answers the scrape on FD on a thread of its own, so a slow scraper
+   never holds up the others. Past CLIENTS_MAX scrapes at once, FD is
+   simply closed. */
+static void
+start_client (int fd, const pthread_attr_t *attr)
+{
+  pthread_t thread;
+  bool full;
+
+  pthread_mutex_lock (&clients_lock);
+  full = (n_clients >= CLIENTS_MAX);
+  if (!full)
+    n_clients++;
+  pthread_mutex_unlock (&clients_lock);
+  if (full) {
+    wet_debug ("too many scrapes at once, dropping one");
+    close (fd);
+    return;
+  }
+  if (pthread_create (&thread, attr, client_main,
+                      (void *) (intptr_t) fd) != 0) {
+    wet_debug ("failed to start a thread for a scrape");
+    close (fd);
+    pthread_mutex_lock (&clients_lock);
+    n_clients--;
+    pthread_mutex_unlock (&clients_lock);
+  }
+}
+
+/* Opens the listening socket for LISTEN_ON, `[ADDRESS:]PORT'. */
+static int
+open_listener (const char *listen_on)
+{
+  char address[ADDRESSMAX];
+  const char *colon;
+  struct sockaddr_in a;
+  long port;
+  char *end;
+  int sock;
+  int one;
+
+  colon = strrchr (listen_on, ':');
+  if (colon) {
+    if ((size_t) (colon - listen_on) >= ADDRESSMAX)
+      wet_die (WET_EOP, "invalid address to listen on: `%s'", listen_on);
+    memcpy (address, listen_on, colon - listen_on);
+    address[colon - listen_on] = '\0';
+    colon++;
+  } else {
+    strcpy (address, "127.0.0.1");
+    colon = listen_on;
+  }
+  port = strtol (colon, &end, 10);
+  if ((end == colon) || *end || (port < 1) || (port > 65535))
+    wet_die (WET_EOP, "invalid port to listen on: `%s'", colon);
+
+  memset (&a, 0, sizeof (a));
+  a.sin_family = AF_INET;
+  a.sin_port = htons ((unsigned short) port);
+  if (!*address || wet_streq (address, "*"))
+    a.sin_addr.s_addr = htonl (INADDR_ANY);
+  else if (inet_pton (AF_INET, address, &a.sin_addr) != 1)
+    wet_die (WET_EOP, "invalid address to listen on: `%s'", address);
+
+  sock = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (sock == -1)
+    wet_die (WET_ENET, "failed to create socket: %s", strerror (errno));
+  one = 1;
+  setsockopt (sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+  if (bind (sock, (struct sockaddr *) &a, sizeof (a)) == -1)
+    wet_die (WET_ENET, "failed to listen on %s: %s", listen_on,
+             strerror (errno));
+  if (listen (sock, SOMAXCONN) == -1)
+    wet_die (WET_ENET, "failed to listen: %s", strerror (errno));
+  return sock;
+}
+
+/* Serves the current conditions of the N locations in IDS as
+   OpenMetrics on LISTEN_ON (`[ADDRESS:]PORT'), fetching them again
+   every REFRESH_INTERVAL seconds. Never returns. */
+void
+wet_metrics_serve (const char **ids, size_t n, const char *listen_on,
+                   unsigned int refresh_interval)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  int sock;
+  int client;
+
+  location_ids = ids;
+  n_locations = n;
+  interval = refresh_interval;
+  wet_arena_init (&arena, 0);
+  sock = open_listener (listen_on);
+
+  /* the first snapshot is taken before any scrape can be answered */
+  refresh ();
+  if (pthread_create (&thread, NULL, refresher, NULL) != 0)
+    wet_die (WET_ESYS, "failed to start the refresher");
+
+  if ((pthread_attr_init (&attr) != 0) ||
+      (pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED) != 0))
+    wet_die (WET_ESYS, "failed to set up scrape threads");
+  for (;;) {
+    client = accept (sock, NULL, NULL);
+    if (client == -1) {
+      if ((errno == EINTR) || (errno == ECONNABORTED))
+        continue;
+      wet_die (WET_ENET, "failed to accept: %s", strerror (errno));
+    }
+    start_client (client, &attr);
+  }
+}
@@ -0,0 +1,33 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_METRICS_H
+#define WET_METRICS_H
+
+#include <stddef.h>
+
+#include "wet.h"
+
+#define WET_METRICS_LISTEN   "127.0.0.1:9641"
+#define WET_METRICS_INTERVAL 300
+
+void wet_metrics_serve (const char **, size_t, const char *, unsigned int);
+
+#endif /* WET_METRICS_H */
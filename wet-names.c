@@ -0,0 +1,374 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * The name index remembers every name a location ID has been found by,
+ * so a query that was resolved before needs no search request, and so
+ * names can be completed from a prefix. It lives in INDEX_FILE in the
+ * data directory and is searched in place once mapped:
+ *
+ *   struct names_header, then `n' struct names_entry, then the strings
+ *
+ * Entries are sorted by their key, which is the name put through
+ * wet_names_normalize() (queries are normalized the same way before
+ * they are looked up), so every key starting with a prefix sits in one
+ * contiguous run. Keys and display names are null terminated and stored
+ * as offsets into the string area.
+ *
+ * Like the location index, the file is native-endian.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "wet-names.h"
+#include "wet-util.h"
+
+#define INDEX_FILE  "names.idx"
+#define INDEX_MAGIC "WETNAM1"
+
+struct names_header {
+  char magic[8];
+  size_t n;
+  size_t strings;
+};
+
+struct names_entry {
+  size_t key;
+  size_t name;
+  char id[WET_PLACE_ID_MAX];
+};
+
+/* an index mapped into memory */
+struct names_index {
+  struct wet_buffer b;
+  const struct names_entry *entries;
+  const char *strings;
+  size_t n;
+};
+
+/* an entry being built, before it is laid out in the file */
+struct pending {
+  char key[WET_NAME_MAX];
+  const char *name;
+  const char *id;
+  size_t seq;
+};
+
+/* Writes the lookup key for NAME to KEY (N bytes): lower case, with
+   every run of anything other than letters and digits turned into a
+   single space, and no leading or trailing space. So "New York, NY",
+   "new york ny" and "  NEW-YORK   NY" all have the same key. */
+void
+wet_names_normalize (char *key, size_t n, const char *name)
+{
+  size_t len;
+  bool space;
+
+  len = 0;
+  space = false;
+  for (; *name && len + 1 < n; ++name) {
+    if (isalnum ((unsigned char) *name)) {
+      if (space && len && len + 2 < n)
+        key[len++] = ' ';
+      key[len++] = tolower ((unsigned char) *name);
+      space = false;
+    } else
+      space = true;
+  }
+  key[len] = '\0';
+}
+
+/* Returns true if every string of X lies within its STRINGS bytes of
+   string area, so the index can be searched without reading past it. */
+static bool
+valid_index (const struct names_index *x, size_t strings)
+{
+  size_t i;
+
+  if (!x->n)
+    return true;
+  if (!strings || x->strings[strings - 1])
+    return false;
+  for (i = 0; i < x->n; ++i)
+    if ((x->entries[i].key >= strings) || (x->entries[i].name >= strings) ||
+        !memchr (x->entries[i].id, '\0', WET_PLACE_ID_MAX))
+      return false;
+  return true;
+}
+
+static bool
+map_index (struct names_index *x)
+{
+  char *path;
+  const struct names_header *h;
+  size_t size;
+
+  x->b.p = NULL;
+  x->b.n = 0;
+  x->b.mapped = false;
+  x->b.allocator = NULL;
+  x->n = 0;
+
+  path = wet_data_path (INDEX_FILE);
+  if (!path)
+    return false;
+  if ((access (path, R_OK) == -1) || !wet_buffer_map (&x->b, path)) {
+    free (path);
+    return false;
+  }
+  free (path);
+
+  h = (const struct names_header *) x->b.p;
+  if ((x->b.n < sizeof (struct names_header)) ||
+      (memcmp (h->magic, INDEX_MAGIC, sizeof (h->magic)) != 0)) {
+    wet_debug ("ignoring unreadable name index");
+    wet_buffer_free (&x->b);
+    return false;
+  }
+  size = sizeof (struct names_header) + h->n * sizeof (struct names_entry);
+  if ((h->n > x->b.n / sizeof (struct names_entry)) ||
+      (size + h->strings != x->b.n)) {
+    wet_debug ("ignoring unreadable name index");
+    wet_buffer_free (&x->b);
+    return false;
+  }
+  x->n = h->n;
+  x->entries = (const struct names_entry *)
+    (x->b.p + sizeof (struct names_header));
+  x->strings = x->b.p + size;
+  if (!valid_index (x, h->strings)) {
+    wet_debug ("ignoring unreadable name index");
+    wet_buffer_free (&x->b);
+    x->n = 0;
+    return false;
+  }
+  return true;
+}
+
+/* Returns the index of the first entry whose key is not less than KEY. */
+static size_t
+lower_bound (const struct names_index *x, const char *key)
+{
+  size_t lo;
+  size_t hi;
+  size_t mid;
+
+  lo = 0;
+  hi = x->n;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (strcmp (x->strings + x->entries[mid].key, key) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* Stores the ID known by exactly the name QUERY in ID (N bytes). Returns
+   false if QUERY has not been resolved before. */
+bool
+wet_names_lookup (const char *query, char *id, size_t n)
+{
+  struct names_index x;
+  char key[WET_NAME_MAX];
+  size_t i;
+  bool found;
+
+  wet_names_normalize (key, WET_NAME_MAX, query);
+  if (!*key || !map_index (&x))
+    return false;
+
+  i = lower_bound (&x, key);
+  found = (i < x.n) && wet_streq (x.strings + x.entries[i].key, key);
+  if (found)
+    snprintf (id, n, "%s", x.entries[i].id);
+  wet_buffer_free (&x.b);
+  return found;
+}
+
+/* Calls FUNC with the display name and ID of every known name that
+   starts with PREFIX (in key order), and returns how many there were. */
+size_t
+wet_names_complete (const char *prefix, wet_names_func func, void *arg)
+{
+  struct names_index x;
+  char key[WET_NAME_MAX];
+  size_t len;
+  size_t first;
+  size_t i;
+
+  wet_names_normalize (key, WET_NAME_MAX, prefix);
+  if (!map_index (&x))
+    return 0;
+
+  len = strlen (key);
+  first = lower_bound (&x, key);
+  for (i = first; i < x.n; ++i) {
+    if (strncmp (x.strings + x.entries[i].key, key, len) != 0)
+      break;
+    func (x.strings + x.entries[i].name, x.entries[i].id, arg);
+  }
+  wet_buffer_free (&x.b);
+  return i - first;
+}
+
+static int
+compare_pending (const void *a, const void *b)
+{
+  const struct pending *x = (const struct pending *) a;
+  const struct pending *y = (const struct pending *) b;
+  int c;
+
+  c = strcmp (x->key, y->key);
+  if (c)
+    return c;
+  /* newest first, so it is the one kept */
+  return (x->seq < y->seq) - (x->seq > y->seq);
+}
+
+/* Adds the N names in NAMES to the index (a name that is already known
+   now maps to the new ID) and rewrites it, unless nothing changed. The
+   index is locked from the time it is read until the new one is in
+   place, so that concurrent writers do not lose each other's names. */
+bool
+wet_names_add (const struct wet_name *names, size_t n)
+{
+  struct names_index x;
+  struct pending *p;
+  struct names_header *h;
+  struct names_entry *e;
+  char key[WET_NAME_MAX];
+  char *data;
+  char *path;
+  size_t n_pending;
+  size_t n_unique;
+  size_t strings;
+  size_t size;
+  size_t i;
+  size_t j;
+  int lock;
+  bool changed;
+  bool ok;
+
+  path = wet_data_path (INDEX_FILE);
+  if (!path)
+    return false;
+  lock = wet_lock_file (path);
+  if (lock == -1) {
+    free (path);
+    return false;
+  }
+  map_index (&x);
+
+  changed = false;
+  for (i = 0; i < n && !changed; ++i) {
+    wet_names_normalize (key, WET_NAME_MAX, names[i].name);
+    if (!*key || !*names[i].id)
+      continue;
+    j = lower_bound (&x, key);
+    changed = (j == x.n) || !wet_streq (x.strings + x.entries[j].key, key) ||
+              !wet_streq (x.entries[j].id, names[i].id);
+  }
+  if (!changed) {
+    wet_buffer_free (&x.b);
+    wet_unlock_file (lock);
+    free (path);
+    return true;
+  }
+
+  p = (struct pending *) malloc ((x.n + n) * sizeof (struct pending));
+  if (!p) {
+    wet_buffer_free (&x.b);
+    wet_unlock_file (lock);
+    free (path);
+    return false;
+  }
+  n_pending = 0;
+  for (i = 0; i < x.n; ++i, ++n_pending) {
+    snprintf (p[n_pending].key, WET_NAME_MAX, "%s",
+              x.strings + x.entries[i].key);
+    p[n_pending].name = x.strings + x.entries[i].name;
+    p[n_pending].id = x.entries[i].id;
+    p[n_pending].seq = n_pending;
+  }
+  for (i = 0; i < n; ++i) {
+    wet_names_normalize (p[n_pending].key, WET_NAME_MAX, names[i].name);
+    if (!*p[n_pending].key || !*names[i].id)
+      continue;
+    p[n_pending].name = names[i].name;
+    p[n_pending].id = names[i].id;
+    p[n_pending].seq = n_pending;
+    n_pending++;
+  }
+
+  qsort (p, n_pending, sizeof (struct pending), compare_pending);
+  strings = 0;
+  for (i = 0, n_unique = 0; i < n_pending; ++i) {
+    if (n_unique && wet_streq (p[i].key, p[n_unique - 1].key))
+      continue;
+    p[n_unique++] = p[i];
+    strings += strlen (p[i].key) + strlen (p[i].name) + 2;
+  }
+
+  size = sizeof (struct names_header) + n_unique * sizeof (struct names_entry);
+  data = (char *) malloc (size + strings);
+  if (!data) {
+    free (p);
+    wet_buffer_free (&x.b);
+    wet_unlock_file (lock);
+    free (path);
+    return false;
+  }
+  h = (struct names_header *) data;
+  memset (h, 0, sizeof (struct names_header));
+  memcpy (h->magic, INDEX_MAGIC, sizeof (h->magic));
+  h->n = n_unique;
+  h->strings = strings;
+  e = (struct names_entry *) (data + sizeof (struct names_header));
+  for (i = 0, strings = 0; i < n_unique; ++i) {
+    e[i].key = strings;
+    strcpy (data + size + strings, p[i].key);
+    strings += strlen (p[i].key) + 1;
+    e[i].name = strings;
+    strcpy (data + size + strings, p[i].name);
+    strings += strlen (p[i].name) + 1;
+    memset (e[i].id, 0, WET_PLACE_ID_MAX);
+    snprintf (e[i].id, WET_PLACE_ID_MAX, "%s", p[i].id);
+  }
+
+  ok = wet_replace_file (path, data, size + strings);
+  free (data);
+  free (p);
+  wet_buffer_free (&x.b);
+  wet_unlock_file (lock);
+  free (path);
+  return ok;
+}
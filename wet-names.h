@@ -0,0 +1,45 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_NAMES_H
+#define WET_NAMES_H
+
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-geo.h"
+
+#define WET_NAME_MAX 128
+
+/* A name that a location ID is known by: a search query that was
+   resolved to it, or the name its weather data gave. */
+struct wet_name {
+  char id[WET_PLACE_ID_MAX];
+  char name[WET_NAME_MAX];
+};
+
+typedef void (*wet_names_func) (const char *, const char *, void *);
+
+void wet_names_normalize (char *, size_t, const char *);
+bool wet_names_lookup (const char *, char *, size_t);
+size_t wet_names_complete (const char *, wet_names_func, void *);
+bool wet_names_add (const struct wet_name *, size_t);
+
+#endif /* WET_NAMES_H */
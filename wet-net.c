@@ -21,6 +21,12 @@
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
+#ifdef HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h> /* ptrdiff_t */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,7 +35,10 @@
 #include <unistd.h>
 
 #include "wet.h"
+#include "wet-arena.h"
 #include "wet-net.h"
+#include "wet-record.h"
+#include "wet-uring.h"
 #include "wet-util.h"
 
 #define PORT               80
@@ -37,7 +46,8 @@
 #define HEADER_DELIMITER   HEADER_LINE HEADER_LINE
 #define USERAGENT          "WET (WEather Tool)/" WET_VERSION
 #define HOST               "wxdata.weather.com"
-#define WEATHER_DATA_PATH  "/wxdata/weather/local/%s?unit=%s&dayf=5&cc=*"
+/* always fetched in metric units; see wet_weather_convert() */
+#define WEATHER_DATA_PATH  "/wxdata/weather/local/%s?unit=m&dayf=%u&cc=*"
 #define WEATHER_LOCID_PATH "/wxdata/search/search?where=%s"
 
 #define GET \
@@ -46,69 +56,182 @@
   "User-Agent: " USERAGENT HEADER_DELIMITER
 
 #define HEADERMAX    1024
+#define HOSTMAX       256
 #define GETMAX        512
 #define URLPATHMAX    256
 #define STATUSTEXTMAX 128
+#define READBUFMAX   4096
+
+/* how many of the server's addresses are tried, and how long (in ms) a
+   connection attempt gets before the next address is tried alongside
+   it (RFC 8305 recommends 250) */
+#define CANDIDATES_MAX        16
+#define CONNECT_ATTEMPT_DELAY 250
 
 #define DATA_UNKNOWN      "(not found)"
-#define DATA_UNKNOWN_SIZE 12 /* includes null terminator */
+
+/* fetches of at least URING_MIN_REQUESTS go through io_uring (if it was
+   available at build time), spread over up to URING_STREAMS connections
+   of URING_REQUESTS_PER_STREAM or more pipelined requests each */
+#define URING_MIN_REQUESTS        32
+#define URING_STREAMS             16
+#define URING_REQUESTS_PER_STREAM 8
 
 struct headerdata {
   int status;
   size_t content_length;
+  bool close;
   char status_text[STATUSTEXTMAX];
 };
 
+/* how reading a response off a connection ended */
+enum response_status {
+  RESPONSE_OK,
+  RESPONSE_CLOSED,  /* the peer closed the connection first */
+  RESPONSE_PARTIAL, /* the rest of it has yet to arrive */
+  RESPONSE_FAILED   /* see the error */
+};
+
+struct connection {
+  int sock;
+  unsigned long id;
+  const struct wet_allocator *allocator; /* for response bodies */
+  size_t n_sent;
+  size_t n_received;
+  size_t pos;
+  size_t len;
+  char buf[READBUFMAX];
+};
+
+/* one of the server's addresses */
+struct candidate {
+  struct sockaddr_storage addr;
+  socklen_t len;
+};
+
+/* the address the last connection race was won by, for the transports
+   that use a single address rather than racing them */
+static pthread_mutex_t winner_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct candidate last_winner;
+static bool have_winner = false;
+
 static const char *encode_chars = "!@#$%^&*()=+{}[]|\\;':\",<>/? ";
-static char *content = NULL;
+static const struct wet_view unknown = {
+  DATA_UNKNOWN,
+  sizeof (DATA_UNKNOWN) - 1
+};
+
+/* Like strstr(), but bounded by END rather than a null terminator, so
+   the document does not need one. */
+static const char *
+find (const char *s, const char *end, const char *q)
+{
+  size_t n;
+  const char *p;
 
-#define __assign_unknown(__r) strncpy (__r, DATA_UNKNOWN, DATA_UNKNOWN_SIZE)
+  n = strlen (q);
+  for (p = s; (end - p) >= (ptrdiff_t) n; ++p) {
+    p = (const char *) memchr (p, *q, (end - p) - n + 1);
+    if (!p)
+      break;
+    if (memcmp (p, q, n) == 0)
+      return p;
+  }
+  return NULL;
+}
+
+#define __assign_unknown(__r) __r = unknown
 
 #define __assign(__p, __n, __c, __r) \
   do { \
-    size_t __i = 0; \
-    for (__p += __n; (*__p && (*__p != __c)); ++__p) \
-      __r[__i++] = *__p; \
-    __r[__i] = '\0'; \
+    const char *__e; \
+    __p += __n; \
+    __e = (const char *) memchr (__p, __c, end - __p); \
+    if (!__e) \
+      __e = end; \
+    __r.p = __p; \
+    __r.n = __e - __p; \
+    __p = __e; \
   } while (0)
 
 #define __find_and_assign(__p, __s, __q, __c, __r) \
   do { \
-    __p = strstr (__s, __q); \
-    if (__p && *__p) { \
-      size_t __i = 0; \
-      for (__p += strlen (__q); (*__p && (*__p != __c)); ++__p) \
-        __r[__i++] = *__p; \
-      __r[__i] = '\0'; \
-    } else if (use_unknown_string) \
+    __p = find (__s, end, __q); \
+    if (__p) \
+      __assign (__p, strlen (__q), __c, __r); \
+    else if (use_unknown_string) \
       __assign_unknown (__r); \
   } while (0)
 
-static void
-fill_weather_struct (struct weather *w)
+/* How many days the forecasts starting at P (NULL if there are none) go
+   on for, in the document ending at END. */
+static size_t
+count_days (const char *p, const char *end)
+{
+  size_t n;
+
+  n = 0;
+  while (p && (p = find (p, end, "<day d="))) {
+    p += strlen ("<day d=");
+    n++;
+  }
+  return n;
+}
+
+/* Makes room for N days of forecasts in W, taken from its allocator (see
+   wet_weather_release()). */
+static bool
+allocate_forecasts (struct weather *w, size_t n)
 {
-  int day;
+  size_t offset;
   char *p;
-  char *t0;
-  char *t1;
-  char *t2;
-  char *t3;
+
+  /* the views and their values share one block, the values starting at
+     the first multiple of their widest member after the views */
+  offset = n * sizeof (struct weather_forecast);
+  offset = (offset + sizeof (int64_t) - 1) / sizeof (int64_t) *
+           sizeof (int64_t);
+  p = (char *) wet_alloc (w->allocator,
+                          offset +
+                          n * sizeof (struct weather_forecast_values));
+  if (!p)
+    return false;
+  w->forecasts = (struct weather_forecast *) p;
+  w->values.forecasts = (struct weather_forecast_values *) (p + offset);
+  w->n_forecasts = n;
+  return true;
+}
+
+/* Fills W with views into the N bytes of CONTENT. Returns false if there
+   is no memory for its forecasts. */
+static bool
+fill_weather_struct (struct weather *w, const char *content, size_t n)
+{
+  size_t day;
+  size_t n_days;
+  const char *end;
+  const char *p;
+  const char *t0;
+  const char *t1;
+  const char *t2;
+  const char *t3;
   bool use_unknown_string;
 
-  p = strstr (content, "<error>");
-  if (p && *p) {
+  end = content + n;
+  p = find (content, end, "<error>");
+  if (p) {
     p = p + strlen ("<error>");
-    t0 = strstr (p, "<err type=\"");
-    if (t0 && *t0) {
+    t0 = find (p, end, "<err type=\"");
+    if (t0) {
       __assign (t0, strlen ("<err type=\""), '"', w->error.type);
-      t1 = strchr (t0, '>');
-      if (t1 && *t1)
+      t1 = (const char *) memchr (t0, '>', end - t0);
+      if (t1)
         __assign (t1, 1, '<', w->error.text);
     }
   }
 
-  if (*w->error.type && *w->error.text)
-    return;
+  if (w->error.type.n && w->error.text.n)
+    return true;
 
   use_unknown_string = false;
   /* units {{{ */
@@ -122,8 +245,8 @@ fill_weather_struct (struct weather *w)
 
 
   /* severe_weather_alert {{{ */
-  p = strstr (content, "<swa>");
-  if (p && *p) {
+  p = find (content, end, "<swa>");
+  if (p) {
     __find_and_assign (t0, p, "<t>", '<', w->severe_weather_alert.text);
     __find_and_assign (t0, p, "<l>", '<', w->severe_weather_alert.link);
   }
@@ -133,50 +256,53 @@ fill_weather_struct (struct weather *w)
 
   use_unknown_string = true;
   /* location {{{ */
-  p = strstr (content, "<loc id=");
-  if (p && *p) {
+  p = find (content, end, "<loc id=");
+  if (p) {
     __find_and_assign (t0, p, "<dnam>", '<', w->location.name);
     __find_and_assign (t0, p, "<lat>", '<', w->location.lat);
     __find_and_assign (t0, p, "<lon>", '<', w->location.lon);
+    __find_and_assign (t0, p, "<zone>", '<', w->location.zone);
   } else {
     __assign_unknown (w->location.name);
     __assign_unknown (w->location.lat);
     __assign_unknown (w->location.lon);
+    __assign_unknown (w->location.zone);
   }
   /* }}} location */
 
 
 
   /* current_conditions {{{ */
-  p = strstr (content, "<cc>");
-  if (p && *p) {
+  p = find (content, end, "<cc>");
+  if (p) {
     __find_and_assign (t0, p, "<lsup>", '<',
                        w->current_conditions.last_updated);
     __find_and_assign (t0, p, "<tmp>", '<',
                        w->current_conditions.temperature);
     __find_and_assign (t0, p, "<dewp>", '<', w->current_conditions.dewpoint);
     __find_and_assign (t0, p, "<t>", '<', w->current_conditions.text);
+    __find_and_assign (t0, p, "<icon>", '<', w->current_conditions.icon);
     __find_and_assign (t0, p, "<vis>", '<', w->current_conditions.visibility);
     __find_and_assign (t0, p, "<hmid>", '<', w->current_conditions.humidity);
     __find_and_assign (t0, p, "<obst>", '<', w->current_conditions.station);
     __find_and_assign (t0, p, "<flik>", '<',
                        w->current_conditions.feels_like);
-    t0 = strstr (p, "<moon>");
-    if (t0 && *t0)
+    t0 = find (p, end, "<moon>");
+    if (t0)
       __find_and_assign (t1, t0, "<t>", '<',
                          w->current_conditions.moon_phase.text);
     else
       __assign_unknown (w->current_conditions.moon_phase.text);
-    t0 = strstr (p, "<uv>");
-    if (t0 && *t0) {
+    t0 = find (p, end, "<uv>");
+    if (t0) {
       __find_and_assign (t1, t0, "<i>", '<', w->current_conditions.uv.index);
       __find_and_assign (t1, t0, "<t>", '<', w->current_conditions.uv.text);
     } else {
       __assign_unknown (w->current_conditions.uv.index);
       __assign_unknown (w->current_conditions.uv.text);
     }
-    t0 = strstr (p, "<bar>");
-    if (t0 && *t0) {
+    t0 = find (p, end, "<bar>");
+    if (t0) {
       __find_and_assign (t1, t0, "<d>", '<',
                          w->current_conditions.barometer.direction);
       __find_and_assign (t1, t0, "<r>", '<',
@@ -185,8 +311,8 @@ fill_weather_struct (struct weather *w)
       __assign_unknown (w->current_conditions.barometer.direction);
       __assign_unknown (w->current_conditions.barometer.reading);
     }
-    t0 = strstr (p, "<wind>");
-    if (t0 && *t0) {
+    t0 = find (p, end, "<wind>");
+    if (t0) {
       __find_and_assign (t1, t0, "<gust>", '<',
                          w->current_conditions.wind.gust);
       __find_and_assign (t1, t0, "<d>", '<',
@@ -205,6 +331,7 @@ fill_weather_struct (struct weather *w)
     __assign_unknown (w->current_conditions.temperature);
     __assign_unknown (w->current_conditions.dewpoint);
     __assign_unknown (w->current_conditions.text);
+    __assign_unknown (w->current_conditions.icon);
     __assign_unknown (w->current_conditions.visibility);
     __assign_unknown (w->current_conditions.humidity);
     __assign_unknown (w->current_conditions.station);
@@ -224,111 +351,85 @@ fill_weather_struct (struct weather *w)
 
 
   /* forecasts {{{ */
-  p = strstr (content, "<dayf>");
-  if (p && *p) {
-    for (day = 0; day < WET_FORECAST_DAYS; ++day) {
-      t0 = strstr (p, "<day d=");
-      if (t0 && *t0) {
-        __find_and_assign (t1, t0, "t=\"", '"',
-                           w->forecasts[day].day_of_week);
-        __find_and_assign (t1, t0, "<hi>", '<', w->forecasts[day].high);
-        __find_and_assign (t1, t0, "<suns>", '<', w->forecasts[day].sunset);
-        __find_and_assign (t1, t0, "<low>", '<', w->forecasts[day].low);
-        __find_and_assign (t1, t0, "<sunr>", '<', w->forecasts[day].sunrise);
-        t1 = strstr (t0, "<part p=\"d\">");
-        if (t1 && *t1) {
-          t2 = strstr (t1, "<wind>");
-          if (t2 && *t2) {
-            __find_and_assign (t3, t2, "<s>", '<',
-                               w->forecasts[day].wind.speed);
-            __find_and_assign (t3, t2, "<gust>", '<',
-                               w->forecasts[day].wind.gust);
-            __find_and_assign (t3, t2, "<d>", '<',
-                               w->forecasts[day].wind.direction);
-            __find_and_assign (t3, t2, "<t>", '<',
-                               w->forecasts[day].wind.text);
-          } else {
-            __assign_unknown (w->forecasts[day].wind.gust);
-            __assign_unknown (w->forecasts[day].wind.direction);
-            __assign_unknown (w->forecasts[day].wind.speed);
-            __assign_unknown (w->forecasts[day].wind.text);
-          }
-          __find_and_assign (t2, t1, "<t>", '<', w->forecasts[day].text);
-          __find_and_assign (t2, t1, "<ppcp>", '<',
-                             w->forecasts[day].chance_precip);
-          __find_and_assign (t2, t1, "<hmid>", '<',
-                             w->forecasts[day].humidity);
-        } else {
-          __assign_unknown (w->forecasts[day].text);
-          __assign_unknown (w->forecasts[day].chance_precip);
-          __assign_unknown (w->forecasts[day].humidity);
-          __assign_unknown (w->forecasts[day].wind.gust);
-          __assign_unknown (w->forecasts[day].wind.direction);
-          __assign_unknown (w->forecasts[day].wind.speed);
-          __assign_unknown (w->forecasts[day].wind.text);
-        }
-        t1 = strstr (t0, "<part p=\"n\">");
-        if (t1 && *t1) {
-          t2 = strstr (t1, "<wind>");
-          if (t2 && *t2) {
-            __find_and_assign (t3, t2, "<s>", '<',
-                               w->forecasts[day].night.wind.speed);
-            __find_and_assign (t3, t2, "<gust>", '<',
-                               w->forecasts[day].night.wind.gust);
-            __find_and_assign (t3, t2, "<d>", '<',
-                               w->forecasts[day].night.wind.direction);
-            __find_and_assign (t3, t2, "<t>", '<',
-                               w->forecasts[day].night.wind.text);
-          } else {
-            __assign_unknown (w->forecasts[day].night.wind.gust);
-            __assign_unknown (w->forecasts[day].night.wind.direction);
-            __assign_unknown (w->forecasts[day].night.wind.speed);
-            __assign_unknown (w->forecasts[day].night.wind.text);
-          }
-          __find_and_assign (t2, t1, "<t>", '<',
-                             w->forecasts[day].night.text);
-          __find_and_assign (t2, t1, "<ppcp>", '<',
-                             w->forecasts[day].night.chance_precip);
-          __find_and_assign (t2, t1, "<hmid>", '<',
-                             w->forecasts[day].night.humidity);
-        } else {
-          __assign_unknown (w->forecasts[day].night.text);
-          __assign_unknown (w->forecasts[day].night.chance_precip);
-          __assign_unknown (w->forecasts[day].night.humidity);
-          __assign_unknown (w->forecasts[day].night.wind.gust);
-          __assign_unknown (w->forecasts[day].night.wind.direction);
-          __assign_unknown (w->forecasts[day].night.wind.speed);
-          __assign_unknown (w->forecasts[day].night.wind.text);
-        }
+  p = find (content, end, "<dayf>");
+  n_days = count_days (p, end);
+  if (!allocate_forecasts (w, (n_days) ? n_days : 1))
+    return false;
+  if (p)
+    __find_and_assign (t0, p, "<lsup>", '<', w->forecasts_updated);
+  else
+    __assign_unknown (w->forecasts_updated);
+  for (day = 0; day < n_days; ++day) {
+    t0 = find (p, end, "<day d=");
+    __find_and_assign (t1, t0, "t=\"", '"',
+                       w->forecasts[day].day_of_week);
+    __find_and_assign (t1, t0, "<hi>", '<', w->forecasts[day].high);
+    __find_and_assign (t1, t0, "<suns>", '<', w->forecasts[day].sunset);
+    __find_and_assign (t1, t0, "<low>", '<', w->forecasts[day].low);
+    __find_and_assign (t1, t0, "<sunr>", '<', w->forecasts[day].sunrise);
+    t1 = find (t0, end, "<part p=\"d\">");
+    if (t1) {
+      t2 = find (t1, end, "<wind>");
+      if (t2) {
+        __find_and_assign (t3, t2, "<s>", '<',
+                           w->forecasts[day].wind.speed);
+        __find_and_assign (t3, t2, "<gust>", '<',
+                           w->forecasts[day].wind.gust);
+        __find_and_assign (t3, t2, "<d>", '<',
+                           w->forecasts[day].wind.direction);
+        __find_and_assign (t3, t2, "<t>", '<',
+                           w->forecasts[day].wind.text);
       } else {
-        __assign_unknown (w->forecasts[day].day_of_week);
-        __assign_unknown (w->forecasts[day].high);
-        __assign_unknown (w->forecasts[day].sunset);
-        __assign_unknown (w->forecasts[day].low);
-        __assign_unknown (w->forecasts[day].sunrise);
-      }
-      t1 = strstr (t0, "</day>");
-      if (t1 && *t1) {
-        p = t1;
-        continue;
+        __assign_unknown (w->forecasts[day].wind.gust);
+        __assign_unknown (w->forecasts[day].wind.direction);
+        __assign_unknown (w->forecasts[day].wind.speed);
+        __assign_unknown (w->forecasts[day].wind.text);
       }
-      break;
-    }
-  } else {
-    for (day = 0; day < WET_FORECAST_DAYS; ++day) {
-      __assign_unknown (w->forecasts[day].day_of_week);
-      __assign_unknown (w->forecasts[day].high);
-      __assign_unknown (w->forecasts[day].sunset);
-      __assign_unknown (w->forecasts[day].low);
-      __assign_unknown (w->forecasts[day].sunrise);
+      __find_and_assign (t2, t1, "<t>", '<', w->forecasts[day].text);
+      __find_and_assign (t2, t1, "<icon>", '<', w->forecasts[day].icon);
+      __find_and_assign (t2, t1, "<ppcp>", '<',
+                         w->forecasts[day].chance_precip);
+      __find_and_assign (t2, t1, "<hmid>", '<',
+                         w->forecasts[day].humidity);
+    } else {
       __assign_unknown (w->forecasts[day].text);
+      __assign_unknown (w->forecasts[day].icon);
       __assign_unknown (w->forecasts[day].chance_precip);
       __assign_unknown (w->forecasts[day].humidity);
       __assign_unknown (w->forecasts[day].wind.gust);
       __assign_unknown (w->forecasts[day].wind.direction);
       __assign_unknown (w->forecasts[day].wind.speed);
       __assign_unknown (w->forecasts[day].wind.text);
+    }
+    t1 = find (t0, end, "<part p=\"n\">");
+    if (t1) {
+      t2 = find (t1, end, "<wind>");
+      if (t2) {
+        __find_and_assign (t3, t2, "<s>", '<',
+                           w->forecasts[day].night.wind.speed);
+        __find_and_assign (t3, t2, "<gust>", '<',
+                           w->forecasts[day].night.wind.gust);
+        __find_and_assign (t3, t2, "<d>", '<',
+                           w->forecasts[day].night.wind.direction);
+        __find_and_assign (t3, t2, "<t>", '<',
+                           w->forecasts[day].night.wind.text);
+      } else {
+        __assign_unknown (w->forecasts[day].night.wind.gust);
+        __assign_unknown (w->forecasts[day].night.wind.direction);
+        __assign_unknown (w->forecasts[day].night.wind.speed);
+        __assign_unknown (w->forecasts[day].night.wind.text);
+      }
+      __find_and_assign (t2, t1, "<t>", '<',
+                         w->forecasts[day].night.text);
+      __find_and_assign (t2, t1, "<icon>", '<',
+                         w->forecasts[day].night.icon);
+      __find_and_assign (t2, t1, "<ppcp>", '<',
+                         w->forecasts[day].night.chance_precip);
+      __find_and_assign (t2, t1, "<hmid>", '<',
+                         w->forecasts[day].night.humidity);
+    } else {
       __assign_unknown (w->forecasts[day].night.text);
+      __assign_unknown (w->forecasts[day].night.icon);
       __assign_unknown (w->forecasts[day].night.chance_precip);
       __assign_unknown (w->forecasts[day].night.humidity);
       __assign_unknown (w->forecasts[day].night.wind.gust);
@@ -336,18 +437,58 @@ fill_weather_struct (struct weather *w)
       __assign_unknown (w->forecasts[day].night.wind.speed);
       __assign_unknown (w->forecasts[day].night.wind.text);
     }
+    t1 = find (t0, end, "</day>");
+    if (!t1) {
+      w->n_forecasts = day + 1;
+      break;
+    }
+    p = t1;
+  }
+  if (!n_days) {
+    __assign_unknown (w->forecasts[0].day_of_week);
+    __assign_unknown (w->forecasts[0].high);
+    __assign_unknown (w->forecasts[0].sunset);
+    __assign_unknown (w->forecasts[0].low);
+    __assign_unknown (w->forecasts[0].sunrise);
+    __assign_unknown (w->forecasts[0].text);
+    __assign_unknown (w->forecasts[0].icon);
+    __assign_unknown (w->forecasts[0].chance_precip);
+    __assign_unknown (w->forecasts[0].humidity);
+    __assign_unknown (w->forecasts[0].wind.gust);
+    __assign_unknown (w->forecasts[0].wind.direction);
+    __assign_unknown (w->forecasts[0].wind.speed);
+    __assign_unknown (w->forecasts[0].wind.text);
+    __assign_unknown (w->forecasts[0].night.text);
+    __assign_unknown (w->forecasts[0].night.icon);
+    __assign_unknown (w->forecasts[0].night.chance_precip);
+    __assign_unknown (w->forecasts[0].night.humidity);
+    __assign_unknown (w->forecasts[0].night.wind.gust);
+    __assign_unknown (w->forecasts[0].night.wind.direction);
+    __assign_unknown (w->forecasts[0].night.wind.speed);
+    __assign_unknown (w->forecasts[0].night.wind.text);
   }
   /* }}} forecasts */
+  return true;
 }
 
 static void
-fill_location_id (struct weather *w)
+fill_location_id (char *location_id, const char *content, size_t n)
 {
-  bool use_unknown_string;
-  char *p;
+  size_t len;
+  const char *p;
+  const char *end;
+  struct wet_view id;
+
+  end = content + n;
+  p = find (content, end, "<loc id=\"");
+  if (!p)
+    return;
+  __assign (p, strlen ("<loc id=\""), '"', id);
 
-  use_unknown_string = false;
-  __find_and_assign (p, content, "<loc id=\"", '"', w->location_id);
+  /* the ID outlives the search document, so this one is copied */
+  len = (id.n < (WET_DATA_MAX - 1)) ? id.n : (WET_DATA_MAX - 1);
+  memcpy (location_id, id.p, len);
+  location_id[len] = '\0';
 }
 
 #undef __assign_unknown
@@ -399,24 +540,474 @@ encode_string (char *buffer, size_t max, const char *str)
   buffer[pos] = '\0';
 }
 
+/* Stores the server to connect to in HOST and PORT. This is always the
+   upstream HOST unless the WET_SERVER environment variable names another
+   one as HOST[:PORT] (for example a local fixture server). */
+static bool
+server_address (char *host, unsigned short *port, struct wet_error *err)
+{
+  char *server;
+  char *colon;
+  long n;
+
+  server = wet_getenv ("WET_SERVER");
+  if (!server || !*server) {
+    snprintf (host, HOSTMAX, "%s", HOST);
+    *port = PORT;
+    return true;
+  }
+
+  snprintf (host, HOSTMAX, "%s", server);
+  *port = PORT;
+  colon = strrchr (host, ':');
+  if (colon) {
+    *colon = '\0';
+    n = strtol (colon + 1, &server, 10);
+    if (*server || n <= 0 || n > 65535)
+      return wet_fail (err, WET_EOP, "invalid port in WET_SERVER: `%s'",
+                       colon + 1);
+    *port = (unsigned short) n;
+  }
+  return true;
+}
+
+/* Looks up every address of the server to connect to, storing its name
+   in HOST (a HOSTMAX sized buffer) and up to CANDIDATES_MAX addresses in
+   C in the order they are to be tried: alternating between IPv6 and
+   IPv4, starting with whichever the resolver put first (RFC 8305).
+   getaddrinfo() is used rather than gethostbyname(), whose static result
+   would not survive other threads resolving at the same time. Returns
+   how many addresses there are, or 0 with ERR saying why. */
+static size_t
+resolve_server (struct candidate *c, char *host, struct wet_error *err)
+{
+  struct addrinfo hints;
+  struct addrinfo *res;
+  struct addrinfo *ai;
+  struct addrinfo *by_family[2][CANDIDATES_MAX];
+  size_t n_family[2];
+  size_t n;
+  size_t i;
+  unsigned short port;
+  char service[8];
+  int first;
+  int k;
+  int f;
+  int e;
+
+  if (!server_address (host, &port, err))
+    return 0;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_NUMERICSERV;
+  snprintf (service, sizeof (service), "%u", port);
+  e = getaddrinfo (host, service, &hints, &res);
+  if (e != 0) {
+    wet_fail (err, WET_ENET, "failed to get host information: %s",
+              gai_strerror (e));
+    return 0;
+  }
+
+  /* 0 is IPv6 and 1 IPv4, each in the resolver's order */
+  first = 0;
+  n_family[0] = 0;
+  n_family[1] = 0;
+  for (ai = res; ai; ai = ai->ai_next) {
+    if (((ai->ai_family != AF_INET6) && (ai->ai_family != AF_INET)) ||
+        (ai->ai_addrlen > sizeof (struct sockaddr_storage)))
+      continue;
+    f = (ai->ai_family == AF_INET);
+    if (!n_family[0] && !n_family[1])
+      first = f;
+    if (n_family[f] < CANDIDATES_MAX)
+      by_family[f][n_family[f]++] = ai;
+  }
+
+  n = 0;
+  for (i = 0; (i < CANDIDATES_MAX) && (n < CANDIDATES_MAX); ++i) {
+    for (k = 0; k < 2; ++k) {
+      f = (k) ? !first : first;
+      if ((i >= n_family[f]) || (n == CANDIDATES_MAX))
+        continue;
+      memcpy (&c[n].addr, by_family[f][i]->ai_addr,
+              by_family[f][i]->ai_addrlen);
+      c[n++].len = by_family[f][i]->ai_addrlen;
+    }
+  }
+  freeaddrinfo (res);
+
+  if (!n)
+    wet_fail (err, WET_ENET, "failed to get host information: %s",
+              "no usable address");
+  else
+    wet_debug ("connecting to: \"%s:%u\" (%zu addresses)", host, port, n);
+  return n;
+}
+
+static bool
+set_blocking (int sock, bool blocking)
+{
+  int flags;
+
+  flags = fcntl (sock, F_GETFL);
+  if (flags == -1)
+    return false;
+  if (blocking)
+    flags &= ~O_NONBLOCK;
+  else
+    flags |= O_NONBLOCK;
+  return fcntl (sock, F_SETFL, flags) != -1;
+}
+
+/* Turns off Nagle's algorithm on SOCK: every request goes out in a
+   single write, so there is never anything for it to coalesce, and
+   holding back the tail of a pipeline for an ACK only adds latency. */
 static void
-retrieve_header (int sock, char *buffer, size_t n)
+tune_socket (int sock)
+{
+#if defined (HAVE_NETINET_TCP_H) && defined (TCP_NODELAY)
+  int on;
+
+  on = 1;
+  if (setsockopt (sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on)) == -1)
+    wet_debug ("failed to set TCP_NODELAY: %s", strerror (errno));
+#endif
+}
+
+/* Starts connecting SOCK to C. With TCP Fast Open, as much of the LEN
+   bytes of EARLY as fit go out in the SYN, and *SENT says how many that
+   was (none if there is no cookie for the server yet, in which case the
+   kernel asks for one). Anything stopping Fast Open from being used falls
+   back to a plain connect(). Returns connect()'s result. */
+static int
+connect_early (int sock, const struct candidate *c, const char *early,
+               size_t len, size_t *sent)
+{
+#ifdef HAVE_MSG_FASTOPEN
+  ssize_t n;
+
+  if (early && len) {
+    n = sendto (sock, early, len, MSG_FASTOPEN,
+                (const struct sockaddr *) &c->addr, c->len);
+    if (n >= 0) {
+      *sent = (size_t) n;
+      errno = EINPROGRESS;
+      return -1;
+    }
+    if ((errno == EINPROGRESS) || (errno == EINTR))
+      return -1;
+    wet_debug ("not using TCP Fast Open: %s", strerror (errno));
+  }
+#endif
+  return connect (sock, (const struct sockaddr *) &c->addr, c->len);
+}
+
+/* Starts connecting a non-blocking socket to C, setting CONNECTED if it
+   got there at once. The LEN bytes of EARLY (if any) are the start of
+   what is to be sent, and *SENT says how many of them have been already
+   (see connect_early()). Returns -1, with errno saying why, if the
+   attempt failed straight away. */
+static int
+start_connection (const struct candidate *c, const char *early,
+                  size_t len, size_t *sent, bool *connected)
+{
+  int sock;
+  int saved;
+
+  *connected = false;
+  *sent = 0;
+  sock = socket (c->addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+  if (sock == -1)
+    return -1;
+  if (set_blocking (sock, false)) {
+    tune_socket (sock);
+    if (connect_early (sock, c, early, len, sent) == 0) {
+      *connected = true;
+      return sock;
+    }
+    if ((errno == EINPROGRESS) || (errno == EINTR))
+      return sock;
+  }
+  saved = errno;
+  close (sock);
+  errno = saved;
+  return -1;
+}
+
+/* Remembers C as the address that won the last race. */
+static void
+remember_winner (const struct candidate *c)
+{
+  pthread_mutex_lock (&winner_lock);
+  last_winner = *c;
+  have_winner = true;
+  pthread_mutex_unlock (&winner_lock);
+}
+
+/* Returns which of the N addresses in C a transport that cannot race
+   them should use: the one that won the last race, if it is among them,
+   or else the first. */
+static size_t
+preferred_candidate (const struct candidate *c, size_t n)
+{
+  size_t i;
+
+  pthread_mutex_lock (&winner_lock);
+  for (i = 0; have_winner && (i < n); ++i)
+    if ((c[i].len == last_winner.len) &&
+        (memcmp (&c[i].addr, &last_winner.addr, c[i].len) == 0))
+      break;
+  pthread_mutex_unlock (&winner_lock);
+  return (have_winner && (i < n)) ? i : 0;
+}
+
+/* Connects to one of the N addresses in C, racing them the Happy
+   Eyeballs way (RFC 8305): the attempts start in order, each one either
+   once the one before has failed or after CONNECT_ATTEMPT_DELAY has gone
+   by without it connecting, and the first to connect wins, the rest
+   being abandoned. Every attempt carries the EARLY_LEN bytes of EARLY in
+   its SYN if it can (see start_connection()); they are GET requests,
+   which the server may safely see on a connection that loses. *SENT says how
+   many of them went out on the winner. Returns the connected (blocking)
+   socket, or -1 with ERR saying why if none of them connected. */
+static int
+race_connections (const struct candidate *c, size_t n, const char *early,
+                  size_t early_len, size_t *sent, struct wet_error *err)
+{
+  struct pollfd fds[CANDIDATES_MAX];
+  size_t early_sent[CANDIDATES_MAX];
+  size_t started;
+  size_t live;
+  size_t i;
+  socklen_t len;
+  bool start_next;
+  bool connected;
+  int winner;
+  int last_error;
+  int ready;
+  int e;
+
+  started = 0;
+  live = 0;
+  winner = -1;
+  last_error = 0;
+  start_next = true;
+
+  while ((winner == -1) && ((started < n) || live)) {
+    if (start_next && (started < n)) {
+      i = started++;
+      fds[i].fd = start_connection (&c[i], early, early_len,
+                                    &early_sent[i], &connected);
+      fds[i].events = POLLOUT;
+      fds[i].revents = 0;
+      if (fds[i].fd == -1)
+        last_error = errno;
+      else if (connected) {
+        remember_winner (&c[i]);
+        winner = fds[i].fd;
+        *sent = early_sent[i];
+        fds[i].fd = -1;
+      } else {
+        live++;
+        start_next = false;
+      }
+      continue;
+    }
+
+    ready = poll (fds, started, (started < n) ? CONNECT_ATTEMPT_DELAY : -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+        continue;
+      last_error = errno;
+      break;
+    }
+    if (ready == 0) {
+      wet_debug ("no connection after %i ms, trying the next address",
+                 CONNECT_ATTEMPT_DELAY);
+      start_next = true;
+      continue;
+    }
+    for (i = 0; i < started; ++i) {
+      if ((fds[i].fd == -1) || !fds[i].revents)
+        continue;
+      len = sizeof (e);
+      if (getsockopt (fds[i].fd, SOL_SOCKET, SO_ERROR, &e, &len) == -1)
+        e = errno;
+      if (e) {
+        last_error = e;
+        close (fds[i].fd);
+        fds[i].fd = -1;
+        live--;
+        start_next = true;
+      } else if (winner == -1) {
+        wet_debug ("connected to address %zu of %zu", i + 1, n);
+        remember_winner (&c[i]);
+        winner = fds[i].fd;
+        *sent = early_sent[i];
+        fds[i].fd = -1;
+      }
+    }
+  }
+
+  for (i = 0; i < started; ++i)
+    if (fds[i].fd != -1)
+      close (fds[i].fd);
+  if ((winner != -1) && !set_blocking (winner, true)) {
+    last_error = errno;
+    close (winner);
+    winner = -1;
+  }
+  if (winner == -1)
+    wet_fail (err, WET_ENET, "failed to connect socket: %s",
+              strerror (last_error));
+  return winner;
+}
+
+/* Connects C to the server, with the LEN bytes of GET (the requests to
+   be sent over it) going out in the SYN if TCP Fast Open allows; *SENT
+   says how many of them did. */
+static bool
+connection_open (struct connection *c, const char *get, size_t len,
+                 size_t *sent, struct wet_error *err)
+{
+  struct candidate candidates[CANDIDATES_MAX];
+  char host[HOSTMAX];
+  size_t n;
+
+  c->pos = 0;
+  c->len = 0;
+  c->id = wet_record_connection ();
+  c->n_sent = 0;
+  c->n_received = 0;
+  c->sock = -1;
+
+  n = resolve_server (candidates, host, err);
+  if (!n)
+    return false;
+  wet_record (WET_RECORD_CONNECT, c->id, 0, host, strlen (host));
+  c->sock = race_connections (candidates, n, get, len, sent, err);
+  if (c->sock == -1)
+    return false;
+  wet_record (WET_RECORD_CONNECTED, c->id, 0, "", 0);
+  return true;
+}
+
+static void
+connection_close (struct connection *c)
+{
+  if (c->sock != -1) {
+    close (c->sock);
+    wet_record (WET_RECORD_CLOSE, c->id, c->n_received, "", 0);
+  }
+  c->sock = -1;
+}
+
+/* Returns the next byte from the connection, or -1 if the peer closed
+   the connection (or an error occurred) before one became available. */
+static int
+connection_getc (struct connection *c)
 {
-  size_t pos;
   ssize_t n_read;
 
+  if (c->pos == c->len) {
+    do
+      n_read = read (c->sock, c->buf, READBUFMAX);
+    while ((n_read == -1) && (errno == EINTR));
+    if (n_read <= 0)
+      return -1;
+    c->pos = 0;
+    c->len = (size_t) n_read;
+  }
+  return (unsigned char) c->buf[c->pos++];
+}
+
+/* Formats the GET requests for the N PATHS back-to-back into a buffer
+   taken from ALLOCATOR, storing where each one ends in ENDS (taken from
+   it too). Returns NULL if there is no memory for them. */
+static char *
+format_requests (const char **paths, size_t n, size_t **ends,
+                 const struct wet_allocator *allocator)
+{
+  size_t i;
+  size_t len;
+  char *get;
+
+  get = (char *) wet_alloc (allocator, n * GETMAX);
+  *ends = (size_t *) wet_alloc (allocator, n * sizeof (size_t));
+  if (!get || !*ends) {
+    wet_release (allocator, get);
+    wet_release (allocator, *ends);
+    return NULL;
+  }
+
+  len = 0;
+  for (i = 0; i < n; ++i) {
+    wet_debug ("requesting: \"%s%s\"", HOST, paths[i]);
+    len += snprintf (get + len, GETMAX, GET, paths[i]);
+    (*ends)[i] = len;
+  }
+  return get;
+}
+
+/* Writes the N GET requests in GET (see format_requests()) back-to-back
+   in a single write so the server sees them as one pipeline, starting
+   after the SENT bytes that went out with the SYN. */
+static bool
+send_requests (struct connection *c, const char *get, const size_t *ends,
+               size_t n, size_t sent, struct wet_error *err)
+{
+  size_t i;
+  size_t len;
+  size_t pos;
+  ssize_t n_write;
+
+  len = ends[n - 1];
+  if (sent)
+    wet_debug ("%zu of %zu request bytes sent with the SYN", sent, len);
+
+  for (pos = sent; pos < len; pos += n_write) {
+    n_write = write (c->sock, get + pos, len - pos);
+    if (n_write < 0) {
+      if (errno == EINTR) {
+        n_write = 0;
+        continue;
+      }
+      return wet_fail (err, WET_ENET, "failed to send GET request: %s",
+                       strerror (errno));
+    }
+  }
+
+  for (i = 0, pos = 0; i < n; pos = ends[i++])
+    wet_record (WET_RECORD_REQUEST, c->id, c->n_sent++, get + pos,
+                ends[i] - pos);
+  return true;
+}
+
+static enum response_status
+retrieve_header (struct connection *c, char *buffer, size_t n,
+                 struct wet_error *err)
+{
+  int ch;
+  size_t pos;
+
   pos = 0;
   buffer[0] = '\0';
 
   while (true) {
-    n_read = read (sock, buffer + pos, 1);
-    if (n_read) {
-      pos += n_read;
-      buffer[pos] = '\0';
-      if (strstr (buffer, HEADER_DELIMITER))
-        break;
+    ch = connection_getc (c);
+    if (ch == -1)
+      return RESPONSE_CLOSED;
+    if (pos == (n - 1)) {
+      wet_fail (err, WET_ENET, "http header too large");
+      return RESPONSE_FAILED;
     }
+    buffer[pos++] = (char) ch;
+    buffer[pos] = '\0';
+    if ((pos >= 4) && (memcmp (buffer + pos - 4, HEADER_DELIMITER, 4) == 0))
+      break;
   }
+  return RESPONSE_OK;
 }
 
 static void
@@ -429,6 +1020,7 @@ read_header (struct headerdata *hd, const char *header)
 
   hd->status = -1;
   hd->content_length = 0;
+  hd->close = false;
   hd->status_text[0] = '\0';
 
   status_buffer[0] = '\0';
@@ -459,123 +1051,1198 @@ read_header (struct headerdata *hd, const char *header)
     content_length_buffer[i] = '\0';
     hd->content_length = wet_str2size (content_length_buffer);
   }
+
+  p = strstr (header, "Connection:");
+  if (p && *p) {
+    p += strlen ("Connection:");
+    while (*p && (*p == ' '))
+      p++;
+    if (strncmp (p, "close", strlen ("close")) == 0)
+      hd->close = true;
+  }
 }
 
-static void
-retrieve_content (int sock, ssize_t n)
+static bool
+retrieve_content (struct connection *c, char *buffer, size_t n)
 {
+  int ch;
   size_t pos;
-  ssize_t n_read;
 
-  pos = 0;
-  content[0] = '\0';
+  buffer[0] = '\0';
 
-  while (true) {
-    n_read = read (sock, content + pos, 1);
-    if (n_read) {
-      pos += n_read;
-      content[pos] = '\0';
-      if (pos >= n)
-        break;
-    }
+  for (pos = 0; pos < n; ++pos) {
+    ch = connection_getc (c);
+    if (ch == -1)
+      return false;
+    buffer[pos] = (char) ch;
   }
+  buffer[pos] = '\0';
+  return true;
 }
 
-static void
-http_get_request (const char *path)
+/* Reads one complete response off the connection, its body into B. */
+static enum response_status
+retrieve_response (struct connection *c, struct headerdata *hd,
+                   struct wet_buffer *b, struct wet_error *err)
 {
-  int sock;
-  long n_haddr;
-  ssize_t n_write;
-  char get[GETMAX];
   char header[HEADERMAX];
-  struct sockaddr_in a;
+  enum response_status status;
+
+  status = retrieve_header (c, header, HEADERMAX, err);
+  if (status != RESPONSE_OK)
+    return status;
+  wet_record (WET_RECORD_HEADER, c->id, c->n_received, header,
+              strlen (header));
+  memset (hd, 0, sizeof (struct headerdata));
+  read_header (hd, header);
+
+  wet_debug ("http status: %i (%s)", hd->status, hd->status_text);
+  if (hd->status != 200) {
+    wet_fail (err, WET_ENET, "http: %i (%s)", hd->status, hd->status_text);
+    return RESPONSE_FAILED;
+  }
+
+  b->p = (char *) wet_alloc (c->allocator, hd->content_length + 1);
+  b->n = hd->content_length;
+  b->mapped = false;
+  b->allocator = c->allocator;
+  if (!b->p) {
+    wet_fail (err, WET_ESYS, "failed to allocate memory");
+    return RESPONSE_FAILED;
+  }
+
+  if (!retrieve_content (c, b->p, b->n)) {
+    wet_buffer_free (b);
+    return RESPONSE_CLOSED;
+  }
+  wet_record (WET_RECORD_BODY, c->id, c->n_received++, b->p, b->n);
+  return RESPONSE_OK;
+}
+
+/* Fetches every path in PATHS from HOST, handing each response body
+   (taken from ALLOCATOR, ownership passes with it) to FUNC as soon as it
+   has been read, in request order. All requests are pipelined on a single
+   connection. If the server closes the connection before every response
+   has been read, the remaining requests are retried serially, one
+   connection each. Returns false, with ERR saying why, if a request
+   failed; FUNC has had the responses before it by then. */
+static bool
+http_get_portable (const char **paths, size_t n, wet_net_body_func func,
+                   void *arg, const struct wet_allocator *allocator,
+                   struct wet_error *err)
+{
+  size_t i;
+  size_t done;
+  size_t count;
+  size_t sent;
+  size_t *ends;
+  char *get;
+  bool pipeline;
+  bool requested;
+  struct wet_buffer body;
+  struct connection c;
   struct headerdata hd;
-  struct hostent *h;
+  enum response_status status;
+
+  done = 0;
+  pipeline = true;
+
+  while (done < n) {
+    count = (pipeline) ? (n - done) : 1;
+    get = format_requests (paths + done, count, &ends, allocator);
+    if (!get)
+      return wet_fail (err, WET_ESYS, "failed to allocate memory");
+    c.allocator = allocator;
+    sent = 0;
+    if (!connection_open (&c, get, ends[count - 1], &sent, err)) {
+      wet_release (allocator, ends);
+      wet_release (allocator, get);
+      return false;
+    }
+    requested = send_requests (&c, get, ends, count, sent, err);
+    wet_release (allocator, ends);
+    wet_release (allocator, get);
+
+    status = RESPONSE_OK;
+    if (!requested) {
+      if (count == 1) {
+        connection_close (&c);
+        return false;
+      }
+      i = 0;
+    } else {
+      for (i = 0; i < count; ++i) {
+        status = retrieve_response (&c, &hd, &body, err);
+        if (status != RESPONSE_OK)
+          break;
+        func (done++, &body, arg);
+        if (hd.close && (i + 1 < count)) {
+          ++i;
+          break;
+        }
+      }
+    }
+    connection_close (&c);
+
+    if (status == RESPONSE_FAILED)
+      return false;
+    if (i < count) {
+      if (count == 1)
+        return wet_fail (err, WET_ENET, "connection closed by server");
+      wet_debug ("pipeline interrupted after %zu of %zu responses, "
+                 "falling back to serial requests", done, n);
+      pipeline = false;
+    }
+  }
+  return true;
+}
 
-  sock = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP);
-  if (sock == -1)
-    wet_die (WET_ENET, "failed to create socket: %s", strerror (errno));
+/* The responses on one connection, read incrementally as they arrive:
+   PATHS[0..N) are requests FIRST.. of the whole fetch, and the response
+   to the next one (number DONE) is being read into HEADER and BODY. */
+struct http_stream {
+  const char **paths;
+  size_t first;
+  size_t n;
+  size_t done;
+  unsigned long id;
+  char *requests;
+  size_t *ends;
+  char header[HEADERMAX];
+  size_t header_len;
+  struct headerdata hd;
+  char *body;
+  size_t body_len;
+  const struct wet_allocator *allocator; /* for BODY */
+};
+
+/* Reads the *N bytes at *P, the next part of the responses on HS, the
+   same way retrieve_response() does, advancing past what was used. Stops
+   at RESPONSE_OK once the response being read is complete (its body is
+   in HS->body), or at RESPONSE_PARTIAL once the bytes run out first. */
+static enum response_status
+stream_receive (struct http_stream *hs, const char **p, size_t *n,
+                struct wet_error *err)
+{
+  size_t take;
+
+  while (*n) {
+    if (!hs->body) {
+      if (hs->header_len == HEADERMAX - 1) {
+        wet_fail (err, WET_ENET, "http header too large");
+        return RESPONSE_FAILED;
+      }
+      hs->header[hs->header_len++] = *(*p)++;
+      hs->header[hs->header_len] = '\0';
+      (*n)--;
+      if ((hs->header_len < 4) ||
+          (memcmp (hs->header + hs->header_len - 4, HEADER_DELIMITER, 4)))
+        continue;
 
-  h = gethostbyname (HOST);
-  if (!h) {
-    close (sock);
-    wet_die (WET_ENET, "failed to get host information");
+      wet_record (WET_RECORD_HEADER, hs->id, hs->done, hs->header,
+                  hs->header_len);
+      read_header (&hs->hd, hs->header);
+      wet_debug ("http status: %i (%s)", hs->hd.status, hs->hd.status_text);
+      if (hs->hd.status != 200) {
+        wet_fail (err, WET_ENET, "http: %i (%s)", hs->hd.status,
+                  hs->hd.status_text);
+        return RESPONSE_FAILED;
+      }
+      hs->body = (char *) wet_alloc (hs->allocator,
+                                     hs->hd.content_length + 1);
+      if (!hs->body) {
+        wet_fail (err, WET_ESYS, "failed to allocate memory");
+        return RESPONSE_FAILED;
+      }
+      hs->body_len = 0;
+    } else {
+      take = hs->hd.content_length - hs->body_len;
+      if (take > *n)
+        take = *n;
+      memcpy (hs->body + hs->body_len, *p, take);
+      hs->body_len += take;
+      *p += take;
+      *n -= take;
+    }
+    if (hs->body && (hs->body_len == hs->hd.content_length)) {
+      hs->body[hs->body_len] = '\0';
+      return RESPONSE_OK;
+    }
   }
+  return RESPONSE_PARTIAL;
+}
+
+#ifdef HAVE_LIBURING
+struct uring_fetch {
+  const char *host;
+  struct http_stream *streams;
+  wet_net_body_func func;
+  void *arg;
+  bool failed;
+  struct wet_error *err;
+};
+
+static void
+uring_connecting (size_t i, void *arg)
+{
+  struct uring_fetch *u;
+
+  u = (struct uring_fetch *) arg;
+  wet_record (WET_RECORD_CONNECT, u->streams[i].id, 0, u->host,
+              strlen (u->host));
+}
+
+static void
+uring_connected (size_t i, void *arg)
+{
+  struct http_stream *hs;
+
+  hs = &((struct uring_fetch *) arg)->streams[i];
+  wet_record (WET_RECORD_CONNECTED, hs->id, 0, "", 0);
+}
+
+static void
+uring_sent (size_t i, void *arg)
+{
+  struct http_stream *hs;
+  size_t j;
+  size_t pos;
+
+  hs = &((struct uring_fetch *) arg)->streams[i];
+  for (j = 0, pos = 0; j < hs->n; pos = hs->ends[j++])
+    wet_record (WET_RECORD_REQUEST, hs->id, j, hs->requests + pos,
+                hs->ends[j] - pos);
+}
+
+/* Hands the complete response body of HS to the caller. Returns false if
+   no more responses are to be read from HS. */
+static bool
+deliver_body (struct uring_fetch *u, struct http_stream *hs)
+{
+  struct wet_buffer b;
+
+  wet_record (WET_RECORD_BODY, hs->id, hs->done, hs->body, hs->body_len);
+  b.p = hs->body;
+  b.n = hs->body_len;
+  b.mapped = false;
+  b.allocator = hs->allocator;
+  u->func (hs->first + hs->done++, &b, u->arg);
+  hs->body = NULL;
+  hs->header_len = 0;
+  return (hs->done < hs->n) && !hs->hd.close;
+}
+
+/* Ends stream HS because of a failure the whole fetch fails with. */
+static bool
+uring_fail (struct uring_fetch *u, struct http_stream *hs)
+{
+  u->failed = true;
+  wet_release (hs->allocator, hs->body);
+  hs->body = NULL;
+  wet_record (WET_RECORD_CLOSE, hs->id, hs->done, "", 0);
+  return false;
+}
 
-  memcpy (&n_haddr, h->h_addr, h->h_length);
-  a.sin_addr.s_addr = n_haddr;
-  a.sin_port = htons (PORT);
-  a.sin_family = AF_INET;
+/* Reads the N bytes at P, the next part of the responses on stream I. */
+static bool
+uring_received (size_t i, const char *p, size_t n, void *arg)
+{
+  struct uring_fetch *u;
+  struct http_stream *hs;
+  enum response_status status;
+
+  u = (struct uring_fetch *) arg;
+  hs = &u->streams[i];
+  if (!n) {
+    wet_release (hs->allocator, hs->body);
+    hs->body = NULL;
+    wet_record (WET_RECORD_CLOSE, hs->id, hs->done, "", 0);
+    return false;
+  }
 
-  wet_debug ("connecting to: \"%s%s\"", HOST, path);
-  if (connect (sock, (struct sockaddr *) &a, sizeof (a)) == -1) {
-    close (sock);
-    wet_die (WET_ENET, "failed to connect socket: %s", strerror (errno));
+  while (n) {
+    status = stream_receive (hs, &p, &n, u->err);
+    if (status == RESPONSE_FAILED)
+      return uring_fail (u, hs);
+    if ((status == RESPONSE_OK) && !deliver_body (u, hs))
+      break;
   }
+  if (hs->body || ((hs->done < hs->n) && !hs->hd.close))
+    return true;
+  wet_record (WET_RECORD_CLOSE, hs->id, hs->done, "", 0);
+  return false;
+}
 
-  snprintf (get, GETMAX, GET, path);
+struct remap {
+  const size_t *indexes;
+  wet_net_body_func func;
+  void *arg;
+};
 
-  n_write = write (sock, get, strlen (get));
-  if (n_write < 0) {
-    close (sock);
-    wet_die (WET_ENET, "failed to send GET request: %s", strerror (errno));
+static void
+remap_body (size_t index, struct wet_buffer *body, void *arg)
+{
+  struct remap *r;
+
+  r = (struct remap *) arg;
+  r->func (r->indexes[index], body, r->arg);
+}
+
+/* Fetches again, the portable way, the requests of the N_STREAMS streams
+   of U that got no response. */
+static bool
+uring_fetch_missing (struct uring_fetch *u, size_t n_streams,
+                     struct wet_error *err)
+{
+  const struct wet_allocator *allocator;
+  struct http_stream *hs;
+  struct remap r;
+  const char **left;
+  size_t *indexes;
+  size_t n_left;
+  size_t i;
+  size_t j;
+  bool ok;
+
+  n_left = 0;
+  for (i = 0; i < n_streams; ++i)
+    n_left += u->streams[i].n - u->streams[i].done;
+  if (!n_left)
+    return true;
+
+  wet_debug ("%zu responses missing, fetching them again", n_left);
+  allocator = u->streams[0].allocator;
+  left = (const char **) wet_alloc (allocator,
+                                    n_left * sizeof (const char *));
+  indexes = (size_t *) wet_alloc (allocator, n_left * sizeof (size_t));
+  if (!left || !indexes) {
+    wet_release (allocator, indexes);
+    wet_release (allocator, left);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+  n_left = 0;
+  for (i = 0; i < n_streams; ++i) {
+    hs = &u->streams[i];
+    for (j = hs->done; j < hs->n; ++j) {
+      left[n_left] = hs->paths[j];
+      indexes[n_left++] = hs->first + j;
+    }
   }
+  r.indexes = indexes;
+  r.func = u->func;
+  r.arg = u->arg;
+  ok = http_get_portable (left, n_left, remap_body, &r, allocator, err);
+  wet_release (allocator, indexes);
+  wet_release (allocator, left);
+  return ok;
+}
 
-  retrieve_header (sock, header, HEADERMAX);
-  memset (&hd, 0, sizeof (struct headerdata));
-  read_header (&hd, header);
+/* Fetches PATHS like http_get_portable(), but spread over as many as
+   URING_STREAMS connections driven through io_uring. Requests a stream
+   did not get a response to (it was closed early, or its connection
+   failed) are fetched again the portable way, as is everything if
+   io_uring cannot be used. */
+static bool
+http_get_uring (const char **paths, size_t n, wet_net_body_func func,
+                void *arg, const struct wet_allocator *allocator,
+                struct wet_error *err)
+{
+  static const struct wet_uring_handlers handlers = {
+    uring_connecting, uring_connected, uring_sent, uring_received
+  };
+  struct uring_fetch u;
+  struct wet_uring_stream *streams;
+  struct http_stream *hs;
+  struct candidate candidates[CANDIDATES_MAX];
+  char host[HOSTMAX];
+  size_t n_candidates;
+  size_t pick;
+  size_t n_streams;
+  size_t i;
+  bool ok;
+
+  n_streams = n / URING_REQUESTS_PER_STREAM;
+  if (n_streams > URING_STREAMS)
+    n_streams = URING_STREAMS;
+  u.streams = (struct http_stream *) wet_alloc (allocator, n_streams *
+                                                sizeof (*u.streams));
+  streams = (struct wet_uring_stream *) wet_alloc (allocator, n_streams *
+                                                   sizeof (*streams));
+  if (!u.streams || !streams) {
+    wet_release (allocator, streams);
+    wet_release (allocator, u.streams);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+  memset (u.streams, 0, n_streams * sizeof (*u.streams));
+  u.func = func;
+  u.arg = arg;
+  u.failed = false;
+  u.err = err;
+
+  n_candidates = resolve_server (candidates, host, err);
+  ok = n_candidates > 0;
+  pick = ok ? preferred_candidate (candidates, n_candidates) : 0;
+  u.host = host;
+  for (i = 0; ok && (i < n_streams); ++i) {
+    hs = &u.streams[i];
+    hs->first = n * i / n_streams;
+    hs->n = n * (i + 1) / n_streams - hs->first;
+    hs->paths = paths + hs->first;
+    hs->id = wet_record_connection ();
+    hs->allocator = allocator;
+    hs->requests = format_requests (hs->paths, hs->n, &hs->ends,
+                                    allocator);
+    if (!hs->requests)
+      ok = wet_fail (err, WET_ESYS, "failed to allocate memory");
+    else {
+      streams[i].request = hs->requests;
+      streams[i].len = hs->ends[hs->n - 1];
+    }
+  }
 
-  wet_debug ("http status: %i (%s)", hd.status, hd.status_text);
-  if (hd.status != 200) {
-    close (sock);
-    wet_die (WET_ENET, "http: %i (%s)", hd.status, hd.status_text);
+  if (ok) {
+    if (wet_uring_exchange ((const struct sockaddr *) &candidates[pick].addr,
+                            candidates[pick].len, streams, n_streams,
+                            &handlers, &u))
+      ok = !u.failed && uring_fetch_missing (&u, n_streams, err);
+    else
+      ok = http_get_portable (paths, n, func, arg, allocator, err);
   }
 
-  wet_free (content);
+  for (i = 0; i < n_streams; ++i) {
+    wet_release (allocator, u.streams[i].requests);
+    wet_release (allocator, u.streams[i].ends);
+  }
+  wet_release (allocator, streams);
+  wet_release (allocator, u.streams);
+  return ok;
+}
+#endif /* HAVE_LIBURING */
+
+/* Fetches PATHS (see http_get_portable()). Large fetches go over several
+   connections at once through io_uring where it is available, in which
+   case FUNC gets the responses in request order per connection only. */
+static bool
+http_get_pipelined (const char **paths, size_t n, wet_net_body_func func,
+                    void *arg, const struct wet_allocator *allocator,
+                    struct wet_error *err)
+{
+#ifdef HAVE_LIBURING
+  if (n >= URING_MIN_REQUESTS)
+    return http_get_uring (paths, n, func, arg, allocator, err);
+#endif
+  return http_get_portable (paths, n, func, arg, allocator, err);
+}
+
+/* One set of identical requests sharing a single fetch (see
+   coalesce_requests()): the paths at members[0..n_members), in request
+   order. */
+struct request_group {
+  size_t *members;
+  size_t n_members;
+};
+
+struct coalesced {
+  struct request_group *groups;
+  wet_net_body_func func;
+  void *arg;
+  bool failed;
+};
+
+static bool
+copy_body (struct wet_buffer *to, const struct wet_buffer *from,
+           const struct wet_allocator *allocator)
+{
+  to->p = (char *) wet_alloc (allocator, from->n + 1);
+  if (!to->p)
+    return false;
+  memcpy (to->p, from->p, from->n);
+  to->p[from->n] = '\0';
+  to->n = from->n;
+  to->mapped = false;
+  to->allocator = allocator;
+  return true;
+}
+
+/* a request's path and its place in the batch, for sorting */
+struct keyed_request {
+  const char *path;
+  size_t index;
+};
+
+static int
+compare_by_path (const void *a, const void *b)
+{
+  const struct keyed_request *x;
+  const struct keyed_request *y;
+  int cmp;
+
+  x = (const struct keyed_request *) a;
+  y = (const struct keyed_request *) b;
+  cmp = strcmp (x->path, y->path);
+  if (cmp)
+    return cmp;
+  return (x->index > y->index) - (x->index < y->index);
+}
 
-  content = (char *) malloc (hd.content_length + 1);
-  if (!content) {
-    close (sock);
-    wet_die (WET_ESYS, "failed to allocate memory: %s", strerror (errno));
+static int
+compare_by_first_member (const void *a, const void *b)
+{
+  size_t i;
+  size_t j;
+
+  i = ((const struct request_group *) a)->members[0];
+  j = ((const struct request_group *) b)->members[0];
+  return (i > j) - (i < j);
+}
+
+/* Hands the body of one unique request to every request it stands for,
+   each getting a copy but the last. A copy that cannot be made fails
+   the fetch, once it is over. */
+static void
+fan_out (size_t index, struct wet_buffer *body, void *arg)
+{
+  struct coalesced *co;
+  struct request_group *g;
+  struct wet_buffer copy;
+  size_t i;
+
+  co = (struct coalesced *) arg;
+  g = &co->groups[index];
+  for (i = 0; i + 1 < g->n_members; ++i) {
+    if (!copy_body (&copy, body, body->allocator)) {
+      co->failed = true;
+      continue;
+    }
+    co->func (g->members[i], &copy, co->arg);
   }
+  co->func (g->members[i], body, co->arg);
+}
 
-  retrieve_content (sock, hd.content_length);
-  close (sock);
+/* Like http_get_pipelined(), but every distinct path is requested only
+   once, however many times it appears in PATHS, and its body is handed
+   to FUNC for each of them. The distinct requests go out in the order of
+   their first appearance. The bookkeeping comes from ALLOCATOR, like the
+   bodies. */
+static bool
+http_get_coalesced (const char **paths, size_t n, wet_net_body_func func,
+                    void *arg, const struct wet_allocator *allocator,
+                    struct wet_error *err)
+{
+  struct keyed_request *sorted;
+  size_t *order;
+  const char **unique;
+  struct coalesced co;
+  size_t n_unique;
+  size_t i;
+  bool ok;
+
+  sorted = (struct keyed_request *) wet_alloc (allocator,
+                                               n * sizeof (*sorted));
+  order = (size_t *) wet_alloc (allocator, n * sizeof (size_t));
+  co.groups = (struct request_group *) wet_alloc (allocator,
+                                                  n * sizeof (*co.groups));
+  unique = (const char **) wet_alloc (allocator, n * sizeof (const char *));
+  if (!sorted || !order || !co.groups || !unique) {
+    wet_release (allocator, unique);
+    wet_release (allocator, co.groups);
+    wet_release (allocator, order);
+    wet_release (allocator, sorted);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+
+  /* group identical paths, each group in request order */
+  for (i = 0; i < n; ++i) {
+    sorted[i].path = paths[i];
+    sorted[i].index = i;
+  }
+  qsort (sorted, n, sizeof (*sorted), compare_by_path);
+  n_unique = 0;
+  for (i = 0; i < n; ++i) {
+    order[i] = sorted[i].index;
+    if (!i || strcmp (sorted[i - 1].path, sorted[i].path)) {
+      co.groups[n_unique].members = &order[i];
+      co.groups[n_unique++].n_members = 0;
+    }
+    co.groups[n_unique - 1].n_members++;
+  }
+  qsort (co.groups, n_unique, sizeof (*co.groups), compare_by_first_member);
+
+  for (i = 0; i < n_unique; ++i)
+    unique[i] = paths[co.groups[i].members[0]];
+  if (n_unique < n)
+    wet_debug ("coalesced %zu requests into %zu", n, n_unique);
+
+  co.func = func;
+  co.arg = arg;
+  co.failed = false;
+  ok = http_get_pipelined (unique, n_unique, fan_out, &co, allocator, err);
+  if (ok && co.failed)
+    ok = wet_fail (err, WET_ESYS, "failed to allocate memory");
+  wet_release (allocator, unique);
+  wet_release (allocator, co.groups);
+  wet_release (allocator, order);
+  wet_release (allocator, sorted);
+  return ok;
 }
 
+/* A single request being fetched by one thread on behalf of every thread
+   that asks for the same path meanwhile (see http_get_request()). The
+   table of them is the one piece of state fetches share, so that
+   concurrent users of the library coalesce too; it is only ever touched
+   under flights_lock. */
+struct flight {
+  const char *path;
+  bool landed;
+  bool ok;
+  size_t n_waiting;
+  struct wet_buffer body;
+  struct wet_error error;
+  struct flight *next;
+};
+
+static pthread_mutex_t flights_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flights_landed = PTHREAD_COND_INITIALIZER;
+static struct flight *flights = NULL;
+static struct wet_slab flight_slab =
+  WET_SLAB_INITIALIZER (sizeof (struct flight), 64);
+
 static void
-cleanup (void)
+store_body (size_t index, struct wet_buffer *body, void *arg)
 {
-  wet_free (content);
+  *(struct wet_buffer *) arg = *body;
 }
 
-void
-wet_net_get_weather_data (struct weather *w, bool metric)
+/* Fetches PATH into B, taken from ALLOCATOR. Concurrent requests for the
+   same path share one fetch: the first thread to ask makes the request,
+   and the others wait for it and get copies of its body (or its error).
+   The copy kept for them meanwhile is malloc'd. */
+static bool
+http_get_request (const char *path, struct wet_buffer *b,
+                  const struct wet_allocator *allocator,
+                  struct wet_error *err)
 {
-  char path[URLPATHMAX];
+  struct flight *f;
+  struct flight **p;
+  bool ok;
+
+  b->p = NULL;
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = allocator;
+
+  pthread_mutex_lock (&flights_lock);
+  for (f = flights; f; f = f->next)
+    if (wet_streq (f->path, path))
+      break;
+  if (f) {
+    f->n_waiting++;
+    while (!f->landed)
+      pthread_cond_wait (&flights_landed, &flights_lock);
+    if (!f->ok)
+      *err = f->error;
+    else if (!copy_body (b, &f->body, allocator))
+      wet_fail (err, WET_ESYS, "failed to allocate memory");
+    ok = f->ok && b->p;
+    /* the last waiter cleans up */
+    if (!--f->n_waiting) {
+      wet_buffer_free (&f->body);
+      wet_slab_put (&flight_slab, f);
+    }
+    pthread_mutex_unlock (&flights_lock);
+    return ok;
+  }
 
-  snprintf (path, URLPATHMAX, WEATHER_DATA_PATH,
-            w->location_id, (!metric) ? "" : "m");
-  http_get_request (path);
-  fill_weather_struct (w);
+  f = (struct flight *) wet_slab_get (&flight_slab);
+  if (!f) {
+    pthread_mutex_unlock (&flights_lock);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+  f->path = path;
+  f->landed = false;
+  f->n_waiting = 0;
+  f->body.p = NULL;
+  f->body.n = 0;
+  f->body.mapped = false;
+  f->body.allocator = NULL;
+  f->next = flights;
+  flights = f;
+  pthread_mutex_unlock (&flights_lock);
+
+  ok = http_get_pipelined (&path, 1, store_body, b, allocator, err);
+
+  pthread_mutex_lock (&flights_lock);
+  for (p = &flights; *p != f; p = &(*p)->next)
+    ;
+  *p = f->next;
+  if (f->n_waiting) {
+    f->ok = ok;
+    if (!ok)
+      f->error = *err;
+    else if (!copy_body (&f->body, b, NULL))
+      f->ok = wet_fail (&f->error, WET_ESYS, "failed to allocate memory");
+    f->landed = true;
+    pthread_cond_broadcast (&flights_landed);
+  } else
+    wet_slab_put (&flight_slab, f);
+  pthread_mutex_unlock (&flights_lock);
+  return ok;
 }
 
-void
-wet_net_get_location_id (struct weather *w, const char *query)
+/* The path of the weather data of LOCATION_ID with DAYS of forecasts
+   (see WET_FORECAST_DAYS_MAX). */
+static void
+weather_data_path (char *path, const char *location_id, unsigned int days)
+{
+  snprintf (path, URLPATHMAX, WEATHER_DATA_PATH, location_id, days);
+}
+
+static void
+location_id_path (char *path, const char *query)
 {
   size_t n;
-  char path[URLPATHMAX];
 
   /* Make equery extra extra large just in case.
      wet_net_encode_string() does not do any safety checks... */
   n = strlen (query) * 10;
   char equery[n];
 
-  atexit (cleanup);
   encode_string (equery, n, query);
   snprintf (path, URLPATHMAX, WEATHER_LOCID_PATH, equery);
-  http_get_request (path);
-  fill_location_id (w);
 }
 
+/* Fills W with views into the N bytes of CONTENT. Nothing is copied, so
+   CONTENT has to outlive W's use of them. Returns false if there is no
+   memory for W's forecasts, which come from W's allocator. */
+bool
+wet_net_parse_weather_data (struct weather *w, const char *content,
+                            size_t n)
+{
+  return fill_weather_struct (w, content, n);
+}
+
+/* Copies the first location ID found in the N byte search result CONTENT
+   to LOCATION_ID (a WET_DATA_MAX sized buffer), if there is one. */
+void
+wet_net_parse_location_id (char *location_id, const char *content, size_t n)
+{
+  location_id[0] = '\0';
+  fill_location_id (location_id, content, n);
+}
+
+/* Fetches DAYS of forecasts along with the current conditions. The
+   fetched document, taken from ALLOCATOR, is retained in W (see
+   wet_weather_release()), since the parsed fields point into it. Like
+   the rest of the fetching functions, returns false with ERR saying why
+   if the fetch failed. */
+bool
+wet_net_get_weather_data (struct weather *w, unsigned int days,
+                          const struct wet_allocator *allocator,
+                          struct wet_error *err)
+{
+  char path[URLPATHMAX];
+
+  weather_data_path (path, w->location_id, days);
+  if (!http_get_request (path, &w->content, allocator, err))
+    return false;
+  w->allocator = allocator;
+  if (!fill_weather_struct (w, w->content.p, w->content.n)) {
+    wet_buffer_free (&w->content);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+  return true;
+}
+
+bool
+wet_net_get_location_id (struct weather *w, const char *query,
+                         struct wet_error *err)
+{
+  char path[URLPATHMAX];
+  struct wet_buffer b;
+
+  location_id_path (path, query);
+  if (!http_get_request (path, &b, NULL, err))
+    return false;
+  fill_location_id (w->location_id, b.p, b.n);
+  wet_buffer_free (&b);
+  return true;
+}
+
+/* Requests the weather data, with DAYS of forecasts, for each of the N
+   location IDs in IDS over one pipelined connection. FUNC is called
+   with the index and body of each response as soon as it has arrived,
+   so the caller can start parsing while the rest are still on the
+   wire. The bodies and the scratch of the fetch are taken from
+   ALLOCATOR, which is only ever called from this thread. An ID given
+   more than once is fetched once, and FUNC gets a copy of its body for
+   each. */
+bool
+wet_net_fetch_weather_data (const char **ids, size_t n, unsigned int days,
+                            wet_net_body_func func, void *arg,
+                            const struct wet_allocator *allocator,
+                            struct wet_error *err)
+{
+  size_t i;
+  char (*path_buffers)[URLPATHMAX];
+  const char **paths;
+  bool ok;
+
+  path_buffers = wet_alloc (allocator, n * sizeof (*path_buffers));
+  paths = (const char **) wet_alloc (allocator, n * sizeof (const char *));
+  if (!path_buffers || !paths) {
+    wet_release (allocator, paths);
+    wet_release (allocator, path_buffers);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+
+  for (i = 0; i < n; ++i) {
+    weather_data_path (path_buffers[i], ids[i], days);
+    paths[i] = path_buffers[i];
+  }
+
+  ok = http_get_coalesced (paths, n, func, arg, allocator, err);
+  wet_release (allocator, paths);
+  wet_release (allocator, path_buffers);
+  return ok;
+}
+
+static void
+store_location_id (size_t index, struct wet_buffer *body, void *arg)
+{
+  char **ids;
+
+  ids = (char **) arg;
+  fill_location_id (ids[index], body->p, body->n);
+  wet_buffer_free (body);
+}
+
+/* Looks up the location ID for each of the N queries in QUERIES over one
+   pipelined connection, searching for each distinct query once. Each ID
+   is written to the WET_DATA_MAX sized buffer in the matching slot of IDS
+   (left empty if none was found). */
+bool
+wet_net_get_location_ids (char **ids, const char **queries, size_t n,
+                          struct wet_error *err)
+{
+  size_t i;
+  char (*path_buffers)[URLPATHMAX];
+  const char **paths;
+  bool ok;
+
+  path_buffers = malloc (n * sizeof (*path_buffers));
+  paths = (const char **) malloc (n * sizeof (const char *));
+  if (!path_buffers || !paths) {
+    free (paths);
+    free (path_buffers);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+
+  for (i = 0; i < n; ++i) {
+    ids[i][0] = '\0';
+    location_id_path (path_buffers[i], queries[i]);
+    paths[i] = path_buffers[i];
+  }
+
+  ok = http_get_coalesced (paths, n, store_location_id, ids, NULL, err);
+  free (paths);
+  free (path_buffers);
+  return ok;
+}
+
+/* what an asynchronous fetch is waiting to do next */
+enum async_state {
+  ASYNC_CONNECTING,
+  ASYNC_SENDING,
+  ASYNC_RECEIVING,
+  ASYNC_DONE
+};
+
+/* A fetch of one weather data document over a non-blocking connection,
+   moved along by wet_net_async_process() instead of blocking. SENT is
+   how much of REQUEST has been written so far. The server's addresses
+   are tried one at a time, starting with the last race's winner, TRIED
+   counting how many of CANDIDATES have been given up on. These are fixed
+   in size, so they are recycled through async_slab rather than freed. */
+struct wet_net_async {
+  enum async_state state;
+  int sock;
+  char request[GETMAX];
+  size_t request_len;
+  size_t sent;
+  struct candidate candidates[CANDIDATES_MAX];
+  char host[HOSTMAX];
+  size_t n_candidates;
+  size_t first;
+  size_t tried;
+  struct http_stream hs;
+};
+
+static struct wet_slab async_slab =
+  WET_SLAB_INITIALIZER (sizeof (struct wet_net_async), 256);
+
+static void
+async_close (struct wet_net_async *a)
+{
+  if (a->sock != -1) {
+    close (a->sock);
+    wet_record (WET_RECORD_CLOSE, a->hs.id, a->hs.done, "", 0);
+  }
+  a->sock = -1;
+  a->state = ASYNC_DONE;
+}
+
+/* Starts connecting A to the next of the server's addresses it has not
+   yet tried, without waiting for it, moving past any that fail at once.
+   ERRNUM is the error the previous address failed with, if any. */
+static bool
+async_try_next (struct wet_net_async *a, int errnum, struct wet_error *err)
+{
+  const struct candidate *c;
+  bool connected;
+
+  while (a->tried < a->n_candidates) {
+    c = &a->candidates[(a->first + a->tried) % a->n_candidates];
+    wet_record (WET_RECORD_CONNECT, a->hs.id, 0, a->host,
+                strlen (a->host));
+    a->sock = start_connection (c, a->request, a->request_len, &a->sent,
+                                &connected);
+    if (a->sock != -1) {
+      if (connected) {
+        remember_winner (c);
+        wet_record (WET_RECORD_CONNECTED, a->hs.id, 0, "", 0);
+        a->state = ASYNC_SENDING;
+      } else
+        a->state = ASYNC_CONNECTING;
+      return true;
+    }
+    errnum = errno;
+    a->tried++;
+  }
+  return wet_fail (err, WET_ENET, "failed to connect socket: %s",
+                   strerror (errnum));
+}
+
+/* Starts connecting A to the server, without waiting for it. */
+static bool
+async_connect (struct wet_net_async *a, struct wet_error *err)
+{
+  a->n_candidates = resolve_server (a->candidates, a->host, err);
+  if (!a->n_candidates)
+    return false;
+  a->first = preferred_candidate (a->candidates, a->n_candidates);
+  a->tried = 0;
+  return async_try_next (a, 0, err);
+}
+
+/* Moves A on to sending once its connection has been established, or on
+   to the next address if it could not be. */
+static bool
+async_connected (struct wet_net_async *a, struct wet_error *err)
+{
+  struct pollfd pfd;
+  socklen_t len;
+  int e;
+
+  /* the caller may not have waited for the socket to become writable */
+  pfd.fd = a->sock;
+  pfd.events = POLLOUT;
+  if (poll (&pfd, 1, 0) == 0)
+    return true;
+
+  len = sizeof (e);
+  if (getsockopt (a->sock, SOL_SOCKET, SO_ERROR, &e, &len) == -1)
+    e = errno;
+  if (e) {
+    close (a->sock);
+    a->sock = -1;
+    a->tried++;
+    return async_try_next (a, e, err);
+  }
+  remember_winner (&a->candidates[(a->first + a->tried) %
+                                  a->n_candidates]);
+  wet_record (WET_RECORD_CONNECTED, a->hs.id, 0, "", 0);
+  a->state = ASYNC_SENDING;
+  return true;
+}
+
+/* Writes as much of A's request as the socket takes. */
+static bool
+async_send (struct wet_net_async *a, struct wet_error *err)
+{
+  size_t len;
+  ssize_t n_write;
+
+  len = a->request_len;
+  while (a->sent < len) {
+    n_write = write (a->sock, a->request + a->sent, len - a->sent);
+    if (n_write < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return true;
+      return wet_fail (err, WET_ENET, "failed to send GET request: %s",
+                       strerror (errno));
+    }
+    a->sent += n_write;
+  }
+  wet_record (WET_RECORD_REQUEST, a->hs.id, 0, a->request, len);
+  a->state = ASYNC_RECEIVING;
+  return true;
+}
+
+/* Reads whatever has arrived of A's response, storing its body in B
+   once it is complete. */
+static bool
+async_receive (struct wet_net_async *a, struct wet_buffer *b,
+               struct wet_error *err)
+{
+  char buf[READBUFMAX];
+  const char *p;
+  size_t n;
+  ssize_t n_read;
+  enum response_status status;
+
+  while (true) {
+    n_read = read (a->sock, buf, READBUFMAX);
+    if (n_read < 0) {
+      if (errno == EINTR)
+        continue;
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        return true;
+      return wet_fail (err, WET_ENET, "failed to read response: %s",
+                       strerror (errno));
+    }
+    if (n_read == 0)
+      return wet_fail (err, WET_ENET, "connection closed by server");
+
+    p = buf;
+    n = (size_t) n_read;
+    status = stream_receive (&a->hs, &p, &n, err);
+    if (status == RESPONSE_FAILED)
+      return false;
+    if (status == RESPONSE_OK)
+      break;
+  }
+
+  wet_record (WET_RECORD_BODY, a->hs.id, a->hs.done++, a->hs.body,
+              a->hs.body_len);
+  b->p = a->hs.body;
+  b->n = a->hs.body_len;
+  b->allocator = a->hs.allocator;
+  a->hs.body = NULL;
+  async_close (a);
+  return true;
+}
+
+/* Starts fetching the weather data document of LOCATION_ID, with DAYS
+   of forecasts, into memory taken from ALLOCATOR, without waiting on the
+   network: from here on, wet_net_async_process() moves the fetch along
+   whenever the descriptor wet_net_async_fd() gives is ready for what
+   wet_net_async_events() says. Only looking up the server's address can
+   block, and only if it is given by name. Returns NULL, with ERR saying
+   why, if the fetch could not be started.
+
+   Unlike the blocking fetches, these are neither pipelined nor shared
+   with concurrent requests for the same document. */
+struct wet_net_async *
+wet_net_async_start (const char *location_id, unsigned int days,
+                     const struct wet_allocator *allocator,
+                     struct wet_error *err)
+{
+  struct wet_net_async *a;
+  char path[URLPATHMAX];
+
+  a = (struct wet_net_async *) wet_slab_get (&async_slab);
+  if (!a) {
+    wet_fail (err, WET_ESYS, "failed to allocate memory");
+    return NULL;
+  }
+  memset (a, 0, sizeof (struct wet_net_async));
+  a->sock = -1;
+  a->hs.n = 1;
+  a->hs.id = wet_record_connection ();
+  a->hs.allocator = allocator;
+  weather_data_path (path, location_id, days);
+  wet_debug ("requesting: \"%s%s\"", HOST, path);
+  a->request_len = snprintf (a->request, GETMAX, GET, path);
+  if (!async_connect (a, err)) {
+    wet_net_async_free (a);
+    return NULL;
+  }
+  return a;
+}
+
+/* the descriptor to poll for A, or -1 once it is done */
+int
+wet_net_async_fd (const struct wet_net_async *a)
+{
+  return a->sock;
+}
+
+/* what A's descriptor is to be polled for (WET_NET_WANT_READ or
+   WET_NET_WANT_WRITE), or 0 once it is done */
+int
+wet_net_async_events (const struct wet_net_async *a)
+{
+  switch (a->state) {
+  case ASYNC_CONNECTING:
+  case ASYNC_SENDING:
+    return WET_NET_WANT_WRITE;
+  case ASYNC_RECEIVING:
+    return WET_NET_WANT_READ;
+  default:
+    return 0;
+  }
+}
+
+/* Moves A along as far as it goes without blocking; it is safe to call
+   at any time. Reading and writing go on until the socket would block,
+   so edge-triggered polling works too. Once the response is complete, B
+   gets its body (B->p is NULL until then) and A is done. Returns false,
+   with ERR saying why, if the fetch failed, which is also the end of
+   it. */
+bool
+wet_net_async_process (struct wet_net_async *a, struct wet_buffer *b,
+                       struct wet_error *err)
+{
+  enum async_state state;
+  bool ok;
+
+  b->p = NULL;
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = a->hs.allocator;
+
+  do {
+    state = a->state;
+    switch (state) {
+    case ASYNC_CONNECTING:
+      ok = async_connected (a, err);
+      break;
+    case ASYNC_SENDING:
+      ok = async_send (a, err);
+      break;
+    case ASYNC_RECEIVING:
+      ok = async_receive (a, b, err);
+      break;
+    default:
+      return true;
+    }
+    if (!ok) {
+      wet_release (a->hs.allocator, a->hs.body);
+      a->hs.body = NULL;
+      async_close (a);
+      return false;
+    }
+  } while (a->state != state);
+  return true;
+}
+
+/* Frees A, abandoning its fetch if it is still going on. */
+void
+wet_net_async_free (struct wet_net_async *a)
+{
+  async_close (a);
+  wet_release (a->hs.allocator, a->hs.body);
+  wet_slab_put (&async_slab, a);
+}
@@ -20,11 +20,42 @@
 #ifndef WET_NET_H
 #define WET_NET_H
 
+#include <stddef.h>
+
 #include "wet.h"
 #include "wet-weather.h"
 
-void wet_net_get_weather_data (struct weather *, bool);
-void wet_net_get_location_id (struct weather *, const char *);
+/* called with the index and body of each completed response, which it
+   takes over (free it with wet_buffer_free()) */
+typedef void (*wet_net_body_func) (size_t, struct wet_buffer *, void *);
+
+/* what an asynchronous fetch's descriptor is to be polled for */
+#define WET_NET_WANT_READ  1
+#define WET_NET_WANT_WRITE 2
+
+struct wet_net_async;
+
+bool wet_net_parse_weather_data (struct weather *, const char *, size_t);
+void wet_net_parse_location_id (char *, const char *, size_t);
+bool wet_net_get_weather_data (struct weather *, unsigned int,
+                               const struct wet_allocator *,
+                               struct wet_error *);
+bool wet_net_get_location_id (struct weather *, const char *,
+                              struct wet_error *);
+bool wet_net_fetch_weather_data (const char **, size_t, unsigned int,
+                                 wet_net_body_func, void *,
+                                 const struct wet_allocator *,
+                                 struct wet_error *);
+bool wet_net_get_location_ids (char **, const char **, size_t,
+                               struct wet_error *);
+struct wet_net_async *wet_net_async_start (const char *, unsigned int,
+                                           const struct wet_allocator *,
+                                           struct wet_error *);
+int wet_net_async_fd (const struct wet_net_async *);
+int wet_net_async_events (const struct wet_net_async *);
+bool wet_net_async_process (struct wet_net_async *, struct wet_buffer *,
+                            struct wet_error *);
+void wet_net_async_free (struct wet_net_async *);
 
 #endif /* WET_NET_H */
 
@@ -0,0 +1,366 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "wet-pool.h"
+#include "wet-util.h"
+
+#define DEQUE_INITIAL_SIZE 64
+
+/* A double-ended queue of jobs. The worker that owns it takes jobs from
+   the head (oldest first, which keeps the reorder stage short), while idle
+   workers steal from the tail. */
+struct deque {
+  pthread_mutex_t lock;
+  size_t head;
+  size_t count;
+  size_t size;
+  void **jobs;
+};
+
+struct worker {
+  struct wet_pool *pool;
+  pthread_t thread;
+  struct deque q;
+  struct wet_arena arena;
+};
+
+struct wet_pool {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  size_t pending;
+  size_t next;
+  bool closing;
+  size_t n_workers;
+  struct worker *workers;
+  struct wet_arena arena;
+  wet_pool_func func;
+  void *arg;
+};
+
+struct wet_reorder {
+  pthread_mutex_t lock;
+  size_t next;
+  size_t n;
+  void **items;
+  bool *ready;
+  wet_reorder_func func;
+  void *arg;
+};
+
+static void *
+xmalloc (size_t n)
+{
+  void *p;
+
+  p = malloc (n);
+  if (!p)
+    wet_die (WET_ESYS, "failed to allocate memory: %s", strerror (errno));
+  return p;
+}
+
+static void
+deque_init (struct deque *q)
+{
+  pthread_mutex_init (&q->lock, NULL);
+  q->head = 0;
+  q->count = 0;
+  q->size = DEQUE_INITIAL_SIZE;
+  q->jobs = (void **) xmalloc (q->size * sizeof (void *));
+}
+
+static void
+deque_destroy (struct deque *q)
+{
+  pthread_mutex_destroy (&q->lock);
+  wet_free (q->jobs);
+}
+
+static void
+deque_push (struct deque *q, void *job)
+{
+  size_t i;
+  void **jobs;
+
+  pthread_mutex_lock (&q->lock);
+  if (q->count == q->size) {
+    jobs = (void **) xmalloc (q->size * 2 * sizeof (void *));
+    for (i = 0; i < q->count; ++i)
+      jobs[i] = q->jobs[(q->head + i) % q->size];
+    free (q->jobs);
+    q->jobs = jobs;
+    q->head = 0;
+    q->size *= 2;
+  }
+  q->jobs[(q->head + q->count) % q->size] = job;
+  q->count++;
+  pthread_mutex_unlock (&q->lock);
+}
+
+static void *
+deque_take (struct deque *q)
+{
+  void *job;
+
+  job = NULL;
+  pthread_mutex_lock (&q->lock);
+  if (q->count) {
+    job = q->jobs[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->count--;
+  }
+  pthread_mutex_unlock (&q->lock);
+  return job;
+}
+
+static void *
+deque_steal (struct deque *q)
+{
+  void *job;
+
+  job = NULL;
+  pthread_mutex_lock (&q->lock);
+  if (q->count) {
+    q->count--;
+    job = q->jobs[(q->head + q->count) % q->size];
+  }
+  pthread_mutex_unlock (&q->lock);
+  return job;
+}
+
+static void *
+find_job (struct worker *self)
+{
+  size_t i;
+  size_t n;
+  void *job;
+  struct wet_pool *pool;
+
+  pool = self->pool;
+  n = pool->n_workers;
+
+  job = deque_take (&self->q);
+  for (i = 1; !job && (i < n); ++i)
+    job = deque_steal (&pool->workers[((self - pool->workers) + i) % n].q);
+
+  if (job) {
+    pthread_mutex_lock (&pool->lock);
+    pool->pending--;
+    pthread_mutex_unlock (&pool->lock);
+  }
+  return job;
+}
+
+static void *
+worker_main (void *arg)
+{
+  void *job;
+  struct worker *self;
+  struct wet_pool *pool;
+
+  self = (struct worker *) arg;
+  pool = self->pool;
+
+  while (true) {
+    job = find_job (self);
+    if (job) {
+      pool->func (job, &self->arena, pool->arg);
+      wet_arena_reset (&self->arena);
+      continue;
+    }
+    pthread_mutex_lock (&pool->lock);
+    while (!pool->pending && !pool->closing)
+      pthread_cond_wait (&pool->cond, &pool->lock);
+    if (!pool->pending && pool->closing) {
+      pthread_mutex_unlock (&pool->lock);
+      break;
+    }
+    pthread_mutex_unlock (&pool->lock);
+  }
+  return NULL;
+}
+
+/* Number of workers to use for N jobs: one per online processor, but
+   never more than there are jobs. A single job gets no workers at all
+   and is run by the thread that pushes it. */
+size_t
+wet_pool_default_workers (size_t n)
+{
+  long n_cpus;
+
+  if (n <= 1)
+    return 0;
+
+#if defined (HAVE_UNISTD_H) && defined (_SC_NPROCESSORS_ONLN)
+  n_cpus = sysconf (_SC_NPROCESSORS_ONLN);
+  if (n_cpus < 1)
+    n_cpus = 1;
+#else
+  n_cpus = 1;
+#endif
+
+  if ((size_t) n_cpus < n)
+    return (size_t) n_cpus;
+  return n;
+}
+
+/* Creates a pool of N_WORKERS threads that each call FUNC on the jobs
+   they take (or steal), passing a private arena holding at most
+   ARENA_LIMIT bytes (see wet_arena_init()) that is reset after every job
+   and so reused from one to the next. With no workers, jobs are run
+   directly by wet_pool_push(). */
+struct wet_pool *
+wet_pool_new (size_t n_workers, size_t arena_limit, wet_pool_func func,
+              void *arg)
+{
+  size_t i;
+  struct wet_pool *pool;
+
+  pool = (struct wet_pool *) xmalloc (sizeof (struct wet_pool));
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->cond, NULL);
+  pool->pending = 0;
+  pool->next = 0;
+  pool->closing = false;
+  pool->n_workers = n_workers;
+  pool->workers = NULL;
+  wet_arena_init (&pool->arena, arena_limit);
+  pool->func = func;
+  pool->arg = arg;
+
+  if (!n_workers)
+    return pool;
+
+  pool->workers = (struct worker *) xmalloc (n_workers *
+                                             sizeof (struct worker));
+  for (i = 0; i < n_workers; ++i) {
+    pool->workers[i].pool = pool;
+    wet_arena_init (&pool->workers[i].arena, arena_limit);
+    deque_init (&pool->workers[i].q);
+  }
+
+  for (i = 0; i < n_workers; ++i)
+    if (pthread_create (&pool->workers[i].thread, NULL, worker_main,
+                        &pool->workers[i]) != 0)
+      wet_die (WET_ESYS, "failed to create worker thread");
+  return pool;
+}
+
+/* Hands JOB to the pool. Jobs are dealt round-robin onto the workers'
+   deques; an idle worker steals from the others when its own runs dry. */
+void
+wet_pool_push (struct wet_pool *pool, void *job)
+{
+  if (!pool->n_workers) {
+    pool->func (job, &pool->arena, pool->arg);
+    wet_arena_reset (&pool->arena);
+    return;
+  }
+
+  /* counted before it can be taken, so that find_job() never takes
+     pending below zero */
+  pthread_mutex_lock (&pool->lock);
+  pool->pending++;
+  pthread_mutex_unlock (&pool->lock);
+
+  deque_push (&pool->workers[pool->next].q, job);
+  pool->next = (pool->next + 1) % pool->n_workers;
+
+  pthread_mutex_lock (&pool->lock);
+  pthread_cond_signal (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+}
+
+/* Waits for every pushed job to complete, then frees the pool. */
+void
+wet_pool_finish (struct wet_pool *pool)
+{
+  size_t i;
+
+  pthread_mutex_lock (&pool->lock);
+  pool->closing = true;
+  pthread_cond_broadcast (&pool->cond);
+  pthread_mutex_unlock (&pool->lock);
+
+  for (i = 0; i < pool->n_workers; ++i)
+    pthread_join (pool->workers[i].thread, NULL);
+
+  for (i = 0; i < pool->n_workers; ++i) {
+    deque_destroy (&pool->workers[i].q);
+    wet_arena_destroy (&pool->workers[i].arena);
+  }
+  wet_free (pool->workers);
+  wet_arena_destroy (&pool->arena);
+  pthread_cond_destroy (&pool->cond);
+  pthread_mutex_destroy (&pool->lock);
+  free (pool);
+}
+
+/* Creates a reorder stage for N items. Items may be put in any order
+   from any thread, but FUNC sees them strictly by index. */
+struct wet_reorder *
+wet_reorder_new (size_t n, wet_reorder_func func, void *arg)
+{
+  struct wet_reorder *r;
+
+  r = (struct wet_reorder *) xmalloc (sizeof (struct wet_reorder));
+  pthread_mutex_init (&r->lock, NULL);
+  r->next = 0;
+  r->n = n;
+  r->items = (void **) xmalloc (n * sizeof (void *));
+  r->ready = (bool *) xmalloc (n * sizeof (bool));
+  memset (r->ready, 0, n * sizeof (bool));
+  r->func = func;
+  r->arg = arg;
+  return r;
+}
+
+/* Stores ITEM as number INDEX and passes on every item that is now next
+   in line. Whichever thread completes the gap does the emitting. */
+void
+wet_reorder_put (struct wet_reorder *r, size_t index, void *item)
+{
+  pthread_mutex_lock (&r->lock);
+  r->items[index] = item;
+  r->ready[index] = true;
+  while ((r->next < r->n) && r->ready[r->next]) {
+    r->func (r->next, r->items[r->next], r->arg);
+    r->next++;
+  }
+  pthread_mutex_unlock (&r->lock);
+}
+
+void
+wet_reorder_free (struct wet_reorder *r)
+{
+  pthread_mutex_destroy (&r->lock);
+  free (r->items);
+  free (r->ready);
+  free (r);
+}
@@ -0,0 +1,47 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WET_POOL_H
+#define WET_POOL_H
+
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-arena.h"
+
+/* called by a worker with a job and that worker's private arena, which
+   is reset once the job returns */
+typedef void (*wet_pool_func) (void *, struct wet_arena *, void *);
+
+/* called (serialized, in index order) with each item given to a reorder */
+typedef void (*wet_reorder_func) (size_t, void *, void *);
+
+struct wet_pool;
+struct wet_reorder;
+
+size_t wet_pool_default_workers (size_t);
+struct wet_pool *wet_pool_new (size_t, size_t, wet_pool_func, void *);
+void wet_pool_push (struct wet_pool *, void *);
+void wet_pool_finish (struct wet_pool *);
+
+struct wet_reorder *wet_reorder_new (size_t, wet_reorder_func, void *);
+void wet_reorder_put (struct wet_reorder *, size_t, void *);
+void wet_reorder_free (struct wet_reorder *);
+
+#endif /* WET_POOL_H */
@@ -0,0 +1,164 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Recordings are appended to RECORD_FILE inside the directory given to
+ * --record. Every frame is one line of text followed by a raw payload:
+ *
+ *   KIND PID.CONNECTION SEQUENCE NANOSECONDS LENGTH\n
+ *   <LENGTH bytes of payload>\n
+ *
+ * KIND is one of the names in kind_names. CONNECTION numbers the
+ * connections made by process PID, and SEQUENCE numbers the requests (and
+ * their responses) sent over that connection, so pipelined exchanges can
+ * be paired back up. NANOSECONDS is read from the monotonic clock when
+ * the phase completed. Each frame is written with a single writev() to a
+ * file opened for appending, so several processes can share a recording.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "wet-record.h"
+#include "wet-util.h"
+
+#define RECORD_FILE    "wet-exchanges.rec"
+#define FRAMEHEADERMAX 128
+
+static const char *kind_names[] = {
+  "connect",
+  "connected",
+  "request",
+  "header",
+  "body",
+  "close"
+};
+
+/* Recording is set up once, before any fetch starts, and is shared by
+   every thread that fetches afterwards. */
+static int record_fd = -1;
+static pthread_mutex_t connections_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long n_connections = 0;
+
+/* Starts recording into DIR, which is created if needed. Returns false,
+   with ERR saying why, if the recording cannot be opened. */
+bool
+wet_record_open (const char *dir, struct wet_error *err)
+{
+  size_t n;
+
+  if ((mkdir (dir, 0755) == -1) && (errno != EEXIST))
+    return wet_fail (err, WET_ESYS, "failed to create `%s': %s", dir,
+                     strerror (errno));
+
+  n = strlen (dir) + strlen (RECORD_FILE) + 2;
+  char path[n];
+
+  snprintf (path, n, "%s/%s", dir, RECORD_FILE);
+  record_fd = open (path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (record_fd == -1)
+    return wet_fail (err, WET_ESYS, "failed to open `%s': %s", path,
+                     strerror (errno));
+  return true;
+}
+
+bool
+wet_record_enabled (void)
+{
+  return record_fd != -1;
+}
+
+/* Returns the number to record the next connection's frames under. */
+unsigned long
+wet_record_connection (void)
+{
+  unsigned long id;
+
+  pthread_mutex_lock (&connections_lock);
+  id = n_connections++;
+  pthread_mutex_unlock (&connections_lock);
+  return id;
+}
+
+/* Appends one frame of KIND for exchange SEQUENCE on CONNECTION, with the
+   N bytes at DATA as its payload. Does nothing unless recording. A frame
+   that cannot be written is dropped; it never fails the fetch. */
+void
+wet_record (enum wet_record_kind kind, unsigned long connection,
+            size_t sequence, const char *data, size_t n)
+{
+  char header[FRAMEHEADERMAX];
+  struct iovec iov[3];
+  struct iovec *v;
+  ssize_t n_write;
+  int n_iov;
+  struct timespec ts;
+  unsigned long long ns;
+
+  if (record_fd == -1)
+    return;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  ns = (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  /* the header, the payload where it is and the newline after it go out
+     together, without copying the payload */
+  iov[0].iov_base = header;
+  iov[0].iov_len = snprintf (header, FRAMEHEADERMAX,
+                             "%s %ld.%lu %zu %llu %zu\n",
+                             kind_names[kind], (long) getpid (), connection,
+                             sequence, ns, n);
+  iov[1].iov_base = (void *) data;
+  iov[1].iov_len = n;
+  iov[2].iov_base = (void *) "\n";
+  iov[2].iov_len = 1;
+
+  v = iov;
+  n_iov = 3;
+  while (n_iov) {
+    n_write = writev (record_fd, v, n_iov);
+    if (n_write < 0) {
+      if (errno == EINTR)
+        continue;
+      wet_debug ("failed to write recording: %s", strerror (errno));
+      break;
+    }
+    /* a short write: carry on after what did go out */
+    for (; n_iov && ((size_t) n_write >= v->iov_len); ++v, --n_iov)
+      n_write -= v->iov_len;
+    if (n_iov) {
+      v->iov_base = (char *) v->iov_base + n_write;
+      v->iov_len -= n_write;
+    }
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WET_RECORD_H
+#define WET_RECORD_H
+
+#include <stddef.h>
+
+#include "wet.h"
+#include "wet-util.h"
+
+/* the phases of an HTTP exchange that get a frame of their own */
+enum wet_record_kind {
+  WET_RECORD_CONNECT,
+  WET_RECORD_CONNECTED,
+  WET_RECORD_REQUEST,
+  WET_RECORD_HEADER,
+  WET_RECORD_BODY,
+  WET_RECORD_CLOSE
+};
+
+bool wet_record_open (const char *, struct wet_error *);
+bool wet_record_enabled (void);
+unsigned long wet_record_connection (void);
+void wet_record (enum wet_record_kind, unsigned long, size_t,
+                 const char *, size_t);
+
+#endif /* WET_RECORD_H */
@@ -0,0 +1,380 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Rules turn wet into an alerting tool: a rules file names conditions
+ * such as
+ *
+ *   freezing: temp < 0
+ *   squall: gust >= 60 and pressure < 1000
+ *
+ * which are compiled once into a flat program of comparisons (struct
+ * wet_rule_test) against the numeric weather values, with every
+ * threshold converted into the units of struct weather_values up front.
+ * Evaluating the program for a location is then a pass over an array of
+ * integer comparisons, with no text to parse and no units to convert,
+ * so thousands of locations can be checked against hundreds of rules.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wet-rules.h"
+#include "wet-util.h"
+
+#define LINEMAX   512
+#define FIELD_MAX 32
+#define UNKNOWN   INT32_MIN
+
+/* how a field's thresholds are converted from the units they are given
+   in to those of struct weather_values */
+enum unit_kind {
+  PLAIN,
+  TEMPERATURE,
+  DISTANCE,
+  SPEED,
+  PRESSURE
+};
+
+static const struct {
+  const char *name;
+  enum wet_rule_field field;
+  enum unit_kind kind;
+} fields[] = {
+  { "temp", WET_RULE_TEMPERATURE, TEMPERATURE },
+  { "feels-like", WET_RULE_FEELS_LIKE, TEMPERATURE },
+  { "dewpoint", WET_RULE_DEWPOINT, TEMPERATURE },
+  { "humidity", WET_RULE_HUMIDITY, PLAIN },
+  { "pressure", WET_RULE_PRESSURE, PRESSURE },
+  { "wind", WET_RULE_WIND_SPEED, SPEED },
+  { "gust", WET_RULE_WIND_GUST, SPEED },
+  { "visibility", WET_RULE_VISIBILITY, DISTANCE },
+  { "uv", WET_RULE_UV_INDEX, PLAIN },
+  { "condition", WET_RULE_CONDITION, PLAIN },
+  { "high", WET_RULE_HIGH, TEMPERATURE },
+  { "low", WET_RULE_LOW, TEMPERATURE },
+  { "precip", WET_RULE_CHANCE_PRECIP, PLAIN },
+  { NULL, 0, PLAIN }
+};
+
+static const struct {
+  const char *text;
+  enum wet_rule_op op;
+} ops[] = {
+  { "<", WET_RULE_LT },
+  { "<=", WET_RULE_LE },
+  { ">", WET_RULE_GT },
+  { ">=", WET_RULE_GE },
+  { "==", WET_RULE_EQ },
+  { "=", WET_RULE_EQ },
+  { "!=", WET_RULE_NE },
+  { NULL, 0 }
+};
+
+/* X, given in the METRIC or imperial units of KIND, in the units of
+   struct weather_values (tenths of the metric unit, apart from plain
+   numbers) */
+static double
+convert_threshold (double x, enum unit_kind kind, bool metric)
+{
+  switch (kind) {
+  case TEMPERATURE:
+    return metric ? x * 10.0 : (x - 32.0) * 50.0 / 9.0;
+  case DISTANCE:
+  case SPEED:
+    return metric ? x * 10.0 : x * 16.09344;
+  case PRESSURE:
+    return metric ? x * 10.0 : x * 338.638866667;
+  default:
+    return x;
+  }
+}
+
+/* Rounds the threshold X of OP to an integer that gives the same result
+   for every integer value compared against it. */
+static int32_t
+round_threshold (double x, enum wet_rule_op op)
+{
+  /* 44.6ºF is exactly 7ºC, whatever the floating point error says */
+  if (fabs (x - round (x)) < 1e-6)
+    x = round (x);
+  switch (op) {
+  case WET_RULE_LT:
+  case WET_RULE_GE:
+    x = ceil (x);
+    break;
+  case WET_RULE_GT:
+  case WET_RULE_LE:
+    x = floor (x);
+    break;
+  default:
+    if (x != round (x))
+      x = (double) INT32_MIN; /* no value is ever equal to it */
+    break;
+  }
+  if (x <= (double) INT32_MIN + 1)
+    return INT32_MIN + 1;
+  if (x >= (double) INT32_MAX)
+    return INT32_MAX;
+  return (int32_t) x;
+}
+
+static const char *
+skip_space (const char *p)
+{
+  while (isspace ((unsigned char) *p))
+    ++p;
+  return p;
+}
+
+/* Parses one `FIELD OP NUMBER' comparison at P into T. Returns what
+   follows it, or NULL if there is none. */
+static const char *
+parse_test (const char *p, struct wet_rule_test *t, bool metric)
+{
+  char field[FIELD_MAX];
+  char op[3];
+  size_t n;
+  double x;
+  char *end;
+  int i;
+  int f;
+  int o;
+
+  p = skip_space (p);
+  for (n = 0; (isalpha ((unsigned char) p[n]) || p[n] == '-') &&
+              (n < FIELD_MAX - 1); ++n)
+    field[n] = tolower ((unsigned char) p[n]);
+  field[n] = '\0';
+  p = skip_space (p + n);
+  for (n = 0; p[n] && strchr ("<>=!", p[n]) && (n < 2); ++n)
+    op[n] = p[n];
+  op[n] = '\0';
+  errno = 0;
+  x = strtod (p + n, &end);
+  if ((end == p + n) || errno)
+    return NULL;
+
+  f = -1;
+  for (i = 0; fields[i].name; ++i)
+    if (wet_streq (field, fields[i].name))
+      f = i;
+  o = -1;
+  for (i = 0; ops[i].text; ++i)
+    if (wet_streq (op, ops[i].text))
+      o = i;
+  if ((f == -1) || (o == -1))
+    return NULL;
+
+  t->field = fields[f].field;
+  t->op = ops[o].op;
+  t->threshold = round_threshold (convert_threshold (x, fields[f].kind,
+                                                     metric), t->op);
+  t->rule = -1;
+  return end;
+}
+
+static void *
+grow (void *p, size_t *size, size_t n, size_t width)
+{
+  if (n < *size)
+    return p;
+  *size = *size ? *size * 2 : 16;
+  p = realloc (p, *size * width);
+  if (!p)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  return p;
+}
+
+/* Compiles the rules file at PATH (`-' for standard input), whose
+   thresholds are in METRIC or imperial units. Each line holds a rule,
+   `NAME: FIELD OP NUMBER [and FIELD OP NUMBER]...'; blank lines and
+   lines starting with `#' are skipped. Dies on a malformed rule. */
+struct wet_rules *
+wet_rules_compile (const char *path, bool metric)
+{
+  FILE *fp;
+  char line[LINEMAX];
+  struct wet_rules *rules;
+  size_t tests_size;
+  size_t names_size;
+  size_t lineno;
+  size_t first;
+  size_t i;
+  char *colon;
+  const char *p;
+  struct wet_rule_test *t;
+
+  fp = wet_streq (path, "-") ? stdin : fopen (path, "r");
+  if (!fp)
+    wet_die (WET_ESYS, "failed to open `%s': %s", path, strerror (errno));
+
+  rules = (struct wet_rules *) calloc (1, sizeof (struct wet_rules));
+  if (!rules)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  tests_size = 0;
+  names_size = 0;
+
+  for (lineno = 1; fgets (line, LINEMAX, fp); ++lineno) {
+    line[strcspn (line, "\r\n")] = '\0';
+    p = skip_space (line);
+    if (!*p || (*p == '#'))
+      continue;
+    colon = strchr (line, ':');
+    if (!colon || (colon == p))
+      wet_die (WET_EOP, "%s:%zu: expected `NAME: FIELD OP NUMBER'",
+               path, lineno);
+    for (i = colon - line; (i > 0) && isspace ((unsigned char) line[i - 1]);
+         --i)
+      ;
+    line[i] = '\0';
+
+    first = rules->n_tests;
+    p = colon + 1;
+    for (;;) {
+      rules->tests = (struct wet_rule_test *)
+        grow (rules->tests, &tests_size, rules->n_tests,
+              sizeof (struct wet_rule_test));
+      t = &rules->tests[rules->n_tests];
+      p = parse_test (p, t, metric);
+      if (!p)
+        wet_die (WET_EOP, "%s:%zu: expected `FIELD OP NUMBER' (FIELD is "
+                 "one of temp, feels-like, dewpoint, humidity, pressure, "
+                 "wind, gust, visibility, uv, condition, high, low and "
+                 "precip)", path, lineno);
+      rules->n_tests++;
+      p = skip_space (p);
+      if (!*p)
+        break;
+      if ((strncmp (p, "and", 3) != 0) || !isspace ((unsigned char) p[3]))
+        wet_die (WET_EOP, "%s:%zu: expected `and' before `%s'", path,
+                 lineno, p);
+      p += 3;
+    }
+
+    rules->names = (char **) grow (rules->names, &names_size,
+                                   rules->n_rules, sizeof (char *));
+    rules->names[rules->n_rules] = strdup (skip_space (line));
+    if (!rules->names[rules->n_rules])
+      wet_die (WET_ESYS, "failed to allocate memory");
+    for (i = first; i < rules->n_tests; ++i)
+      rules->tests[i].next = rules->n_tests;
+    rules->tests[rules->n_tests - 1].rule = rules->n_rules++;
+  }
+  if (fp != stdin)
+    fclose (fp);
+  return rules;
+}
+
+/* Loads the quantities rules can test from V, UNKNOWN where V has none. */
+static void
+load_fields (int32_t *f, const struct weather_values *v)
+{
+#define __value(__x) (((__x) == WET_NO_VALUE) ? UNKNOWN : (int32_t) (__x))
+#define __byte(__x)  (((__x) == WET_NO_BYTE) ? UNKNOWN : (int32_t) (__x))
+
+  f[WET_RULE_TEMPERATURE] = __value (v->temperature);
+  f[WET_RULE_FEELS_LIKE] = __value (v->feels_like);
+  f[WET_RULE_DEWPOINT] = __value (v->dewpoint);
+  f[WET_RULE_HUMIDITY] = __byte (v->humidity);
+  f[WET_RULE_PRESSURE] = __value (v->pressure);
+  f[WET_RULE_WIND_SPEED] = __value (v->wind.speed);
+  f[WET_RULE_WIND_GUST] = __value (v->wind.gust);
+  f[WET_RULE_VISIBILITY] = __value (v->visibility);
+  f[WET_RULE_UV_INDEX] = __byte (v->uv_index);
+  f[WET_RULE_CONDITION] = __byte (v->condition);
+  f[WET_RULE_HIGH] = __value (v->forecasts[0].high);
+  f[WET_RULE_LOW] = __value (v->forecasts[0].low);
+  f[WET_RULE_CHANCE_PRECIP] = __byte (v->forecasts[0].chance_precip);
+
+#undef __value
+#undef __byte
+}
+
+/* Runs the rules against V, storing the name of every rule that matches
+   in MATCHES (which has room for all of them) and returning how many
+   did. A comparison against a quantity V does not give never holds. */
+size_t
+wet_rules_match (const struct wet_rules *rules,
+                 const struct weather_values *v, const char **matches)
+{
+  int32_t f[WET_RULE_FIELDS];
+  const struct wet_rule_test *t;
+  size_t i;
+  size_t n;
+  int32_t x;
+  bool holds;
+
+  load_fields (f, v);
+  n = 0;
+  i = 0;
+  while (i < rules->n_tests) {
+    t = &rules->tests[i];
+    x = f[t->field];
+    switch (t->op) {
+    case WET_RULE_LT:
+      holds = x < t->threshold;
+      break;
+    case WET_RULE_LE:
+      holds = x <= t->threshold;
+      break;
+    case WET_RULE_GT:
+      holds = x > t->threshold;
+      break;
+    case WET_RULE_GE:
+      holds = x >= t->threshold;
+      break;
+    case WET_RULE_EQ:
+      holds = x == t->threshold;
+      break;
+    default:
+      holds = x != t->threshold;
+      break;
+    }
+    if (!holds || (x == UNKNOWN)) {
+      i = t->next;
+      continue;
+    }
+    if (t->rule != -1)
+      matches[n++] = rules->names[t->rule];
+    ++i;
+  }
+  return n;
+}
+
+void
+wet_rules_free (struct wet_rules *rules)
+{
+  size_t i;
+
+  for (i = 0; i < rules->n_rules; ++i)
+    free (rules->names[i]);
+  free (rules->names);
+  free (rules->tests);
+  free (rules);
+}
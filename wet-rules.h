@@ -0,0 +1,82 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_RULES_H
+#define WET_RULES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wet.h"
+#include "wet-weather.h"
+
+/* the quantities a rule can test, as loaded for each location */
+enum wet_rule_field {
+  WET_RULE_TEMPERATURE,
+  WET_RULE_FEELS_LIKE,
+  WET_RULE_DEWPOINT,
+  WET_RULE_HUMIDITY,
+  WET_RULE_PRESSURE,
+  WET_RULE_WIND_SPEED,
+  WET_RULE_WIND_GUST,
+  WET_RULE_VISIBILITY,
+  WET_RULE_UV_INDEX,
+  WET_RULE_CONDITION,
+  WET_RULE_HIGH,
+  WET_RULE_LOW,
+  WET_RULE_CHANCE_PRECIP,
+  WET_RULE_FIELDS
+};
+
+enum wet_rule_op {
+  WET_RULE_LT,
+  WET_RULE_LE,
+  WET_RULE_GT,
+  WET_RULE_GE,
+  WET_RULE_EQ,
+  WET_RULE_NE
+};
+
+/* One comparison of the flat rule program: field OP threshold, with the
+   threshold already in the units of struct weather_values. A rule is a
+   run of these that must all hold; if one fails, evaluation jumps to
+   NEXT (the first comparison of the following rule), and if the last
+   one of a run holds, RULE (otherwise -1) has matched. */
+struct wet_rule_test {
+  uint8_t field;
+  uint8_t op;
+  int32_t threshold;
+  int32_t rule;
+  uint32_t next;
+};
+
+struct wet_rules {
+  struct wet_rule_test *tests;
+  size_t n_tests;
+  char **names;
+  size_t n_rules;
+};
+
+struct wet_rules *wet_rules_compile (const char *, bool);
+size_t wet_rules_match (const struct wet_rules *,
+                        const struct weather_values *, const char **);
+void wet_rules_free (struct wet_rules *);
+
+#endif /* WET_RULES_H */
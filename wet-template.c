@@ -0,0 +1,322 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * A --format-string is text with fields in braces, such as
+ *
+ *   {loc.name}: {cc.temp}º{units.temp} {cc.text}
+ *
+ * It is compiled once into a flat program of ops (struct
+ * wet_template_op), each of which either copies a run of the literal
+ * text or the value of one field. A field is located in struct weather
+ * by its offset there, or in a forecast by its offset in struct
+ * weather_forecast, so rendering a document runs no lookups at all: it
+ * is one copy per op into the caller's output.
+ *
+ * `{{' and `}}' stand for literal braces, and `\n', `\t' and `\\' for a
+ * newline, a tab and a backslash.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wet-template.h"
+#include "wet-util.h"
+
+#define FIELD_MAX 64
+/* what the parser gives a field the document does not have */
+#define UNKNOWN   "(not found)"
+
+#define __field(__name, __member) \
+  { __name, offsetof (struct weather, __member) }
+#define __forecast_field(__name, __member) \
+  { __name, offsetof (struct weather_forecast, __member) }
+
+static const struct {
+  const char *name;
+  size_t offset;
+} fields[] = {
+  __field ("loc.name", location.name),
+  __field ("loc.lat", location.lat),
+  __field ("loc.lon", location.lon),
+  __field ("loc.zone", location.zone),
+  __field ("cc.last-updated", current_conditions.last_updated),
+  __field ("cc.temp", current_conditions.temperature),
+  __field ("cc.dewpoint", current_conditions.dewpoint),
+  __field ("cc.text", current_conditions.text),
+  __field ("cc.icon", current_conditions.icon),
+  __field ("cc.visibility", current_conditions.visibility),
+  __field ("cc.humidity", current_conditions.humidity),
+  __field ("cc.station", current_conditions.station),
+  __field ("cc.feels-like", current_conditions.feels_like),
+  __field ("cc.moon", current_conditions.moon_phase.text),
+  __field ("cc.uv", current_conditions.uv.index),
+  __field ("cc.uv-text", current_conditions.uv.text),
+  __field ("cc.barometer", current_conditions.barometer.reading),
+  __field ("cc.barometer-trend", current_conditions.barometer.direction),
+  __field ("cc.wind", current_conditions.wind.speed),
+  __field ("cc.gust", current_conditions.wind.gust),
+  __field ("cc.wind-dir", current_conditions.wind.text),
+  __field ("cc.wind-deg", current_conditions.wind.direction),
+  __field ("units.temp", units.temperature),
+  __field ("units.distance", units.distance),
+  __field ("units.speed", units.speed),
+  __field ("units.pressure", units.pressure),
+  __field ("units.rainfall", units.rainfall),
+  __field ("severe.text", severe_weather_alert.text),
+  __field ("severe.link", severe_weather_alert.link),
+  { NULL, 0 }
+};
+
+/* the fields of fc.DAY.FIELD */
+static const struct {
+  const char *name;
+  size_t offset;
+} forecast_fields[] = {
+  __forecast_field ("dow", day_of_week),
+  __forecast_field ("high", high),
+  __forecast_field ("low", low),
+  __forecast_field ("sunset", sunset),
+  __forecast_field ("sunrise", sunrise),
+  __forecast_field ("text", text),
+  __forecast_field ("icon", icon),
+  __forecast_field ("cop", chance_precip),
+  __forecast_field ("humidity", humidity),
+  __forecast_field ("wind", wind.speed),
+  __forecast_field ("gust", wind.gust),
+  __forecast_field ("wind-dir", wind.text),
+  __forecast_field ("wind-deg", wind.direction),
+  __forecast_field ("night.text", night.text),
+  __forecast_field ("night.icon", night.icon),
+  __forecast_field ("night.cop", night.chance_precip),
+  __forecast_field ("night.humidity", night.humidity),
+  __forecast_field ("night.wind", night.wind.speed),
+  __forecast_field ("night.gust", night.wind.gust),
+  __forecast_field ("night.wind-dir", night.wind.text),
+  __forecast_field ("night.wind-deg", night.wind.direction),
+  { NULL, 0 }
+};
+
+#undef __field
+#undef __forecast_field
+
+struct compiler {
+  struct wet_template *t;
+  size_t ops_size;
+  size_t text_len;
+};
+
+static struct wet_template_op *
+add_op (struct compiler *c, enum wet_template_kind kind)
+{
+  struct wet_template_op *op;
+
+  if (c->t->n_ops == c->ops_size) {
+    c->ops_size = c->ops_size ? c->ops_size * 2 : 16;
+    c->t->ops = (struct wet_template_op *)
+      realloc (c->t->ops, c->ops_size * sizeof (struct wet_template_op));
+    if (!c->t->ops)
+      wet_die (WET_ESYS, "failed to allocate memory");
+  }
+  op = &c->t->ops[c->t->n_ops++];
+  memset (op, 0, sizeof (struct wet_template_op));
+  op->kind = kind;
+  return op;
+}
+
+/* Appends CH to the literal text, extending the last op if it is the
+   literal just before it. */
+static void
+add_char (struct compiler *c, char ch)
+{
+  struct wet_template_op *op;
+
+  op = c->t->n_ops ? &c->t->ops[c->t->n_ops - 1] : NULL;
+  if (!op || (op->kind != WET_TEMPLATE_LITERAL) ||
+      (op->offset + op->len != c->text_len)) {
+    op = add_op (c, WET_TEMPLATE_LITERAL);
+    op->offset = (uint32_t) c->text_len;
+  }
+  c->t->text[c->text_len++] = ch;
+  op->len++;
+}
+
+/* Returns the forecast day (0 is today) that the N bytes at P name, or
+   -1 if they are not one. */
+static int
+parse_day (const char *p, size_t n)
+{
+  int day;
+  size_t i;
+
+  if ((n == 5) && !strncmp (p, "today", 5))
+    return 0;
+  if ((n == 8) && !strncmp (p, "tomorrow", 8))
+    return 1;
+  if (!n || (n > 2))
+    return -1;
+  day = 0;
+  for (i = 0; i < n; ++i) {
+    if ((p[i] < '0') || (p[i] > '9'))
+      return -1;
+    day = day * 10 + (p[i] - '0');
+  }
+  if ((day < 1) || (day > WET_FORECAST_DAYS_MAX))
+    return -1;
+  return day - 1;
+}
+
+/* Compiles a reference to the field NAME. */
+static void
+add_field (struct compiler *c, const char *name)
+{
+  struct wet_template_op *op;
+  const char *dot;
+  int day;
+  int i;
+
+  if (wet_streq (name, "loc.id")) {
+    add_op (c, WET_TEMPLATE_LOCATION_ID);
+    return;
+  }
+  for (i = 0; fields[i].name; ++i) {
+    if (wet_streq (name, fields[i].name)) {
+      op = add_op (c, WET_TEMPLATE_VIEW);
+      op->offset = (uint32_t) fields[i].offset;
+      return;
+    }
+  }
+
+  if (!strncmp (name, "fc.", 3) && (dot = strchr (name + 3, '.'))) {
+    day = parse_day (name + 3, dot - (name + 3));
+    for (i = 0; (day != -1) && forecast_fields[i].name; ++i) {
+      if (wet_streq (dot + 1, forecast_fields[i].name)) {
+        op = add_op (c, WET_TEMPLATE_FORECAST);
+        op->day = (uint8_t) day;
+        op->offset = (uint32_t) forecast_fields[i].offset;
+        if ((unsigned int) day + 1 > c->t->days)
+          c->t->days = day + 1;
+        return;
+      }
+    }
+  }
+  wet_die (WET_EOP, "unknown field `{%s}' in `--format-string' (see the "
+           "manual for the list)", name);
+}
+
+/* Compiles the template S. Dies on a malformed one. */
+struct wet_template *
+wet_template_compile (const char *s)
+{
+  struct compiler c;
+  char name[FIELD_MAX];
+  const char *p;
+  const char *rbrace;
+
+  c.t = (struct wet_template *) calloc (1, sizeof (struct wet_template));
+  if (!c.t)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  /* the literal text is never longer than the template */
+  c.t->text = (char *) malloc (strlen (s) + 1);
+  if (!c.t->text)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  c.t->days = 1;
+  c.ops_size = 0;
+  c.text_len = 0;
+
+  for (p = s; *p; ++p) {
+    if (((*p == '{') || (*p == '}')) && (p[1] == *p))
+      add_char (&c, *p++);
+    else if (*p == '}')
+      wet_die (WET_EOP, "unmatched `}' in `--format-string' (use `}}' for "
+               "a literal one)");
+    else if (*p == '{') {
+      rbrace = strchr (p, '}');
+      if (!rbrace)
+        wet_die (WET_EOP, "unterminated `{' in `--format-string' (use `{{' "
+                 "for a literal one)");
+      snprintf (name, FIELD_MAX, "%.*s", (int) (rbrace - p - 1), p + 1);
+      add_field (&c, name);
+      p = rbrace;
+    } else if ((*p == '\\') && (p[1] == 'n')) {
+      add_char (&c, '\n');
+      ++p;
+    } else if ((*p == '\\') && (p[1] == 't')) {
+      add_char (&c, '\t');
+      ++p;
+    } else if ((*p == '\\') && (p[1] == '\\')) {
+      add_char (&c, '\\');
+      ++p;
+    } else
+      add_char (&c, *p);
+  }
+  return c.t;
+}
+
+/* Writes W to OUT as T says. */
+void
+wet_template_render (const struct wet_template *t, FILE *out,
+                     const struct weather *w)
+{
+  const struct wet_template_op *op;
+  const struct wet_template_op *end;
+  const struct wet_view *v;
+
+  end = t->ops + t->n_ops;
+  for (op = t->ops; op < end; ++op) {
+    switch (op->kind) {
+    case WET_TEMPLATE_LITERAL:
+      fwrite (t->text + op->offset, 1, op->len, out);
+      break;
+    case WET_TEMPLATE_VIEW:
+      v = (const struct wet_view *) ((const char *) w + op->offset);
+      fwrite (v->p, 1, v->n, out);
+      break;
+    case WET_TEMPLATE_FORECAST:
+      /* the document may have fewer days than were asked for */
+      if (op->day >= w->n_forecasts) {
+        fwrite (UNKNOWN, 1, sizeof (UNKNOWN) - 1, out);
+        break;
+      }
+      v = (const struct wet_view *) ((const char *) &w->forecasts[op->day] +
+                                     op->offset);
+      fwrite (v->p, 1, v->n, out);
+      break;
+    default:
+      fputs (w->location_id, out);
+      break;
+    }
+  }
+}
+
+void
+wet_template_free (struct wet_template *t)
+{
+  if (!t)
+    return;
+  free (t->ops);
+  free (t->text);
+  free (t);
+}
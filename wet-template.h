@@ -0,0 +1,62 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_TEMPLATE_H
+#define WET_TEMPLATE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "wet.h"
+#include "wet-weather.h"
+
+enum wet_template_kind {
+  WET_TEMPLATE_LITERAL,     /* LEN bytes of the template's text at OFFSET */
+  WET_TEMPLATE_VIEW,        /* the struct wet_view at OFFSET in the weather */
+  WET_TEMPLATE_FORECAST,    /* ... at OFFSET in forecast DAY */
+  WET_TEMPLATE_LOCATION_ID  /* the weather's location_id */
+};
+
+/* One step of a compiled template: writes some literal text or the value
+   of one field. */
+struct wet_template_op {
+  uint8_t kind;
+  uint8_t day;
+  uint32_t offset;
+  uint32_t len;
+};
+
+/* A --format-string, compiled into a flat program of ops so that
+   rendering a document is a pass of copies, with no template left to
+   parse. DAYS is how many days of forecasts its fields read (at least
+   one), which is all that has to be fetched for it. */
+struct wet_template {
+  struct wet_template_op *ops;
+  size_t n_ops;
+  char *text;
+  unsigned int days;
+};
+
+struct wet_template *wet_template_compile (const char *);
+void wet_template_render (const struct wet_template *, FILE *,
+                          const struct weather *);
+void wet_template_free (struct wet_template *);
+
+#endif /* WET_TEMPLATE_H */
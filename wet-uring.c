@@ -0,0 +1,291 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * An io_uring transport for large fan-outs (see http_get_pipelined()).
+ * Every stream's connect, send and receive goes through one ring: the
+ * operations that become ready while completions are being handled are
+ * queued and then submitted together, so a fetch over many connections
+ * costs a handful of system calls per round rather than several per
+ * connection. Receives land in buffers registered with the ring up
+ * front, which spares the kernel mapping them on every read; if they
+ * cannot be registered (a low RLIMIT_MEMLOCK, say), plain receives into
+ * the same buffers are used instead.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_LIBURING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <liburing.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "wet-uring.h"
+#include "wet-util.h"
+
+#define RECV_BUFFER 16384
+
+enum stream_state {
+  CONNECTING,
+  SENDING,
+  RECEIVING,
+  DONE
+};
+
+struct stream {
+  size_t index;
+  int sock;
+  enum stream_state state;
+  size_t sent;
+  char *buffer;
+  const struct wet_uring_stream *s;
+};
+
+struct exchange {
+  struct io_uring ring;
+  bool fixed;
+  const struct wet_uring_handlers *handlers;
+  void *arg;
+};
+
+/* Every stream has at most one operation outstanding, and the ring has
+   room for all of them, so this only returns NULL on a broken ring. */
+static struct io_uring_sqe *
+get_sqe (struct exchange *x)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = io_uring_get_sqe (&x->ring);
+  if (!sqe)
+    wet_debug ("io_uring submission queue is full");
+  return sqe;
+}
+
+static bool
+queue_send (struct exchange *x, struct stream *st)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = get_sqe (x);
+  if (!sqe)
+    return false;
+  io_uring_prep_send (sqe, st->sock, st->s->request + st->sent,
+                      st->s->len - st->sent, MSG_NOSIGNAL);
+  io_uring_sqe_set_data (sqe, st);
+  return true;
+}
+
+static bool
+queue_receive (struct exchange *x, struct stream *st)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = get_sqe (x);
+  if (!sqe)
+    return false;
+  if (x->fixed)
+    io_uring_prep_read_fixed (sqe, st->sock, st->buffer, RECV_BUFFER, 0,
+                              (int) st->index);
+  else
+    io_uring_prep_recv (sqe, st->sock, st->buffer, RECV_BUFFER, 0);
+  io_uring_sqe_set_data (sqe, st);
+  return true;
+}
+
+static void
+finish (struct exchange *x, struct stream *st, bool report)
+{
+  if (report)
+    x->handlers->received (st->index, NULL, 0, x->arg);
+  close (st->sock);
+  st->state = DONE;
+}
+
+/* Moves ST on after one of its operations completed with RES. */
+static void
+advance (struct exchange *x, struct stream *st, int res)
+{
+  switch (st->state) {
+  case CONNECTING:
+    if (res < 0) {
+      wet_debug ("io_uring connect failed: %s", strerror (-res));
+      finish (x, st, true);
+      return;
+    }
+    x->handlers->connected (st->index, x->arg);
+    st->state = SENDING;
+    if (!queue_send (x, st))
+      finish (x, st, true);
+    return;
+  case SENDING:
+    if (res < 0) {
+      wet_debug ("io_uring send failed: %s", strerror (-res));
+      finish (x, st, true);
+      return;
+    }
+    st->sent += res;
+    if (st->sent < st->s->len) {
+      if (!queue_send (x, st))
+        finish (x, st, true);
+      return;
+    }
+    x->handlers->sent (st->index, x->arg);
+    st->state = RECEIVING;
+    if (!queue_receive (x, st))
+      finish (x, st, true);
+    return;
+  case RECEIVING:
+    if (res <= 0) {
+      finish (x, st, true);
+      return;
+    }
+    if (!x->handlers->received (st->index, st->buffer, (size_t) res,
+                                x->arg)) {
+      finish (x, st, false);
+      return;
+    }
+    if (!queue_receive (x, st))
+      finish (x, st, true);
+    return;
+  default:
+    return;
+  }
+}
+
+/* Connects N streams to ADDRESS (LEN bytes), sends each its request and hands
+   everything received to HANDLERS until they have had enough. Returns
+   false, having done nothing, if io_uring cannot be used here; any
+   failure after that ends only the streams it hits (all of them, if the
+   ring itself fails), which HANDLERS are told about. */
+bool
+wet_uring_exchange (const struct sockaddr *address, socklen_t len,
+                    const struct wet_uring_stream *streams, size_t n,
+                    const struct wet_uring_handlers *handlers, void *arg)
+{
+  struct exchange x;
+  struct stream *states;
+  struct stream *st;
+  struct iovec *iov;
+  struct io_uring_sqe *sqe;
+  struct io_uring_cqe *cqe;
+  char *buffers;
+  size_t active;
+  size_t i;
+  int err;
+  int on;
+
+  err = io_uring_queue_init ((unsigned int) n, &x.ring, 0);
+  if (err < 0) {
+    wet_debug ("io_uring unavailable: %s", strerror (-err));
+    return false;
+  }
+
+  states = (struct stream *) malloc (n * sizeof (struct stream));
+  iov = (struct iovec *) malloc (n * sizeof (struct iovec));
+  buffers = (char *) malloc (n * RECV_BUFFER);
+  if (!states || !iov || !buffers) {
+    wet_debug ("no memory for io_uring buffers");
+    io_uring_queue_exit (&x.ring);
+    free (buffers);
+    free (iov);
+    free (states);
+    return false;
+  }
+  for (i = 0; i < n; ++i) {
+    iov[i].iov_base = buffers + i * RECV_BUFFER;
+    iov[i].iov_len = RECV_BUFFER;
+  }
+  err = io_uring_register_buffers (&x.ring, iov, (unsigned int) n);
+  x.fixed = (err == 0);
+  if (!x.fixed)
+    wet_debug ("io_uring buffers not registered: %s", strerror (-err));
+  x.handlers = handlers;
+  x.arg = arg;
+
+  /* every connect goes out in the first submission */
+  active = 0;
+  for (i = 0; i < n; ++i) {
+    st = &states[i];
+    st->index = i;
+    st->sent = 0;
+    st->buffer = buffers + i * RECV_BUFFER;
+    st->s = &streams[i];
+    st->state = CONNECTING;
+    handlers->connecting (i, arg);
+    st->sock = socket (address->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (st->sock == -1) {
+      wet_debug ("failed to create socket: %s", strerror (errno));
+      st->state = DONE;
+      handlers->received (i, NULL, 0, arg);
+      continue;
+    }
+    /* each stream's pipeline goes out in one write, which Nagle's
+       algorithm would only hold the tail of back */
+    on = 1;
+    setsockopt (st->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+    sqe = get_sqe (&x);
+    if (!sqe) {
+      finish (&x, st, true);
+      continue;
+    }
+    io_uring_prep_connect (sqe, st->sock, address, len);
+    io_uring_sqe_set_data (sqe, st);
+    active++;
+  }
+
+  while (active) {
+    err = io_uring_submit_and_wait (&x.ring, 1);
+    if ((err < 0) && (err != -EINTR)) {
+      wet_debug ("io_uring submission failed: %s", strerror (-err));
+      for (i = 0; i < n; ++i)
+        if (states[i].state != DONE)
+          finish (&x, &states[i], true);
+      break;
+    }
+    /* handle every completion there is, queueing what follows each, and
+       let the next round submit them all at once */
+    while (io_uring_peek_cqe (&x.ring, &cqe) == 0) {
+      st = (struct stream *) io_uring_cqe_get_data (cqe);
+      err = cqe->res;
+      io_uring_cqe_seen (&x.ring, cqe);
+      advance (&x, st, err);
+      if (st->state == DONE)
+        active--;
+    }
+  }
+
+  io_uring_queue_exit (&x.ring);
+  free (buffers);
+  free (iov);
+  free (states);
+  return true;
+}
+
+#endif /* HAVE_LIBURING */
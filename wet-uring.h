@@ -0,0 +1,56 @@
+/*
+ * wet - A command line tool for retrieving weather data.
+ *
+ * Copyright (C) 2013  Nathan Forbes
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef WET_URING_H
+#define WET_URING_H
+
+#ifdef HAVE_LIBURING
+
+#include <stddef.h>
+#include <sys/socket.h>
+
+#include "wet.h"
+
+/* What happens on stream I. CONNECTING is called as its connection is
+   started, CONNECTED once it is established and SENT once its whole
+   request has been sent; RECEIVED with the bytes
+   that arrived on it, or with N == 0 once it has ended (the peer closed
+   it, or it failed), and returns false when the stream needs nothing
+   more, which closes it. */
+struct wet_uring_handlers {
+  void (*connecting) (size_t, void *);
+  void (*connected) (size_t, void *);
+  void (*sent) (size_t, void *);
+  bool (*received) (size_t, const char *, size_t, void *);
+};
+
+/* one connection: REQUEST is sent as soon as it is established */
+struct wet_uring_stream {
+  const char *request;
+  size_t len;
+};
+
+bool wet_uring_exchange (const struct sockaddr *, socklen_t,
+                         const struct wet_uring_stream *, size_t,
+                         const struct wet_uring_handlers *, void *);
+
+#endif /* HAVE_LIBURING */
+
+#endif /* WET_URING_H */
@@ -22,15 +22,24 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h> /* INT_MIN and INT_MAX */
 #include <stdarg.h>
 #ifdef HAVE_STDINT_H
 # include <stdint.h> /* SIZE_MAX */
 #endif
 #include <string.h>
+#ifdef HAVE_SYS_FILE_H
+# include <sys/file.h> /* flock */
+#endif
 #ifdef HAVE_SYS_IOCTL_H
 # include <sys/ioctl.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#include <sys/stat.h>
 #ifdef HAVE_UNISTD_H
 # include <unistd.h>
 #endif
@@ -41,6 +50,10 @@
 #include "wet-util.h"
 
 #define DEFAULT_CONSOLE_WIDTH 80
+#define READ_CHUNK            65536
+
+/* the name messages are tagged with; wet sets it from argv[0] */
+const char *program_name = WET_PROGRAM_NAME;
 
 void wet_print (int out, const char *tag, const char *fmt, ...)
 {
@@ -60,6 +73,20 @@ void wet_print (int out, const char *tag, const char *fmt, ...)
   fputc ('\n', stream);
 }
 
+/* Stores the error code E and the message FMT in ERR. Returns false, so
+   a failing function can end with `return wet_fail (...)'. */
+bool
+wet_fail (struct wet_error *err, int e, const char *fmt, ...)
+{
+  va_list ap;
+
+  err->code = e;
+  va_start (ap, fmt);
+  vsnprintf (err->text, WET_ERROR_MAX, fmt, ap);
+  va_end (ap);
+  return false;
+}
+
 void
 wet_puts (const char *fmt, ...)
 {
@@ -75,6 +102,21 @@ wet_puts (const char *fmt, ...)
   va_end (ap);
 }
 
+void
+wet_fputs (FILE *stream, const char *fmt, ...)
+{
+  if (!strchr (fmt, '%')) {
+    fputs (fmt, stream);
+    return;
+  }
+
+  va_list ap;
+
+  va_start (ap, fmt);
+  vfprintf (stream, fmt, ap);
+  va_end (ap);
+}
+
 void
 wet_eputs (const char *fmt, ...)
 {
@@ -250,3 +292,342 @@ wet_getenv (const char *key)
   return value;
 }
 
+
+/* Returns an owned, null terminated copy of V (free it when done), or
+   NULL if there is no memory for one. */
+char *
+wet_view_dup (struct wet_view v)
+{
+  char *s;
+
+  s = (char *) malloc (v.n + 1);
+  if (!s)
+    return NULL;
+  memcpy (s, v.p, v.n);
+  s[v.n] = '\0';
+  return s;
+}
+
+bool
+wet_view_streqi (struct wet_view v, const char *s)
+{
+  size_t i;
+
+  if (v.n != strlen (s))
+    return false;
+  for (i = 0; i < v.n; ++i)
+    if (tolower ((unsigned char) v.p[i]) != tolower ((unsigned char) s[i]))
+      return false;
+  return true;
+}
+
+int
+wet_view2int (struct wet_view v)
+{
+  char buffer[32];
+
+  if (v.n >= sizeof (buffer))
+    v.n = sizeof (buffer) - 1;
+  memcpy (buffer, v.p, v.n);
+  buffer[v.n] = '\0';
+  return wet_str2int (buffer);
+}
+
+/* Stores the number in V in *D and returns true, or returns false if V
+   is not a number. */
+bool
+wet_view2double (struct wet_view v, double *d)
+{
+  char buffer[64];
+  char *end;
+
+  if (!v.n || v.n >= sizeof (buffer))
+    return false;
+  memcpy (buffer, v.p, v.n);
+  buffer[v.n] = '\0';
+  errno = 0;
+  *d = strtod (buffer, &end);
+  return !errno && !*end;
+}
+
+static bool
+make_dirs (char *path)
+{
+  char *p;
+
+  for (p = path + 1; *p; ++p) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir (path, 0755) == -1 && errno != EEXIST) {
+      *p = '/';
+      return false;
+    }
+    *p = '/';
+  }
+  return mkdir (path, 0755) == 0 || errno == EEXIST;
+}
+
+/* Returns the malloc'd path of NAME inside wet's data directory, which is
+   created if needed: $WET_DATA_DIR, $XDG_DATA_HOME/wet or
+   $HOME/.local/share/wet, in that order. Returns NULL if there is no
+   usable data directory. */
+char *
+wet_data_path (const char *name)
+{
+  char *base;
+  const char *suffix;
+  char *path;
+  size_t n;
+
+  suffix = "";
+  base = wet_getenv ("WET_DATA_DIR");
+  if (!base || !*base) {
+    suffix = "/wet";
+    base = wet_getenv ("XDG_DATA_HOME");
+  }
+  if (!base || !*base) {
+    suffix = "/.local/share/wet";
+    base = wet_getenv ("HOME");
+  }
+  if (!base || !*base)
+    return NULL;
+
+  n = strlen (base) + strlen (suffix) + strlen (name) + 2;
+  path = (char *) malloc (n);
+  if (!path)
+    return NULL;
+  snprintf (path, n, "%s%s", base, suffix);
+  if (!make_dirs (path)) {
+    wet_debug ("failed to create `%s': %s", path, strerror (errno));
+    free (path);
+    return NULL;
+  }
+  snprintf (path, n, "%s%s/%s", base, suffix, name);
+  return path;
+}
+
+/* Opens PATH.lock and takes the flock OPERATION on it. */
+static int
+lock_file (const char *path, int operation)
+{
+  char *lock;
+  size_t len;
+  int fd;
+
+  len = strlen (path) + sizeof (".lock");
+  lock = (char *) malloc (len);
+  if (!lock)
+    return -1;
+  snprintf (lock, len, "%s.lock", path);
+  fd = open (lock, O_RDWR | O_CREAT, 0644);
+  free (lock);
+  if (fd == -1)
+    return -1;
+#ifdef HAVE_SYS_FILE_H
+  while (flock (fd, operation) == -1) {
+    if (errno != EINTR) {
+      close (fd);
+      return -1;
+    }
+  }
+#endif
+  return fd;
+}
+
+/* Takes an exclusive lock for rewriting the file at PATH, held on
+   PATH.lock since PATH itself is replaced by a rename. The lock belongs
+   to the open file, so it keeps out other threads as well as other
+   processes. Returns the descriptor to give to wet_unlock_file(), or -1
+   if the lock cannot be had. */
+int
+wet_lock_file (const char *path)
+{
+#ifdef HAVE_SYS_FILE_H
+  return lock_file (path, LOCK_EX);
+#else
+  return lock_file (path, 0);
+#endif
+}
+
+/* Takes a shared lock for reading the file at PATH: any number of
+   readers can hold it at once, but none while wet_lock_file() is
+   held. */
+int
+wet_lock_file_shared (const char *path)
+{
+#ifdef HAVE_SYS_FILE_H
+  return lock_file (path, LOCK_SH);
+#else
+  return lock_file (path, 0);
+#endif
+}
+
+void
+wet_unlock_file (int fd)
+{
+  if (fd != -1)
+    close (fd);
+}
+
+/* Replaces the file at PATH with the N bytes at P. The data is written
+   to a temporary file of its own first and renamed over PATH, so readers
+   (which may have PATH mapped) only ever see the old or the new
+   contents. Callers that merge with the old contents hold
+   wet_lock_file() across the read and the rename. */
+bool
+wet_replace_file (const char *path, const void *p, size_t n)
+{
+  char *tmp;
+  size_t len;
+  FILE *fp;
+  int fd;
+  bool ok;
+
+  len = strlen (path) + sizeof (".XXXXXX");
+  tmp = (char *) malloc (len);
+  if (!tmp)
+    return false;
+  snprintf (tmp, len, "%s.XXXXXX", path);
+
+  fd = mkstemp (tmp);
+  if (fd == -1) {
+    free (tmp);
+    return false;
+  }
+  fp = NULL;
+  if (fchmod (fd, 0644) == 0)
+    fp = fdopen (fd, "wb");
+  if (!fp) {
+    close (fd);
+    unlink (tmp);
+    free (tmp);
+    return false;
+  }
+  ok = fwrite (p, 1, n, fp) == n;
+  ok = (fclose (fp) == 0) && ok;
+  ok = ok && (rename (tmp, path) == 0);
+  if (!ok)
+    unlink (tmp);
+  free (tmp);
+  return ok;
+}
+
+void *
+wet_alloc (const struct wet_allocator *allocator, size_t n)
+{
+  if (!allocator)
+    return malloc (n);
+  return allocator->alloc (n, allocator->arg);
+}
+
+void
+wet_release (const struct wet_allocator *allocator, void *p)
+{
+  if (!allocator)
+    free (p);
+  else if (p)
+    allocator->release (p, allocator->arg);
+}
+
+static bool
+read_whole_file (struct wet_buffer *b, int fd)
+{
+  size_t size;
+  ssize_t n_read;
+  char *p;
+
+  size = READ_CHUNK;
+  b->p = (char *) malloc (size + 1);
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = NULL;
+
+  while (b->p) {
+    n_read = read (fd, b->p + b->n, size - b->n);
+    if (n_read < 0) {
+      if (errno == EINTR)
+        continue;
+      wet_buffer_free (b);
+      return false;
+    }
+    if (n_read == 0)
+      break;
+    b->n += n_read;
+    if (b->n == size) {
+      size *= 2;
+      p = (char *) realloc (b->p, size + 1);
+      if (!p)
+        free (b->p);
+      b->p = p;
+    }
+  }
+
+  if (!b->p) {
+    b->n = 0;
+    errno = ENOMEM;
+    return false;
+  }
+  b->p[b->n] = '\0';
+  return true;
+}
+
+/* Loads the file at PATH ("-" for standard input) into B. Regular files
+   are mapped rather than read, so nothing is copied; anything else (a
+   pipe, say) is read into a malloc'd buffer. Returns false, with errno
+   saying why, if the file could not be loaded. */
+bool
+wet_buffer_map (struct wet_buffer *b, const char *path)
+{
+  int fd;
+  int saved;
+  bool ok;
+  struct stat st;
+
+  b->p = NULL;
+  b->n = 0;
+  b->mapped = false;
+  b->allocator = NULL;
+  if (wet_streq (path, "-"))
+    fd = STDIN_FILENO;
+  else {
+    fd = open (path, O_RDONLY);
+    if (fd == -1)
+      return false;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  if ((fstat (fd, &st) == 0) && S_ISREG (st.st_mode) && (st.st_size > 0)) {
+    b->p = (char *) mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (b->p != MAP_FAILED) {
+      b->n = st.st_size;
+      b->mapped = true;
+      if (fd != STDIN_FILENO)
+        close (fd);
+      return true;
+    }
+  }
+#endif
+
+  ok = read_whole_file (b, fd);
+  saved = errno;
+  if (fd != STDIN_FILENO)
+    close (fd);
+  errno = saved;
+  return ok;
+}
+
+void
+wet_buffer_free (struct wet_buffer *b)
+{
+  if (!b->p)
+    return;
+#ifdef HAVE_SYS_MMAN_H
+  if (b->mapped)
+    munmap (b->p, b->n);
+  else
+#endif
+    wet_release (b->allocator, b->p);
+  b->p = NULL;
+  b->n = 0;
+}
@@ -28,6 +28,39 @@
 #define __WET_OUTPUT_STDOUT 0
 #define __WET_OUTPUT_STDERR 1
 #define __WET_TAG_MAX       256
+#define WET_ERROR_MAX       256
+
+/* A string that is not null terminated and is not owned: N bytes at P,
+   usually inside a retained response buffer. Print with "%.*s". */
+struct wet_view {
+  const char *p;
+  size_t n;
+};
+
+/* Where memory comes from: ALLOC returns N bytes (or NULL) and RELEASE
+   gives back what it returned, both being passed ARG. A null allocator
+   stands for malloc() and free(). */
+struct wet_allocator {
+  void *(*alloc) (size_t, void *);
+  void (*release) (void *, void *);
+  void *arg;
+};
+
+/* A document held in memory, either mapped from a file or taken from
+   ALLOCATOR. */
+struct wet_buffer {
+  char *p;
+  size_t n;
+  bool mapped;
+  const struct wet_allocator *allocator;
+};
+
+/* What went wrong, for the code that reports failures to its caller
+   rather than exiting: one of the WET_E* codes and a message. */
+struct wet_error {
+  int code;
+  char text[WET_ERROR_MAX];
+};
 
 #define wet_putc(c)  fputc (c, stdout)
 #define wet_eputc(c) fputc (c, stderr)
@@ -58,6 +91,8 @@
     exit (e); \
   } while (0)
 
+#define wet_die_error(err) wet_die ((err)->code, "%s", (err)->text)
+
 #define wet_free(p) \
   do { \
     if (!p) \
@@ -67,7 +102,9 @@
   } while (0)
 
 void wet_print (int, const char *, const char *, ...);
+bool wet_fail (struct wet_error *, int, const char *, ...);
 void wet_puts (const char *, ...);
+void wet_fputs (FILE *, const char *, ...);
 void wet_eputs (const char *, ...);
 int wet_console_width (void);
 bool wet_streq (const char *, const char *);
@@ -75,6 +112,19 @@ bool wet_streqi (const char *, const char *);
 int wet_str2int (const char *);
 size_t wet_str2size (const char *);
 char *wet_getenv (const char *);
+char *wet_view_dup (struct wet_view);
+bool wet_view_streqi (struct wet_view, const char *);
+int wet_view2int (struct wet_view);
+bool wet_view2double (struct wet_view, double *);
+char *wet_data_path (const char *);
+int wet_lock_file (const char *);
+int wet_lock_file_shared (const char *);
+void wet_unlock_file (int);
+bool wet_replace_file (const char *, const void *, size_t);
+void *wet_alloc (const struct wet_allocator *, size_t);
+void wet_release (const struct wet_allocator *, void *);
+bool wet_buffer_map (struct wet_buffer *, const char *);
+void wet_buffer_free (struct wet_buffer *);
 
 #endif /* WET_UTIL_H */
 
@@ -17,84 +17,692 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <string.h> /* memset() */
+#include <math.h>
+#include <stdio.h>
+#include <string.h> /* memset(), strncpy() */
 
 #include "wet.h"
+#include "wet-geo.h"
+#include "wet-names.h"
 #include "wet-net.h"
 #include "wet-util.h"
 #include "wet-weather.h"
 
+static const struct wet_view empty = { "", 0 };
+
 static void
 init_weather_struct (struct weather *w)
 {
-  int i;
-
   memset (w, 0, sizeof (struct weather));
 
-#define __init_wind(__w)   \
-  __w.gust[0] = '\0';      \
-  __w.direction[0] = '\0'; \
-  __w.speed[0] = '\0';     \
-  __w.text[0] = '\0'
+#define __init_wind(__w) \
+  __w.gust = empty;      \
+  __w.direction = empty; \
+  __w.speed = empty;     \
+  __w.text = empty
 
   w->location_id[0] = '\0';
-  w->error.type[0] = '\0';
-  w->error.text[0] = '\0';
-  w->units.distance[0] = '\0';
-  w->units.speed[0] = '\0';
-  w->units.temperature[0] = '\0';
-  w->units.rainfall[0] = '\0';
-  w->units.pressure[0] = '\0';
-  w->severe_weather_alert.text[0] = '\0';
-  w->severe_weather_alert.link[0] = '\0';
-  w->current_conditions.last_updated[0] = '\0';
-  w->current_conditions.temperature[0] = '\0';
-  w->current_conditions.dewpoint[0] = '\0';
-  w->current_conditions.text[0] = '\0';
-  w->current_conditions.visibility[0] = '\0';
-  w->current_conditions.humidity[0] = '\0';
-  w->current_conditions.station[0] = '\0';
-  w->current_conditions.feels_like[0] = '\0';
-  w->current_conditions.moon_phase.text[0] = '\0';
-  w->current_conditions.uv.index[0] = '\0';
-  w->current_conditions.uv.text[0] = '\0';
-  w->current_conditions.barometer.direction[0] = '\0';
-  w->current_conditions.barometer.reading[0] = '\0';
+  w->content.p = NULL;
+  w->content.n = 0;
+  w->content.mapped = false;
+  w->content.allocator = NULL;
+  w->allocator = NULL;
+  w->error.type = empty;
+  w->error.text = empty;
+  w->units.distance = empty;
+  w->units.speed = empty;
+  w->units.temperature = empty;
+  w->units.rainfall = empty;
+  w->units.pressure = empty;
+  w->severe_weather_alert.text = empty;
+  w->severe_weather_alert.link = empty;
+  w->current_conditions.last_updated = empty;
+  w->current_conditions.temperature = empty;
+  w->current_conditions.dewpoint = empty;
+  w->current_conditions.text = empty;
+  w->current_conditions.icon = empty;
+  w->current_conditions.visibility = empty;
+  w->current_conditions.humidity = empty;
+  w->current_conditions.station = empty;
+  w->current_conditions.feels_like = empty;
+  w->current_conditions.moon_phase.text = empty;
+  w->current_conditions.uv.index = empty;
+  w->current_conditions.uv.text = empty;
+  w->current_conditions.barometer.direction = empty;
+  w->current_conditions.barometer.reading = empty;
   __init_wind (w->current_conditions.wind);
-  w->location.lat[0] = '\0';
-  w->location.lon[0] = '\0';
-  w->location.name[0] = '\0';
-
-  for (i = 0; i < WET_FORECAST_DAYS; ++i) {
-    w->forecasts[i].day_of_week[0] = '\0';
-    w->forecasts[i].high[0] = '\0';
-    w->forecasts[i].sunset[0] = '\0';
-    w->forecasts[i].low[0] = '\0';
-    w->forecasts[i].sunrise[0] = '\0';
-    w->forecasts[i].text[0] = '\0';
-    w->forecasts[i].chance_precip[0] = '\0';
-    w->forecasts[i].humidity[0] = '\0';
-    __init_wind (w->forecasts[i].wind);
-    w->forecasts[i].night.text[0] = '\0';
-    w->forecasts[i].night.chance_precip[0] = '\0';
-    w->forecasts[i].night.humidity[0] = '\0';
-    __init_wind (w->forecasts[i].night.wind);
-  }
+  w->location.lat = empty;
+  w->location.lon = empty;
+  w->location.name = empty;
+  w->location.zone = empty;
+  w->forecasts_updated = empty;
+
+  w->n_forecasts = 0;
+  w->forecasts = NULL;
+  w->values.forecasts = NULL;
 #undef __init_wind
 }
 
+/* Resolves "@LAT,LON" to the nearest location in the local index. */
+static bool
+locate_coordinates (char *id, const char *location, struct wet_error *err)
+{
+  double lat;
+  double lon;
+  struct wet_place place;
+
+  if (!wet_geo_parse_coordinates (location, &lat, &lon))
+    return wet_fail (err, WET_EOP,
+                     "invalid coordinates -- `%s' (expected @LAT,LON)",
+                     location);
+  if (!wet_geo_nearest (lat, lon, &place))
+    return wet_fail (err, WET_EWEATHER,
+                     "no known location near '%s' (look up a location by "
+                     "name first, or import a list with "
+                     "--import-locations)", location);
+  wet_debug ("nearest known location to %s: %s (%s)",
+             location, place.id, place.name);
+  snprintf (id, WET_DATA_MAX, "%s", place.id);
+  return true;
+}
+
+/* Adds the N QUERIES that were just searched for (and resolved to IDS)
+   to the name index, so they can be resolved locally next time. */
+static void
+remember_names (const char **queries, char **ids, size_t n)
+{
+  struct wet_name *names;
+  size_t i;
+
+  names = (struct wet_name *) malloc (n * sizeof (struct wet_name));
+  if (!names) {
+    wet_debug ("failed to update the name index");
+    return;
+  }
+  for (i = 0; i < n; ++i) {
+    snprintf (names[i].name, WET_NAME_MAX, "%s", queries[i]);
+    snprintf (names[i].id, WET_PLACE_ID_MAX, "%.*s", WET_PLACE_ID_MAX - 1,
+              ids[i]);
+  }
+  if (!wet_names_add (names, n))
+    wet_debug ("failed to update the name index");
+  free (names);
+}
+
+static const char *compass_points[] = {
+  "N", "NNE", "NE", "ENE", "E", "ESE", "SE", "SSE",
+  "S", "SSW", "SW", "WSW", "W", "WNW", "NW", "NNW", NULL
+};
+
+static const char *moon_phases[] = {
+  "New", "Waxing Crescent", "First Quarter", "Waxing Gibbous", "Full",
+  "Waning Gibbous", "Last Quarter", "Waning Crescent", NULL
+};
+
+static const char *trends[] = { "rising", "falling", "steady", NULL };
+
+/* UTC offsets (in minutes) of the zones observation times are given in */
+static const struct {
+  const char *name;
+  int offset;
+} zones[] = {
+  { "UTC", 0 }, { "GMT", 0 },
+  { "EST", -300 }, { "EDT", -240 },
+  { "CST", -360 }, { "CDT", -300 },
+  { "MST", -420 }, { "MDT", -360 },
+  { "PST", -480 }, { "PDT", -420 },
+  { "AKST", -540 }, { "AKDT", -480 },
+  { "HST", -600 },
+  { NULL, 0 }
+};
+
+/* The number in V, less OFFSET, times SCALE, as a fixed point value. */
+static int16_t
+fixed_value (struct wet_view v, double offset, double scale)
+{
+  double d;
+
+  if (!wet_view2double (v, &d))
+    return WET_NO_VALUE;
+  d = round ((d - offset) * scale);
+  if ((d <= WET_NO_VALUE) || (d >= WET_UNLIMITED))
+    return WET_NO_VALUE;
+  return (int16_t) d;
+}
+
+static uint8_t
+byte_value (struct wet_view v)
+{
+  double d;
+
+  if (!wet_view2double (v, &d) || (d < 0.0) || (d >= WET_NO_BYTE))
+    return WET_NO_BYTE;
+  return (uint8_t) round (d);
+}
+
+/* The position (from 1) of V in the null terminated NAMES, or 0. */
+static uint8_t
+name_index (struct wet_view v, const char **names)
+{
+  uint8_t i;
+
+  for (i = 0; names[i]; ++i)
+    if (wet_view_streqi (v, names[i]))
+      return i + 1;
+  return 0;
+}
+
+/* Days from 1970-01-01 to the (proleptic Gregorian) date Y-M-D. */
+static int64_t
+days_from_civil (int64_t y, int m, int d)
+{
+  int64_t era;
+  int64_t yoe;
+  int64_t doy;
+
+  y -= (m <= 2);
+  era = ((y >= 0) ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+  return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/* Reads a "9:15 AM" clock time at S as minutes after midnight. Returns
+   what follows it, or NULL if S does not start with one. */
+static const char *
+parse_clock (const char *s, int *minutes)
+{
+  int h;
+  int m;
+  int n;
+  char half[3];
+
+  n = 0;
+  if ((sscanf (s, "%d:%d %2s%n", &h, &m, half, &n) != 3) || (h < 1) ||
+      (h > 12) || (m < 0) || (m > 59))
+    return NULL;
+  h %= 12;
+  if ((half[0] == 'P') || (half[0] == 'p'))
+    h += 12;
+  *minutes = h * 60 + m;
+  return s + n;
+}
+
+/* Copies V into the null terminated BUFFER of SIZE bytes. */
+static bool
+view_text (char *buffer, size_t size, struct wet_view v)
+{
+  if (!v.n || (v.n >= size))
+    return false;
+  memcpy (buffer, v.p, v.n);
+  buffer[v.n] = '\0';
+  return true;
+}
+
+static int64_t
+clock_time (struct wet_view v, int64_t day, int offset)
+{
+  char buffer[32];
+  int minutes;
+
+  if (!view_text (buffer, sizeof (buffer), v) ||
+      !parse_clock (buffer, &minutes))
+    return WET_NO_TIME;
+  return day * 86400 + (int64_t) (minutes - offset) * 60;
+}
+
+/* Reads a "3/30/14 9:15 AM EDT" time stamp into the day it names (days
+   from the epoch) and the epoch time. Times in a zone that is not known
+   are taken to be at OFFSET minutes from UTC. */
+static bool
+parse_time_stamp (struct wet_view v, int offset, int64_t *day,
+                  int64_t *t)
+{
+  char buffer[64];
+  char zone[8];
+  const char *p;
+  int y;
+  int m;
+  int d;
+  int n;
+  int minutes;
+  size_t i;
+
+  n = 0;
+  if (!view_text (buffer, sizeof (buffer), v) ||
+      (sscanf (buffer, "%d/%d/%d %n", &m, &d, &y, &n) != 3) || !n ||
+      (m < 1) || (m > 12) || (d < 1) || (d > 31))
+    return false;
+  p = parse_clock (buffer + n, &minutes);
+  if (!p)
+    return false;
+  if (sscanf (p, "%7s", zone) == 1)
+    for (i = 0; zones[i].name; ++i)
+      if (wet_streqi (zone, zones[i].name))
+        offset = zones[i].offset;
+
+  *day = days_from_civil ((y < 100) ? 2000 + y : y, m, d);
+  *t = *day * 86400 + (int64_t) (minutes - offset) * 60;
+  return true;
+}
+
+static void
+fill_wind_values (struct __wind_values *values, const struct __wind *wind,
+                  double scale)
+{
+  values->speed = fixed_value (wind->speed, 0.0, scale);
+  values->gust = fixed_value (wind->gust, 0.0, scale);
+  values->direction = fixed_value (wind->direction, 0.0, 1.0);
+  if (wet_view_streqi (wind->text, "CALM") ||
+      wet_view_streqi (wind->speed, "calm")) {
+    values->compass = WET_COMPASS_CALM;
+    values->speed = 0;
+  } else if (wet_view_streqi (wind->text, "VAR"))
+    values->compass = WET_COMPASS_VARIABLE;
+  else
+    values->compass = name_index (wind->text, compass_points);
+}
+
+/* Fills the weather_values of W from the text fill_weather_struct() found,
+   in whatever units the document used. */
+static void
+fill_values (struct weather *w)
+{
+  struct weather_values *v;
+  double temperature_offset;
+  double temperature_scale;
+  double distance_scale;
+  double speed_scale;
+  double pressure_scale;
+  double zone;
+  int offset;
+  int64_t day;
+  int64_t t;
+  size_t i;
+
+  v = &w->values;
+  temperature_offset = 0.0;
+  temperature_scale = 10.0;
+  if (wet_view_streqi (w->units.temperature, "F")) {
+    temperature_offset = 32.0;
+    temperature_scale = 50.0 / 9.0;
+  }
+  distance_scale = 10.0;
+  if (wet_view_streqi (w->units.distance, "mi"))
+    distance_scale = 16.09344;
+  speed_scale = 10.0;
+  if (wet_view_streqi (w->units.speed, "mph"))
+    speed_scale = 16.09344;
+  pressure_scale = 10.0;
+  if (wet_view_streqi (w->units.pressure, "in"))
+    pressure_scale = 338.638866667;
+
+#define __temperature(__t) \
+  fixed_value (__t, temperature_offset, temperature_scale)
+
+  v->temperature = __temperature (w->current_conditions.temperature);
+  v->feels_like = __temperature (w->current_conditions.feels_like);
+  v->dewpoint = __temperature (w->current_conditions.dewpoint);
+  if (wet_view_streqi (w->current_conditions.visibility, "Unlimited"))
+    v->visibility = WET_UNLIMITED;
+  else
+    v->visibility =
+      fixed_value (w->current_conditions.visibility, 0.0, distance_scale);
+  v->pressure =
+    fixed_value (w->current_conditions.barometer.reading, 0.0,
+                 pressure_scale);
+  v->humidity = byte_value (w->current_conditions.humidity);
+  v->uv_index = byte_value (w->current_conditions.uv.index);
+  v->pressure_trend =
+    name_index (w->current_conditions.barometer.direction, trends);
+  v->moon_phase = name_index (w->current_conditions.moon_phase.text,
+                              moon_phases);
+  v->condition = byte_value (w->current_conditions.icon);
+  fill_wind_values (&v->wind, &w->current_conditions.wind, speed_scale);
+
+  /* the location's offset from UTC (in hours) is for local times that
+     have no zone of their own, like sunrise and sunset */
+  offset = wet_view2double (w->location.zone, &zone) ?
+           (int) round (zone * 60.0) : 0;
+  if (!parse_time_stamp (w->current_conditions.last_updated, offset, &day,
+                         &v->last_updated))
+    v->last_updated = WET_NO_TIME;
+  /* sunrise and sunset are given for the days from the one the forecasts
+     were issued on */
+  if (!parse_time_stamp (w->forecasts_updated, offset, &day, &t))
+    day = WET_NO_TIME;
+
+  for (i = 0; i < w->n_forecasts; ++i) {
+    v->forecasts[i].sunrise = WET_NO_TIME;
+    v->forecasts[i].sunset = WET_NO_TIME;
+    if (day != WET_NO_TIME) {
+      v->forecasts[i].sunrise =
+        clock_time (w->forecasts[i].sunrise, day + (int64_t) i, offset);
+      v->forecasts[i].sunset =
+        clock_time (w->forecasts[i].sunset, day + (int64_t) i, offset);
+    }
+    v->forecasts[i].high = __temperature (w->forecasts[i].high);
+    v->forecasts[i].low = __temperature (w->forecasts[i].low);
+    v->forecasts[i].chance_precip =
+      byte_value (w->forecasts[i].chance_precip);
+    v->forecasts[i].humidity = byte_value (w->forecasts[i].humidity);
+    v->forecasts[i].condition = byte_value (w->forecasts[i].icon);
+    fill_wind_values (&v->forecasts[i].wind, &w->forecasts[i].wind,
+                      speed_scale);
+    v->forecasts[i].night.chance_precip =
+      byte_value (w->forecasts[i].night.chance_precip);
+    v->forecasts[i].night.humidity =
+      byte_value (w->forecasts[i].night.humidity);
+    v->forecasts[i].night.condition =
+      byte_value (w->forecasts[i].night.icon);
+    fill_wind_values (&v->forecasts[i].night.wind,
+                      &w->forecasts[i].night.wind, speed_scale);
+  }
+
+#undef __temperature
+}
+
+/* Reports the error the weather server put in W's document. */
+static bool
+document_error (const struct weather *w, struct wet_error *err)
+{
+  if (!w->error.text.n)
+    return wet_fail (err, WET_ENET, "failed to retrieve weather data");
+  return wet_fail (err, WET_EWEATHER, "weather: %.*s",
+                   (int) w->error.text.n, w->error.text.p);
+}
+
+/* Looks up LOCATION and fills W with its weather and DAYS of forecasts
+   (fewer, if that is all the weather server has), converted into metric
+   units if METRIC, otherwise into imperial ones. Returns false, with ERR
+   saying why, if the location is unknown, the fetch failed or the
+   weather server answered with an error; W holds nothing to release
+   then. */
 bool
-wet_weather (struct weather *w, const char *location, bool metric)
+wet_weather (struct weather *w, const char *location, bool metric,
+             unsigned int days, const struct wet_allocator *allocator,
+             struct wet_error *err)
 {
+  char *id;
+
   init_weather_struct (w);
-  wet_net_get_location_id (w, location);
+  if (*location == '@') {
+    if (!locate_coordinates (w->location_id, location, err))
+      return false;
+  } else if (!wet_names_lookup (location, w->location_id, WET_DATA_MAX)) {
+    if (!wet_net_get_location_id (w, location, err))
+      return false;
+    if (*w->location_id) {
+      id = w->location_id;
+      remember_names (&location, &id, 1);
+    }
+  }
 
   if (!*w->location_id)
-    wet_die (WET_EWEATHER, "failed to find location '%s'", location);
+    return wet_fail (err, WET_EWEATHER, "failed to find location '%s'",
+                     location);
 
-  wet_net_get_weather_data (w, metric);
-  if (*w->error.type || *w->error.text)
+  if (!wet_net_get_weather_data (w, days, allocator, err))
     return false;
+  if (w->error.type.n || w->error.text.n) {
+    document_error (w, err);
+    wet_weather_release (w);
+    return false;
+  }
+  fill_values (w);
+  wet_weather_convert (w, metric);
+  return true;
+}
+
+/* Looks up the location IDs of all N LOCATIONS, writing them to the
+   WET_DATA_MAX sized buffers in IDS. Coordinates ("@LAT,LON") and names
+   that were resolved before come from the local indexes; the rest are
+   searched for all at once (the searches are pipelined over a single
+   connection). Returns false, with ERR saying why, if any of them
+   could not be found. */
+bool
+wet_weather_locate (char **ids, const char **locations, size_t n,
+                    struct wet_error *err)
+{
+  size_t i;
+  size_t n_queries;
+  char **query_ids;
+  const char **queries;
+  bool ok;
+
+  query_ids = (char **) malloc (n * sizeof (char *));
+  queries = (const char **) malloc (n * sizeof (const char *));
+  if (!query_ids || !queries) {
+    free (query_ids);
+    free (queries);
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  }
+
+  ok = true;
+  n_queries = 0;
+  for (i = 0; ok && (i < n); ++i) {
+    if (*locations[i] == '@')
+      ok = locate_coordinates (ids[i], locations[i], err);
+    else if (wet_names_lookup (locations[i], ids[i], WET_DATA_MAX))
+      wet_debug ("known location: %s (%s)", locations[i], ids[i]);
+    else {
+      query_ids[n_queries] = ids[i];
+      queries[n_queries++] = locations[i];
+    }
+  }
+  if (ok && n_queries) {
+    ok = wet_net_get_location_ids (query_ids, queries, n_queries, err);
+    if (ok)
+      remember_names (queries, query_ids, n_queries);
+  }
+  free (query_ids);
+  free (queries);
+
+  for (i = 0; ok && (i < n); ++i)
+    if (!*ids[i])
+      ok = wet_fail (err, WET_EWEATHER, "failed to find location '%s'",
+                     locations[i]);
+  return ok;
+}
+
+/* Fills W from the weather data document CONTENT, which was fetched for
+   LOCATION_ID, taking its forecasts from ALLOCATOR. W takes ownership of
+   CONTENT, since its fields point into it. Returns false, with ERR saying
+   what, if the document contained an error. */
+bool
+wet_weather_parse (struct weather *w, const char *location_id,
+                   struct wet_buffer *content,
+                   const struct wet_allocator *allocator,
+                   struct wet_error *err)
+{
+  init_weather_struct (w);
+  w->allocator = allocator;
+  strncpy (w->location_id, location_id, WET_DATA_MAX - 1);
+  w->content = *content;
+  if (!wet_net_parse_weather_data (w, content->p, content->n))
+    return wet_fail (err, WET_ESYS, "failed to allocate memory");
+  if (w->error.type.n || w->error.text.n)
+    return document_error (w, err);
+  fill_values (w);
   return true;
 }
 
+/* The fixed point value V (in tenths) as a number: NaN if it is unknown
+   (WET_NO_VALUE), +Inf if it is unlimited (WET_UNLIMITED). */
+double
+wet_weather_tenths (int16_t v)
+{
+  if (v == WET_NO_VALUE)
+    return NAN;
+  if (v == WET_UNLIMITED)
+    return INFINITY;
+  return v / 10.0;
+}
+
+/* V as a number, or NaN if it is unknown (WET_NO_BYTE). */
+double
+wet_weather_byte (uint8_t v)
+{
+  return (v == WET_NO_BYTE) ? NAN : (double) v;
+}
+
+/* Frees the document retained by W, and its forecasts. Its fields are
+   invalid afterwards. */
+void
+wet_weather_release (struct weather *w)
+{
+  wet_release (w->allocator, w->forecasts);
+  w->forecasts = NULL;
+  w->values.forecasts = NULL;
+  w->n_forecasts = 0;
+  wet_buffer_free (&w->content);
+}
+
+/* Whether CONTENT is a location search result rather than weather data
+   (both kinds can be replayed from a file). */
+bool
+wet_weather_is_search (const struct wet_buffer *content)
+{
+  size_t i;
+
+  /* skip the XML declaration and the copyright comment */
+  for (i = 0; i < content->n; ++i)
+    if ((content->p[i] == '<') && (i + 1 < content->n) &&
+        (content->p[i + 1] != '?') && (content->p[i + 1] != '!'))
+      break;
+  return (content->n - i > strlen ("<search")) &&
+         (memcmp (content->p + i, "<search", strlen ("<search")) == 0);
+}
+
+/* the unit names the weather data uses in each system */
+struct unit_system {
+  const char *temperature;
+  const char *distance;
+  const char *speed;
+  const char *pressure;
+  const char *rainfall;
+};
+
+static const struct unit_system imperial_units = {
+  "F", "mi", "mph", "in", "in"
+};
+
+static const struct unit_system metric_units = {
+  "C", "km", "km/h", "mb", "mm"
+};
+
+/* How to turn a value in one system into the other: (VALUE - OFFSET) *
+   SCALE + BIAS, rounded to DECIMALS places the way the weather data
+   itself would have been. */
+struct conversion {
+  double offset;
+  double scale;
+  double bias;
+  int decimals;
+};
+
+/* Replaces the number in V with its converted value, whose text goes
+   into W's conversion buffer. Anything that is not a number ("N/A",
+   "calm" and so on) is left alone. */
+static void
+convert_value (struct weather *w, struct wet_view *v,
+               const struct conversion *c)
+{
+  double d;
+  double p;
+  int n;
+  char *text;
+
+  if (!wet_view2double (*v, &d))
+    return;
+  p = pow (10.0, c->decimals);
+  d = round (((d - c->offset) * c->scale + c->bias) * p) / p;
+  if (d == 0.0)
+    d = 0.0; /* no "-0" */
+
+  text = w->converted.text + w->converted.len;
+  n = snprintf (text, WET_CONVERTED_MAX - w->converted.len, "%.*f",
+                c->decimals, d);
+  if (n < 0 || (size_t) n >= WET_CONVERTED_MAX - w->converted.len) {
+    /* cannot happen with the documents weather.com serves */
+    wet_debug ("too many values to convert");
+    return;
+  }
+  w->converted.len += n;
+  v->p = text;
+  v->n = n;
+}
+
+/* Converts every measurement in W into metric units if METRIC, otherwise
+   into imperial units. The weather data is always fetched in metric
+   units (so both kinds of user share one request), but a document read
+   with --from-file may be in either; the units W reports say which. */
+void
+wet_weather_convert (struct weather *w, bool metric)
+{
+  static const struct conversion c2f = { 0.0, 9.0 / 5.0, 32.0, 0 };
+  static const struct conversion f2c = { 32.0, 5.0 / 9.0, 0.0, 0 };
+  static const struct conversion km2mi = { 0.0, 1.0 / 1.609344, 0.0, 1 };
+  static const struct conversion mi2km = { 0.0, 1.609344, 0.0, 1 };
+  static const struct conversion kmh2mph = { 0.0, 1.0 / 1.609344, 0.0, 0 };
+  static const struct conversion mph2kmh = { 0.0, 1.609344, 0.0, 0 };
+  static const struct conversion mb2in = { 0.0, 1.0 / 33.8638866667, 0.0, 2 };
+  static const struct conversion in2mb = { 0.0, 33.8638866667, 0.0, 1 };
+  const struct unit_system *to;
+  const struct unit_system *from;
+  const struct conversion *c;
+  size_t i;
+
+  to = metric ? &metric_units : &imperial_units;
+  from = metric ? &imperial_units : &metric_units;
+  w->converted.len = 0;
+
+#define __convert_wind(__w) \
+  do { \
+    convert_value (w, &__w.speed, c); \
+    convert_value (w, &__w.gust, c); \
+  } while (0)
+
+  if (wet_view_streqi (w->units.temperature, from->temperature)) {
+    c = metric ? &f2c : &c2f;
+    convert_value (w, &w->current_conditions.temperature, c);
+    convert_value (w, &w->current_conditions.feels_like, c);
+    convert_value (w, &w->current_conditions.dewpoint, c);
+    for (i = 0; i < w->n_forecasts; ++i) {
+      convert_value (w, &w->forecasts[i].high, c);
+      convert_value (w, &w->forecasts[i].low, c);
+    }
+    w->units.temperature.p = to->temperature;
+    w->units.temperature.n = strlen (to->temperature);
+  }
+
+  if (wet_view_streqi (w->units.distance, from->distance)) {
+    c = metric ? &mi2km : &km2mi;
+    convert_value (w, &w->current_conditions.visibility, c);
+    w->units.distance.p = to->distance;
+    w->units.distance.n = strlen (to->distance);
+  }
+
+  if (wet_view_streqi (w->units.speed, from->speed)) {
+    c = metric ? &mph2kmh : &kmh2mph;
+    __convert_wind (w->current_conditions.wind);
+    for (i = 0; i < w->n_forecasts; ++i) {
+      __convert_wind (w->forecasts[i].wind);
+      __convert_wind (w->forecasts[i].night.wind);
+    }
+    w->units.speed.p = to->speed;
+    w->units.speed.n = strlen (to->speed);
+  }
+
+  if (wet_view_streqi (w->units.pressure, from->pressure)) {
+    c = metric ? &in2mb : &mb2in;
+    convert_value (w, &w->current_conditions.barometer.reading, c);
+    w->units.pressure.p = to->pressure;
+    w->units.pressure.n = strlen (to->pressure);
+    /* the pressure is shown with the rainfall unit */
+    w->units.rainfall.p = to->rainfall;
+    w->units.rainfall.n = strlen (to->rainfall);
+  }
+
+#undef __convert_wind
+}
@@ -20,92 +20,228 @@
 #ifndef WET_WEATHER_H
 #define WET_WEATHER_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "wet.h"
+#include "wet-util.h"
 
-#define WET_FORECAST_DAYS 5
+/* how many days of forecast are fetched unless asked otherwise, and the
+   most that can be asked for */
+#define WET_FORECAST_DAYS     5
+#define WET_FORECAST_DAYS_MAX 10
 #define WET_DATA_MAX   1024
+#define WET_CONVERTED_MAX 1024
+
+/* "no value" markers for the fields of struct weather_values */
+#define WET_NO_VALUE  INT16_MIN
+#define WET_UNLIMITED INT16_MAX
+#define WET_NO_BYTE   UINT8_MAX
+#define WET_NO_TIME   INT64_MIN
+
+enum wet_compass {
+  WET_COMPASS_UNKNOWN,
+  WET_COMPASS_N,
+  WET_COMPASS_NNE,
+  WET_COMPASS_NE,
+  WET_COMPASS_ENE,
+  WET_COMPASS_E,
+  WET_COMPASS_ESE,
+  WET_COMPASS_SE,
+  WET_COMPASS_SSE,
+  WET_COMPASS_S,
+  WET_COMPASS_SSW,
+  WET_COMPASS_SW,
+  WET_COMPASS_WSW,
+  WET_COMPASS_W,
+  WET_COMPASS_WNW,
+  WET_COMPASS_NW,
+  WET_COMPASS_NNW,
+  WET_COMPASS_VARIABLE,
+  WET_COMPASS_CALM
+};
+
+enum wet_moon_phase {
+  WET_MOON_UNKNOWN,
+  WET_MOON_NEW,
+  WET_MOON_WAXING_CRESCENT,
+  WET_MOON_FIRST_QUARTER,
+  WET_MOON_WAXING_GIBBOUS,
+  WET_MOON_FULL,
+  WET_MOON_WANING_GIBBOUS,
+  WET_MOON_LAST_QUARTER,
+  WET_MOON_WANING_CRESCENT
+};
+
+enum wet_trend {
+  WET_TREND_UNKNOWN,
+  WET_TREND_RISING,
+  WET_TREND_FALLING,
+  WET_TREND_STEADY
+};
+
+struct __wind_values {
+  int16_t speed;     /* tenths of km/h */
+  int16_t gust;      /* tenths of km/h */
+  int16_t direction; /* degrees */
+  uint8_t compass;   /* enum wet_compass */
+};
+
+struct weather_forecast_values {
+  int64_t sunrise;       /* seconds since the epoch */
+  int64_t sunset;        /* seconds since the epoch */
+  int16_t high;          /* tenths of ºC */
+  int16_t low;           /* tenths of ºC */
+  uint8_t chance_precip; /* percent */
+  uint8_t humidity;      /* percent */
+  uint8_t condition;
+  struct __wind_values wind;
+
+  struct {
+    uint8_t chance_precip;
+    uint8_t humidity;
+    uint8_t condition;
+    struct __wind_values wind;
+  } night;
+};
+
+/* The measurements of a weather data document as numbers, always in
+   metric units whatever the document used, so nothing downstream has to
+   parse text. Fixed point values are in tenths; a field that the
+   document did not give holds the WET_NO_* marker for its type.
+   Conditions are weather.com condition (icon) codes. */
+struct weather_values {
+  int64_t last_updated;    /* seconds since the epoch */
+  int16_t temperature;     /* tenths of ºC */
+  int16_t feels_like;      /* tenths of ºC */
+  int16_t dewpoint;        /* tenths of ºC */
+  int16_t visibility;      /* tenths of km, or WET_UNLIMITED */
+  int16_t pressure;        /* tenths of mb */
+  uint8_t humidity;        /* percent */
+  uint8_t uv_index;
+  uint8_t pressure_trend;  /* enum wet_trend */
+  uint8_t moon_phase;      /* enum wet_moon_phase */
+  uint8_t condition;
+  struct __wind_values wind;
+  /* one for each of the weather's forecasts (see struct weather) */
+  struct weather_forecast_values *forecasts;
+};
 
 struct __wind {
-  char gust[WET_DATA_MAX];
-  char direction[WET_DATA_MAX];
-  char speed[WET_DATA_MAX];
-  char text[WET_DATA_MAX];
+  struct wet_view gust;
+  struct wet_view direction;
+  struct wet_view speed;
+  struct wet_view text;
+};
+
+struct weather_forecast {
+  struct wet_view day_of_week;
+  struct wet_view high;
+  struct wet_view sunset;
+  struct wet_view low;
+  struct wet_view sunrise;
+  struct wet_view text;
+  struct wet_view icon;
+  struct wet_view chance_precip;
+  struct wet_view humidity;
+  struct __wind wind;
+
+  struct {
+    struct wet_view text;
+    struct wet_view icon;
+    struct wet_view chance_precip;
+    struct wet_view humidity;
+    struct __wind wind;
+  } night;
 };
 
+/* Apart from location_id and values, every field is a view into content
+   (the retained weather data document), so none of them are null
+   terminated. The exception is values that wet_weather_convert() has
+   converted to other units: their text is kept in converted. There are
+   as many forecasts as the document had days (its own and their values
+   are taken from allocator, which need not be content's), but always at
+   least one, so today's can be read without checking: a document
+   without any gets a single day of unknown values. */
 struct weather {
   char location_id[WET_DATA_MAX];
+  struct wet_buffer content;
+  const struct wet_allocator *allocator;
+  struct weather_values values;
 
   struct {
-    char type[WET_DATA_MAX];
-    char text[WET_DATA_MAX];
+    char text[WET_CONVERTED_MAX];
+    size_t len;
+  } converted;
+
+  struct {
+    struct wet_view type;
+    struct wet_view text;
   } error;
 
   struct {
-    char distance[WET_DATA_MAX];
-    char speed[WET_DATA_MAX];
-    char temperature[WET_DATA_MAX];
-    char rainfall[WET_DATA_MAX];
-    char pressure[WET_DATA_MAX];
+    struct wet_view distance;
+    struct wet_view speed;
+    struct wet_view temperature;
+    struct wet_view rainfall;
+    struct wet_view pressure;
   } units;
 
   struct {
-    char text[WET_DATA_MAX];
-    char link[WET_DATA_MAX];
+    struct wet_view text;
+    struct wet_view link;
   } severe_weather_alert;
 
   struct {
-    char last_updated[WET_DATA_MAX];
-    char temperature[WET_DATA_MAX];
-    char dewpoint[WET_DATA_MAX];
-    char text[WET_DATA_MAX];
-    char visibility[WET_DATA_MAX];
-    char humidity[WET_DATA_MAX];
-    char station[WET_DATA_MAX];
-    char feels_like[WET_DATA_MAX];
+    struct wet_view last_updated;
+    struct wet_view temperature;
+    struct wet_view dewpoint;
+    struct wet_view text;
+    struct wet_view icon;
+    struct wet_view visibility;
+    struct wet_view humidity;
+    struct wet_view station;
+    struct wet_view feels_like;
     struct __wind wind;
 
     struct {
-      char text[WET_DATA_MAX];
+      struct wet_view text;
     } moon_phase;
 
     struct {
-      char index[WET_DATA_MAX];
-      char text[WET_DATA_MAX];
+      struct wet_view index;
+      struct wet_view text;
     } uv;
 
     struct {
-      char direction[WET_DATA_MAX];
-      char reading[WET_DATA_MAX];
+      struct wet_view direction;
+      struct wet_view reading;
     } barometer;
   } current_conditions;
 
   struct {
-    char lat[WET_DATA_MAX];
-    char lon[WET_DATA_MAX];
-    char name[WET_DATA_MAX];
+    struct wet_view lat;
+    struct wet_view lon;
+    struct wet_view name;
+    struct wet_view zone;
   } location;
 
-  struct {
-    char day_of_week[WET_DATA_MAX];
-    char high[WET_DATA_MAX];
-    char sunset[WET_DATA_MAX];
-    char low[WET_DATA_MAX];
-    char sunrise[WET_DATA_MAX];
-    char text[WET_DATA_MAX];
-    char chance_precip[WET_DATA_MAX];
-    char humidity[WET_DATA_MAX];
-    struct __wind wind;
-
-    struct {
-      char text[WET_DATA_MAX];
-      char chance_precip[WET_DATA_MAX];
-      char humidity[WET_DATA_MAX];
-      struct __wind wind;
-    } night;
-  } forecasts[WET_FORECAST_DAYS];
+  /* when the forecasts were issued */
+  struct wet_view forecasts_updated;
+  size_t n_forecasts;
+  struct weather_forecast *forecasts;
 };
 
-bool wet_weather (struct weather *, const char *, bool);
+bool wet_weather (struct weather *, const char *, bool, unsigned int,
+                  const struct wet_allocator *, struct wet_error *);
+bool wet_weather_locate (char **, const char **, size_t, struct wet_error *);
+bool wet_weather_parse (struct weather *, const char *, struct wet_buffer *,
+                        const struct wet_allocator *, struct wet_error *);
+bool wet_weather_is_search (const struct wet_buffer *);
+void wet_weather_convert (struct weather *, bool);
+double wet_weather_tenths (int16_t);
+double wet_weather_byte (uint8_t);
+void wet_weather_release (struct weather *);
 
 #endif /* WET_WEATHER_H */
 
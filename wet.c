@@ -17,11 +17,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <ctype.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
+#include "libwet.h"
 #include "wet.h"
+#include "wet-arena.h"
+#include "wet-batch.h"
+#include "wet-display.h"
+#include "wet-geo.h"
+#include "wet-history.h"
+#include "wet-metrics.h"
+#include "wet-names.h"
+#include "wet-net.h"
+#include "wet-pool.h"
+#include "wet-record.h"
+#include "wet-rules.h"
+#include "wet-template.h"
 #include "wet-util.h"
 #include "wet-weather.h"
 
@@ -29,15 +44,19 @@
 #define HELP_COMMAND_LEAD_SPACES 1
 #define HELP_TEXT_LEAD_SPACES    4
 
-#define DAYMASK 0
-#define DAY0    (1 << 1)
-#define DAY1    (1 << 2)
-#define DAY2    (1 << 3)
-#define DAY3    (1 << 4)
-#define DAY4    (1 << 5)
-#define DAYALL  (1 << 6)
+/* the forecast days asked for, as a bitmask: DAY (0) is today */
+#define DAYMASK   0
+#define DAYALL    1
+#define DAY(__n)  (1 << ((__n) + 1))
 
-const char *program_name;
+#define HISTORY_ALL    0
+#define HISTORY_HOURLY 1
+#define HISTORY_DAILY  2
+
+#define SECONDS_PER_DAY 86400L
+
+/* the arguments for printing a struct wet_view with "%.*s" */
+#define __v(__x) (int) (__x).n, (__x).p
 
 /* main options given after program invocation */
 static const char *main_command_options[] = {
@@ -45,6 +64,9 @@ static const char *main_command_options[] = {
   "loc",
   "fc",
   "severe",
+  "history",
+  "serve-metrics",
+  "batch",
   "imperial",
   "metric",
   "help",
@@ -90,7 +112,12 @@ static const char *loc_options[] = {
   "2", "tomorrow", \
   "3", \
   "4", \
-  "5"
+  "5", \
+  "6", \
+  "7", \
+  "8", \
+  "9", \
+  "10"
 
 /* specific day options for "fc" command */
 static const char *fc_day_options[] = {
@@ -116,6 +143,24 @@ static const char *fc_options[] = {
 
 #undef __FC_DAY_OPTS
 
+/* options for "history" command */
+static const char *history_options[] = {
+  "temp",
+  "dewpoint",
+  "humidity",
+  "pressure",
+  "wind",
+  "gust",
+  "visibility",
+  "hourly",
+  "daily",
+  "day",
+  "week",
+  "month",
+  "year",
+  NULL
+};
+
 /* options for forecast_daypart_options */
 static const char *fc_night_options[] = {
   "text",
@@ -125,66 +170,74 @@ static const char *fc_night_options[] = {
   NULL
 };
 
-static char *location = NULL;
+static const char **locations = NULL;
+static size_t n_locations = 0;
+static const char **replay_files = NULL;
+static size_t n_replay_files = 0;
 static bool metric = true;
-static bool default_display = false;
-static struct weather w;
-
-/* make this an almost mirror image of struct weather */
-static struct {
-  bool location_id;
-  bool severe_weather_alert;
-
-  struct {
-    bool all;
-    bool last_updated;
-    bool temperature;
-    bool dewpoint;
-    bool text;
-    bool visibility;
-    bool humidity;
-    bool station;
-    bool feels_like;
-    bool wind;
-    bool moon_phase;
-    bool uv;
-    bool barometer;
-  } current_conditions;
-
-  struct {
-    bool all;
-    bool lat;
-    bool lon;
-    bool name;
-  } location;
-
-  struct {
-    bool all;
-    bool day_of_week;
-    bool high;
-    bool sunset;
-    bool low;
-    bool sunrise;
-    bool text;
-    bool chance_precip;
-    bool humidity;
-    bool wind;
-
-    struct {
-      bool all;
-      bool text;
-      bool chance_precip;
-      bool humidity;
-      bool wind;
-    } night;
-  } forecasts[WET_FORECAST_DAYS];
-} x;
+static char **location_ids = NULL;
+static struct wet_place *seen_places = NULL;
+static bool record_history = false;
+static bool show_history = false;
+static int history_bucket = HISTORY_ALL;
+static long history_window = 0;
+static bool history_columns[WET_HISTORY_COLUMNS];
+static time_t fetch_time;
+static const char *rules_file = NULL;
+static struct wet_rules *rules = NULL;
+static const char *format_string = NULL;
+static struct wet_template *output_template = NULL;
+static const char *batch_source = NULL;
+static struct wet_batch_options batch = {
+  WET_BATCH_WINDOW, false, false, true, 1, NULL, NULL
+};
+static bool batch_options_given = false;
+static bool serve_metrics = false;
+static const char *metrics_listen = WET_METRICS_LISTEN;
+static unsigned int metrics_interval = WET_METRICS_INTERVAL;
+static size_t n_seen_places = 0;
+/* how many days of forecasts are fetched, and whether --days set it */
+static unsigned int forecast_days = 1;
+static bool forecast_days_given = false;
+
+/* a fetched weather data document waiting to be parsed and rendered */
+struct render_job {
+  size_t index;
+  const char *location_id;
+  struct wet_buffer content;
+};
+
+/* what a pool worker parses a job with, taken from its private arena
+   along with the forecasts of the weather, and gone with the arena's
+   next reset */
+struct renderer {
+  struct wet_context ctx;
+  struct weather w;
+};
+
+/* the rendered output for one location, waiting for its turn */
+struct rendering {
+  bool failed;
+  char *text;
+  size_t len;
+  struct wet_error error;
+  struct wet_place place;
+};
+
+static struct wet_display x;
+
+/* jobs and renderings come and go once per location, so they are
+   recycled rather than freed */
+static struct wet_slab job_slab =
+  WET_SLAB_INITIALIZER (sizeof (struct render_job), 256);
+static struct wet_slab rendering_slab =
+  WET_SLAB_INITIALIZER (sizeof (struct rendering), 256);
 
 static void
 usage (bool error)
 {
   fprintf ((!error) ? stdout : stderr,
-           "Usage: %s COMMAND [OPTION] [LOCATION]\n",
+           "Usage: %s COMMAND [OPTION] [LOCATION...]\n",
            program_name);
 }
 
@@ -275,6 +328,26 @@ help (const char *command, const char *option1)
     print_help_cmd ("loc", "Shows information about LOCATION.");
     print_help_cmd ("fc", "Shows forecast predictions.");
     print_help_cmd ("severe", "Shows severe weather alert (if any)");
+    print_help_cmd ("history",
+                    "Summarizes the observations recorded locally for "
+                    "LOCATION (use `%s help history' for its options).",
+                    program_name);
+    print_help_cmd ("serve-metrics",
+                    "Serves the current conditions of every LOCATION as "
+                    "OpenMetrics gauges at /metrics, refreshed in the "
+                    "background every `--interval SECONDS' (default %d) "
+                    "and listening on `--listen [ADDRESS:]PORT' (default "
+                    WET_METRICS_LISTEN ").",
+                    WET_METRICS_INTERVAL);
+    print_help_cmd ("batch SOURCE [COMMAND]",
+                    "Reads location queries from SOURCE (`-' for standard "
+                    "input), one per line, and shows each as COMMAND "
+                    "would (or as `--format-string' says) as it is "
+                    "fetched, keeping at most `--window SIZE' (default %d) "
+                    "of them in flight. Results come in input order unless "
+                    "`--unordered' is given; `--ndjson' writes each as a "
+                    "JSON object on a line of its own instead.",
+                    WET_BATCH_WINDOW);
     print_help_cmd ("imperial",
                     "Causes all measurements to use imperial units "
                     "(farenheit, miles, etc.)");
@@ -288,6 +361,39 @@ help (const char *command, const char *option1)
                     program_name);
     print_help_cmd ("version",
                     "Shows the version information of this program.");
+    print_help_cmd ("--from-file PATH",
+                    "Reads a previously saved weather data (or location "
+                    "search) document from PATH instead of fetching one. "
+                    "Use `-' for standard input. May be given more than "
+                    "once; no LOCATION is needed.");
+    print_help_cmd ("--import-locations PATH",
+                    "Adds the locations listed in PATH (one `ID LATITUDE "
+                    "LONGITUDE NAME' per line) to the local index used to "
+                    "resolve @LAT,LON, then exits.");
+    print_help_cmd ("--complete PREFIX",
+                    "Lists the ID and name of every location name already "
+                    "known locally that starts with PREFIX, then exits. "
+                    "Names wet has resolved before are never searched for "
+                    "again.");
+    print_help_cmd ("--record DIR",
+                    "Appends every raw HTTP request, response header and "
+                    "body exchanged with the server, each with a monotonic "
+                    "timestamp, to a recording in DIR.");
+    print_help_cmd ("--days DAYS",
+                    "Fetches DAYS (1-%d) days of forecasts, instead of only "
+                    "as many as the command shows (%d for `fc all').",
+                    WET_FORECAST_DAYS_MAX, WET_FORECAST_DAYS);
+    print_help_cmd ("--rules PATH",
+                    "Checks every location against the rules in PATH (one "
+                    "`NAME: FIELD OP NUMBER [and ...]' per line, in the "
+                    "units measurements would be shown in) and shows only "
+                    "the matches: the location ID, rule name and location "
+                    "name, separated by tabs.");
+    print_help_cmd ("--format-string TEMPLATE",
+                    "Shows each location as one line of TEMPLATE, with "
+                    "every `{FIELD}' in it replaced by that field, e.g. "
+                    "`{loc.name}: {cc.temp}º{units.temp} {cc.text}'. See "
+                    "the manual for the fields.");
     print_separator ();
     print_text (0, false,
                 "If no option commands are given, a default set of basic "
@@ -402,21 +508,46 @@ help (const char *command, const char *option1)
     return;
   }
 
+  if (wet_streqi (command, "history")) {
+    if (option1)
+      wet_die (WET_EOP, "use `%s help history' for all `history' options",
+               program_name);
+    wet_puts ("Weather Tool (" WET_VERSION ") History Options\n");
+    print_separator ();
+    print_text (0, false,
+                "Observations are only recorded while the WET_HISTORY "
+                "environment variable is set. For each quantity, the number "
+                "of samples, the minimum, mean, median, 95th percentile and "
+                "maximum are shown.");
+    wet_putc ('\n');
+    print_help_cmd ("history [temp|dewpoint|humidity|pressure|wind|gust|"
+                    "visibility]",
+                    "Shows only the given quantities (all of them if none "
+                    "are given).");
+    print_help_cmd ("history [hourly|daily]",
+                    "Summarizes each hour or day (local time) separately "
+                    "instead of the whole period.");
+    print_help_cmd ("history [day|week|month|year]",
+                    "Only uses the observations of the last day, 7 days, 30 "
+                    "days or 365 days.");
+    print_separator ();
+    return;
+  }
+
   if (wet_streqi (command, "fc")) {
     if (option1) {
-      if (wet_streqi (option1, "1") || wet_streqi (option1, "2") ||
-          wet_streqi (option1, "3") || wet_streqi (option1, "4") ||
-          wet_streqi (option1, "5") || wet_streqi (option1, "today") ||
+      if ((wet_str2int (option1) > 0) || wet_streqi (option1, "today") ||
           wet_streqi (option1, "tomorrow"))
-        print_help_cmd ("fc [1-5|today|tomorrow]",
-                        "Shows forecast data for a specific day out of a "
-                        "5 day forecast (1=today, 2=tomorrow, etc.). If this "
-                        "option is not given, only the forecast data for "
-                        "today will be used.");
+        print_help_cmd ("fc [1-10|today|tomorrow]",
+                        "Shows forecast data for a specific day "
+                        "(1=today, 2=tomorrow, etc.); the forecast is only "
+                        "fetched up to the last day given. If this option "
+                        "is not given, only the forecast data for today "
+                        "will be used.");
       else if (wet_streqi (option1, "all"))
         print_help_cmd ("fc all",
-                        "Shows forecast data for all days in the 5 day "
-                        "forecast.");
+                        "Shows forecast data for all days of a %d day "
+                        "forecast (see `--days').", WET_FORECAST_DAYS);
       else if (wet_streqi (option1, "dow"))
         print_help_cmd ("fc dow",
                         "Shows the name for the day of the week of the "
@@ -455,14 +586,14 @@ help (const char *command, const char *option1)
     }
     wet_puts ("Weather Tool (" WET_VERSION ") Forecast Options\n");
     print_separator ();
-    print_help_cmd ("fc [1-5|today|tomorrow]",
-                    "Shows forecast data for a specific day out of a 5 day "
-                    "forecast (1=today, 2=tomorrow, etc.). If this option "
-                    "is not given, only the forecast data for today will be "
-                    "used.");
+    print_help_cmd ("fc [1-10|today|tomorrow]",
+                    "Shows forecast data for a specific day (1=today, "
+                    "2=tomorrow, etc.); the forecast is only fetched up to "
+                    "the last day given. If this option is not given, only "
+                    "the forecast data for today will be used.");
     print_help_cmd ("fc all",
-                    "Shows forecast data for all days in the 5 day "
-                    "forecast.");
+                    "Shows forecast data for all days of a %d day forecast "
+                    "(see `--days').", WET_FORECAST_DAYS);
     print_help_cmd ("fc dow",
                     "Shows the name for the day of the week of the forecast "
                     "day.");
@@ -494,51 +625,6 @@ version (void)
   exit (WET_ESUCCESS);
 }
 
-static void
-init_display_opts (void)
-{
-  int i;
-
-  x.severe_weather_alert = false;
-
-  x.current_conditions.all = false;
-  x.current_conditions.last_updated = false;
-  x.current_conditions.temperature = false;
-  x.current_conditions.dewpoint = false;
-  x.current_conditions.text = false;
-  x.current_conditions.visibility = false;
-  x.current_conditions.humidity = false;
-  x.current_conditions.station = false;
-  x.current_conditions.feels_like = false;
-  x.current_conditions.moon_phase = false;
-  x.current_conditions.uv = false;
-  x.current_conditions.barometer = false;
-  x.current_conditions.wind = false;
-
-  x.location.all = false;
-  x.location.lat = false;
-  x.location.lon = false;
-  x.location.name = false;
-
-  for (i = 0; i < WET_FORECAST_DAYS; ++i) {
-    x.forecasts[i].all = false;
-    x.forecasts[i].day_of_week = false;
-    x.forecasts[i].high = false;
-    x.forecasts[i].sunset = false;
-    x.forecasts[i].low = false;
-    x.forecasts[i].sunrise = false;
-    x.forecasts[i].text = false;
-    x.forecasts[i].chance_precip = false;
-    x.forecasts[i].humidity = false;
-    x.forecasts[i].wind = false;
-    x.forecasts[i].night.all = false;
-    x.forecasts[i].night.text = false;
-    x.forecasts[i].night.chance_precip = false;
-    x.forecasts[i].night.humidity = false;
-    x.forecasts[i].night.wind = false;
-  }
-}
-
 #define __is_option_func_body(__o, __a) \
   size_t __i; \
   for (__i = 0; __a[__i]; ++__i) \
@@ -570,6 +656,12 @@ is_fc_option (const char *opt)
   __is_option_func_body (opt, fc_options);
 }
 
+static bool
+is_history_option (const char *opt)
+{
+  __is_option_func_body (opt, history_options);
+}
+
 static bool
 is_fc_day_option (const char *opt)
 {
@@ -589,15 +681,23 @@ find_wanted_location (int *c, char **v)
 {
   size_t i;
   size_t j;
+  bool history;
+
+  /* there can never be more locations than arguments */
+  locations = (const char **) malloc (*c * sizeof (const char *));
+  if (!locations)
+    wet_die (WET_ESYS, "failed to allocate memory");
 
+  /* words like `day' are only options to `history'; elsewhere they are
+     locations */
+  history = v[1] && wet_streqi (v[1], "history");
   for (i = 1; v[i]; ++i) {
     if (is_main_command_option (v[i]) || is_cc_option (v[i]) ||
         is_loc_option (v[i]) || is_fc_option (v[i]) ||
-        is_fc_night_option (v[i]))
+        is_fc_night_option (v[i]) ||
+        (history && is_history_option (v[i])))
       continue;
-    if (location)
-      wet_die (WET_ELOC, "too many location arguments given");
-    location = v[i];
+    locations[n_locations++] = v[i];
     /* remove the location argument from the array */
     *c -= 1;
     for (j = i; v[j]; ++j)
@@ -605,13 +705,234 @@ find_wanted_location (int *c, char **v)
     i--;
   }
 
-  if (!location)
-    location = wet_getenv ("WET_LOCATION");
+  if (!n_locations) {
+    locations[0] = wet_getenv ("WET_LOCATION");
+    if (locations[0] && *locations[0])
+      n_locations = 1;
+  }
 
-  if (!location || !*location)
+  if (!n_locations)
     wet_die (WET_ELOC, "no location given and WET_LOCATION not set");
 }
 
+static void
+find_wanted_replay_files (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+
+  replay_files = (const char **) malloc (*c * sizeof (const char *));
+  if (!replay_files)
+    wet_die (WET_ESYS, "failed to allocate memory");
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--from-file"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--from-file' requires a PATH argument");
+    replay_files[n_replay_files++] = v[i + 1];
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
+/* Imports the --import-locations list (if one was given) and exits. */
+static void
+find_wanted_import_file (char **v)
+{
+  size_t i;
+  struct wet_error err;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--import-locations"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--import-locations' requires a PATH argument");
+    if (!wet_geo_import (v[i + 1], &err))
+      wet_die_error (&err);
+    exit (WET_ESUCCESS);
+  }
+}
+
+static void
+print_completion (const char *name, const char *id, void *arg)
+{
+  wet_puts ("%s\t%s\n", id, name);
+}
+
+/* Lists the known names starting with the --complete PREFIX (if one was
+   given) and exits. */
+static void
+find_wanted_completion (char **v)
+{
+  size_t i;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--complete"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--complete' requires a PREFIX argument");
+    if (!wet_names_complete (v[i + 1], print_completion, NULL))
+      exit (WET_ELOC);
+    exit (WET_ESUCCESS);
+  }
+}
+
+static void
+find_wanted_record_dir (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+  struct wet_error err;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--record"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--record' requires a DIR argument");
+    if (wet_record_enabled ())
+      wet_die (WET_EOP, "`--record' given more than once");
+    if (!wet_record_open (v[i + 1], &err))
+      wet_die_error (&err);
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
+static void
+find_wanted_rules_file (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--rules"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--rules' requires a PATH argument");
+    if (rules_file)
+      wet_die (WET_EOP, "`--rules' given more than once");
+    rules_file = v[i + 1];
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
+static void
+find_wanted_format_string (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--format-string"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--format-string' requires a TEMPLATE argument");
+    if (format_string)
+      wet_die (WET_EOP, "`--format-string' given more than once");
+    format_string = v[i + 1];
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
+/* Takes `batch SOURCE' off the front of the arguments, leaving the
+   command (if any) that says how to show each location. */
+static void
+find_wanted_batch_source (int *c, char **v)
+{
+  size_t j;
+
+  if (!v[1] || !wet_streqi (v[1], "batch"))
+    return;
+  if (!v[2])
+    wet_die (WET_EOP, "`batch' requires a SOURCE argument (`-' for "
+             "standard input)");
+  batch_source = v[2];
+  *c -= 2;
+  for (j = 1; v[j + 1]; ++j)
+    v[j] = v[j + 2];
+}
+
+static void
+find_wanted_batch_options (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+  size_t n;
+  long window;
+  char *end;
+
+  for (i = 1; v[i]; ++i) {
+    n = 1;
+    if (wet_streq (v[i], "--window")) {
+      if (!v[i + 1])
+        wet_die (WET_EOP, "`--window' requires a SIZE argument");
+      window = strtol (v[i + 1], &end, 10);
+      if ((end == v[i + 1]) || *end || (window < 1) ||
+          (window > WET_BATCH_WINDOW_MAX))
+        wet_die (WET_EOP, "invalid `--window' -- `%s' (1-%d)", v[i + 1],
+                 WET_BATCH_WINDOW_MAX);
+      batch.window = (size_t) window;
+      n = 2;
+    } else if (wet_streq (v[i], "--unordered"))
+      batch.unordered = true;
+    else if (wet_streq (v[i], "--ndjson"))
+      batch.ndjson = true;
+    else
+      continue;
+    batch_options_given = true;
+    /* remove the option (and its argument) from the array */
+    *c -= n;
+    for (j = i; v[j + n - 1]; ++j)
+      v[j] = v[j + n];
+    i--;
+  }
+}
+
+static void
+find_wanted_metrics_options (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+  long n;
+  char *end;
+
+  for (i = 1; v[i]; ++i) {
+    if (wet_streq (v[i], "--listen")) {
+      if (!v[i + 1])
+        wet_die (WET_EOP, "`--listen' requires an [ADDRESS:]PORT argument");
+      metrics_listen = v[i + 1];
+    } else if (wet_streq (v[i], "--interval")) {
+      if (!v[i + 1])
+        wet_die (WET_EOP, "`--interval' requires a SECONDS argument");
+      n = strtol (v[i + 1], &end, 10);
+      if ((end == v[i + 1]) || *end || (n < 1) || (n > 86400))
+        wet_die (WET_EOP, "invalid `--interval' -- `%s'", v[i + 1]);
+      metrics_interval = (unsigned int) n;
+    } else
+      continue;
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
 static void
 find_wanted_units (int *c, char **v)
 {
@@ -651,6 +972,34 @@ find_wanted_units (int *c, char **v)
   }
 }
 
+static void
+find_wanted_days (int *c, char **v)
+{
+  size_t i;
+  size_t j;
+  long n;
+  char *end;
+
+  for (i = 1; v[i]; ++i) {
+    if (!wet_streq (v[i], "--days"))
+      continue;
+    if (!v[i + 1])
+      wet_die (WET_EOP, "`--days' requires a DAYS argument");
+    n = strtol (v[i + 1], &end, 10);
+    if ((end == v[i + 1]) || *end || (n < 1) ||
+        (n > WET_FORECAST_DAYS_MAX))
+      wet_die (WET_EOP, "invalid `--days' -- `%s' (1-%d)", v[i + 1],
+               WET_FORECAST_DAYS_MAX);
+    forecast_days = (unsigned int) n;
+    forecast_days_given = true;
+    /* remove the option and its argument from the array */
+    *c -= 2;
+    for (j = i; v[j + 1]; ++j)
+      v[j] = v[j + 2];
+    i--;
+  }
+}
+
 static int
 find_wanted_forecast_days (int *c, char **v)
 {
@@ -661,18 +1010,14 @@ find_wanted_forecast_days (int *c, char **v)
   day = DAYMASK;
   for (i = 1; v[i]; ++i) {
     if (is_fc_day_option (v[i])) {
-      if (wet_streq (v[i], "1") || wet_streqi (v[i], "today"))
-        day |= DAY0;
-      else if (wet_streq (v[i], "2") || wet_streqi (v[i], "tomorrow"))
-        day |= DAY1;
-      else if (wet_streq (v[i], "3"))
-        day |= DAY2;
-      else if (wet_streq (v[i], "4"))
-        day |= DAY3;
-      else if (wet_streq (v[i], "5"))
-        day |= DAY4;
+      if (wet_streqi (v[i], "today"))
+        day |= DAY (0);
+      else if (wet_streqi (v[i], "tomorrow"))
+        day |= DAY (1);
       else if (wet_streqi (v[i], "all"))
         day |= DAYALL;
+      else if (wet_str2int (v[i]) > 0)
+        day |= DAY (wet_str2int (v[i]) - 1);
       *c -= 1;
       for (j = i; v[j]; ++j)
         v[j] = v[j + 1];
@@ -681,7 +1026,7 @@ find_wanted_forecast_days (int *c, char **v)
   }
 
   if (day == DAYMASK)
-    day |= DAY0;
+    day |= DAY (0);
 
   return day;
 }
@@ -696,15 +1041,55 @@ parse_opt (int c, char **v)
 
   program_name = v[0];
 
-  find_wanted_location (&c, v);
+  find_wanted_import_file (v);
+  find_wanted_completion (v);
+  find_wanted_batch_source (&c, v);
+  find_wanted_batch_options (&c, v);
+  find_wanted_replay_files (&c, v);
+  find_wanted_record_dir (&c, v);
+  find_wanted_rules_file (&c, v);
+  find_wanted_format_string (&c, v);
+  find_wanted_metrics_options (&c, v);
+  find_wanted_days (&c, v);
+  if (!n_replay_files && !batch_source)
+    find_wanted_location (&c, v);
   find_wanted_units (&c, v);
+  /* thresholds are in the units measurements would be shown in */
+  if (rules_file)
+    rules = wet_rules_compile (rules_file, metric);
+
+  if (batch_options_given && !batch_source)
+    wet_die (WET_EOP, "`--window', `--unordered' and `--ndjson' only apply "
+             "to `batch'");
+  if (batch_source) {
+    if (n_replay_files || rules_file)
+      wet_die (WET_EOP, "`batch' cannot be used with `--from-file' or "
+               "`--rules'");
+    if (batch.ndjson && (format_string || (c > 1)))
+      wet_die (WET_EOP, "`--ndjson' cannot be used with `--format-string' "
+               "or a command");
+  }
+
+  if (format_string) {
+    if (rules_file)
+      wet_die (WET_EOP, "`--format-string' and `--rules' cannot be used "
+               "together");
+    if (c > 1)
+      wet_die (WET_EOP, "`--format-string' cannot be used with a command "
+               "-- `%s'", v[1]);
+    output_template = wet_template_compile (format_string);
+    /* only fetch as far ahead as the template reads */
+    if (!forecast_days_given)
+      forecast_days = output_template->days;
+    return;
+  }
 
   if (c == 1) {
-    if (!location) {
+    if (!n_locations && !n_replay_files && !batch_source) {
       usage (true);
       exit (WET_ELOC);
     }
-    default_display = true;
+    x.summary = true;
     return;
   }
 
@@ -726,7 +1111,60 @@ parse_opt (int c, char **v)
     version ();
   }
 
-  init_display_opts ();
+  wet_display_init (&x);
+
+  if (batch_source && (wet_streqi (v[1], "history") ||
+                       wet_streqi (v[1], "serve-metrics")))
+    wet_die (WET_EOP, "`batch' cannot be used with `%s'", v[1]);
+
+  if (wet_streqi (v[1], "history")) {
+    show_history = true;
+    for (i = 2; v[i]; ++i) {
+      if (wet_streqi (v[i], "temp"))
+        history_columns[WET_HISTORY_TEMPERATURE] = true;
+      else if (wet_streqi (v[i], "dewpoint"))
+        history_columns[WET_HISTORY_DEWPOINT] = true;
+      else if (wet_streqi (v[i], "humidity"))
+        history_columns[WET_HISTORY_HUMIDITY] = true;
+      else if (wet_streqi (v[i], "pressure"))
+        history_columns[WET_HISTORY_PRESSURE] = true;
+      else if (wet_streqi (v[i], "wind"))
+        history_columns[WET_HISTORY_WIND_SPEED] = true;
+      else if (wet_streqi (v[i], "gust"))
+        history_columns[WET_HISTORY_WIND_GUST] = true;
+      else if (wet_streqi (v[i], "visibility"))
+        history_columns[WET_HISTORY_VISIBILITY] = true;
+      else if (wet_streqi (v[i], "hourly"))
+        history_bucket = HISTORY_HOURLY;
+      else if (wet_streqi (v[i], "daily"))
+        history_bucket = HISTORY_DAILY;
+      else if (wet_streqi (v[i], "day"))
+        history_window = SECONDS_PER_DAY;
+      else if (wet_streqi (v[i], "week"))
+        history_window = 7 * SECONDS_PER_DAY;
+      else if (wet_streqi (v[i], "month"))
+        history_window = 30 * SECONDS_PER_DAY;
+      else if (wet_streqi (v[i], "year"))
+        history_window = 365 * SECONDS_PER_DAY;
+      else
+        wet_die (WET_EOP, "unknown `history' option -- `%s'", v[i]);
+    }
+    for (i = 0; i < WET_HISTORY_COLUMNS; ++i)
+      if (history_columns[i])
+        return;
+    for (i = 0; i < WET_HISTORY_COLUMNS; ++i)
+      history_columns[i] = true;
+    return;
+  }
+
+  if (wet_streqi (v[1], "serve-metrics")) {
+    if (c > 2)
+      wet_die (WET_EOP, "too many arguments for `serve-metrics'");
+    if (n_replay_files)
+      wet_die (WET_EOP, "`serve-metrics' cannot serve `--from-file' data");
+    serve_metrics = true;
+    return;
+  }
 
   if (wet_streqi (v[1], "severe")) {
     x.severe_weather_alert = true;
@@ -788,23 +1226,27 @@ parse_opt (int c, char **v)
   }
 
 #define __is_specified_day(__d, __i) \
-  (__d & DAYALL) || \
-   (((__d & DAY0) && (__i == 0)) || \
-    ((__d & DAY1) && (__i == 1)) || \
-    ((__d & DAY2) && (__i == 2)) || \
-    ((__d & DAY3) && (__i == 3)) || \
-    ((__d & DAY4) && (__i == 4)))
+  (((__d) & DAYALL) || ((__d) & DAY (__i)))
 
   if (wet_streqi (v[1], "fc")) {
     day = find_wanted_forecast_days (&c, v);
+    /* only fetch as far ahead as the last day asked for */
+    if (!forecast_days_given) {
+      if (day & DAYALL)
+        forecast_days = WET_FORECAST_DAYS;
+      else
+        for (i = 0; i < WET_FORECAST_DAYS_MAX; ++i)
+          if (day & DAY (i))
+            forecast_days = i + 1;
+    }
     if (!v[2]) {
-      for (i = 0; i < WET_FORECAST_DAYS; ++i)
+      for (i = 0; i < WET_FORECAST_DAYS_MAX; ++i)
         if (__is_specified_day (day, i))
           x.forecasts[i].all = true;
       return;
     }
     for (i = 2; v[i]; ++i) {
-      for (j = 0; j < WET_FORECAST_DAYS; ++j) {
+      for (j = 0; j < WET_FORECAST_DAYS_MAX; ++j) {
         if (__is_specified_day (day, j)) {
           if (wet_streqi (v[i], "dow"))
             x.forecasts[j].day_of_week = true;
@@ -852,327 +1294,406 @@ parse_opt (int c, char **v)
 #undef __is_specified_day
 }
 
+/* Notes where W is for the nearest-location index, leaving PLACE's ID
+   empty if the document did not say. */
 static void
-print_forecast_data (int day, bool night, const char *text, ...)
+note_place (struct wet_place *place, const struct weather *w)
 {
-  va_list ap;
-
-  if (day == 0) {
-    if (night)
-      wet_puts ("tonight");
-    else
-      wet_puts ("today");
-  } else {
-    wet_puts ("%s", w.forecasts[day].day_of_week);
-    if (night)
-      wet_puts (" night");
-  }
-  wet_puts ("'s ");
-
-  va_start (ap, text);
-  vfprintf (stdout, text, ap);
-  va_end (ap);
-  wet_putc ('\n');
+  place->id[0] = '\0';
+  if (!*w->location_id || (strlen (w->location_id) >= WET_PLACE_ID_MAX) ||
+      !wet_view2double (w->location.lat, &place->lat) ||
+      !wet_view2double (w->location.lon, &place->lon))
+    return;
+  snprintf (place->name, WET_PLACE_NAME_MAX, "%.*s",
+            __v (w->location.name));
+  strcpy (place->id, w->location_id);
 }
 
+/* Writes a line to OUT for every rule W matches. */
 static void
-display (void)
+print_matches (FILE *out, const struct weather *w)
 {
-  int day;
+  const char **matches;
+  size_t i;
+  size_t n;
 
-#define __display_uv(__u) \
-  do { \
-    wet_puts (__u.index); \
-    if (*__u.text) \
-      wet_puts (" (%s)", __u.text); \
-    wet_putc ('\n'); \
-  } while (0)
-
-#define __display_barometer(__b) \
-  do { \
-    wet_puts ("%s%s", __b.reading, w.units.rainfall); \
-    if (*__b.direction) \
-      wet_puts (" (%s)", __b.direction); \
-    wet_putc ('\n'); \
-  } while (0)
-
-#define __display_wind(__w) \
-  do { \
-    wet_puts ("%sº %s", __w.direction, __w.text); \
-    if ((wet_str2int (__w.speed) != 0) && isdigit (*__w.speed)) \
-      wet_puts (" %s%s", __w.speed, w.units.speed); \
-    if (!wet_streqi (__w.gust, "n/a")) \
-      wet_puts (" (%s%s gusts)", __w.gust, w.units.speed); \
-    wet_putc ('\n'); \
-  } while (0)
-
-  if (default_display) {
-    wet_puts ("%s (%s, %s)\n"
-              "%sº%s and %s (feels like %sº%s)\n"
-              "today's high    - %sº%s\n"
-              "today's low     - %sº%s\n"
-              "visibility      - %s%s\n"
-              "humidity        - %s%%\n"
-              "dew point       - %sº%s\n"
-              "sunrise         - %s\n"
-              "sunset          - %s\n",
-              w.location.name, w.location.lat, w.location.lon,
-              w.current_conditions.temperature, w.units.temperature,
-              w.current_conditions.text, w.current_conditions.feels_like,
-              w.units.temperature, w.forecasts[0].high,
-              w.units.temperature, w.forecasts[0].low,
-              w.units.temperature, w.current_conditions.visibility,
-              w.units.distance, w.current_conditions.humidity,
-              w.current_conditions.dewpoint, w.units.temperature,
-              w.forecasts[0].sunrise, w.forecasts[0].sunset);
-    wet_puts ("uv index        - ");
-    __display_uv (w.current_conditions.uv);
-    wet_puts ("pressure        - ");
-    __display_barometer (w.current_conditions.barometer);
-    wet_puts ("wind conditions - ");
-    __display_wind (w.current_conditions.wind);
-    if (*w.severe_weather_alert.text) {
-      wet_puts ("\nALERT: %s\n\n", w.severe_weather_alert.text);
-      if (*w.severe_weather_alert.link)
-        wet_puts ("For more info visit:\n%s\n",
-                  w.severe_weather_alert.link);
-    }
-    return;
-  }
+  matches = (const char **) malloc ((rules->n_rules + 1) *
+                                    sizeof (const char *));
+  if (!matches)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  n = wet_rules_match (rules, &w->values, matches);
+  for (i = 0; i < n; ++i)
+    wet_fputs (out, "%s\t%s\t%.*s\n",
+               *w->location_id ? w->location_id : "-", matches[i],
+               __v (w->location.name));
+  free (matches);
+}
 
-  if (x.severe_weather_alert) {
-    if (!*w.severe_weather_alert.text) {
-      wet_puts ("no severe weather alerts\n");
-      return;
+/* Runs on a pool worker: parses one document into the worker's arena
+   and renders it into memory, then hands it on to the reorder stage. */
+static void
+render_location (void *job, struct wet_arena *arena, void *arg)
+{
+  struct render_job *j;
+  struct rendering *r;
+  struct renderer *self;
+  struct weather *w;
+  FILE *out;
+
+  j = (struct render_job *) job;
+  self = (struct renderer *) wet_arena_alloc (arena,
+                                              sizeof (struct renderer));
+  if (!self)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  w = &self->w;
+  wet_context_init (&self->ctx);
+  self->ctx.metric = metric;
+  self->ctx.allocator = &arena->allocator;
+
+  r = (struct rendering *) wet_slab_get (&rendering_slab);
+  if (!r)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  r->failed = false;
+  r->text = NULL;
+  r->len = 0;
+  r->place.id[0] = '\0';
+
+  out = open_memstream (&r->text, &r->len);
+  if (!out)
+    wet_die (WET_ESYS, "failed to open memory stream");
+
+  if (wet_weather_is_search (&j->content)) {
+    /* a replayed search result has no weather data to show */
+    wet_net_parse_location_id (w->location_id, j->content.p, j->content.n);
+    if (*w->location_id)
+      wet_fputs (out, "location id - %s\n", w->location_id);
+    else
+      wet_fputs (out, "no location found\n");
+    wet_buffer_free (&j->content);
+  } else if (wet_parse (&self->ctx, j->location_id, &j->content, w)) {
+    r->failed = true;
+    r->error = self->ctx.error;
+  } else {
+    note_place (&r->place, w);
+    if (record_history && !wet_history_append (w, fetch_time))
+      wet_debug ("failed to record the history of %s", w->location_id);
+    if (rules)
+      print_matches (out, w);
+    else if (output_template) {
+      wet_template_render (output_template, out, w);
+      fputc ('\n', out);
+    } else if (wet_format (&self->ctx, out, w, &x)) {
+      r->failed = true;
+      r->error = self->ctx.error;
     }
-    wet_puts ("%s\n", w.severe_weather_alert.text);
-    wet_puts ("For more info visit:\n%s\n",
-              w.severe_weather_alert.link);
+    wet_weather_release (w);
   }
+  fclose (out);
 
-  if (x.current_conditions.all) {
-    wet_puts ("Current Conditions for %s\n"
-              "%s\n"
-              "----------------\n"
-              "last updated        - %s\n"
-              "temperature         - %sº%s\n"
-              "dew point           - %sº%s\n"
-              "visibility          - %s%s\n"
-              "humidity            - %s%%\n"
-              "local station       - %s\n"
-              "feels like          - %sº%s\n"
-              "moon                - %s\n",
-              w.location.name,
-              w.current_conditions.text,
-              w.current_conditions.last_updated,
-              w.current_conditions.temperature, w.units.temperature,
-              w.current_conditions.dewpoint, w.units.temperature,
-              w.current_conditions.visibility, w.units.distance,
-              w.current_conditions.humidity,
-              w.current_conditions.station,
-              w.current_conditions.feels_like, w.units.temperature,
-              w.current_conditions.moon_phase.text);
-    wet_puts ("uv index            - ");
-    __display_uv (w.current_conditions.uv);
-    wet_puts ("barometric pressure - ");
-    __display_barometer (w.current_conditions.barometer);
-    wet_puts ("wind                - ");
-    __display_wind (w.current_conditions.wind);
-  }
-
-  if (x.location.all)
-    wet_puts ("%s\n"
-              "----------------\n"
-              "latitude  - %s\n"
-              "longitude - %s\n",
-              w.location.name,
-              w.location.lat,
-              w.location.lon);
-
-  if (x.current_conditions.last_updated)
-    wet_puts ("last updated - %s\n", w.current_conditions.last_updated);
+  wet_reorder_put ((struct wet_reorder *) arg, j->index, r);
+  wet_slab_put (&job_slab, j);
+}
 
-  if (x.current_conditions.temperature)
-    wet_puts ("current temperature - %sº%s\n",
-              w.current_conditions.temperature, w.units.temperature);
+/* Called in input order with each location's rendered output. */
+static void
+emit_location (size_t index, void *item, void *arg)
+{
+  struct rendering *r;
 
-  if (x.current_conditions.dewpoint)
-    wet_puts ("current dew point - %sº%s\n",
-              w.current_conditions.dewpoint, w.units.temperature);
+  r = (struct rendering *) item;
+  if (r->failed)
+    wet_die_error (&r->error);
 
-  if (x.current_conditions.text)
-    wet_puts ("%s\n", w.current_conditions.text);
+  /* rule matches and templates are one line each, with nothing in
+     between */
+  if (index && !rules && !output_template)
+    wet_putc ('\n');
+  fwrite (r->text, 1, r->len, stdout);
+  if (*r->place.id)
+    seen_places[n_seen_places++] = r->place;
+  free (r->text);
+  wet_slab_put (&rendering_slab, r);
+}
 
-  if (x.current_conditions.visibility)
-    wet_puts ("current visibility - %s%s\n",
-              w.current_conditions.visibility, w.units.distance);
+/* Called on the I/O thread as each weather data document arrives. */
+static void
+queue_location (size_t index, struct wet_buffer *content, void *arg)
+{
+  struct render_job *j;
+
+  j = (struct render_job *) wet_slab_get (&job_slab);
+  if (!j)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  j->index = index;
+  j->location_id = location_ids[index];
+  j->content = *content;
+  wet_pool_push ((struct wet_pool *) arg, j);
+}
 
-  if (x.current_conditions.humidity)
-    wet_puts ("current humidity - %s%%\n", w.current_conditions.humidity);
+/* Looks up the location ID of every location. */
+static void
+resolve_locations (void)
+{
+  struct wet_context ctx;
+  size_t i;
 
-  if (x.current_conditions.station)
-    wet_puts ("current local station - %s\n", w.current_conditions.station);
+  location_ids = (char **) malloc (n_locations * sizeof (char *));
+  if (!location_ids)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  for (i = 0; i < n_locations; ++i) {
+    location_ids[i] = (char *) malloc (WET_DATA_MAX);
+    if (!location_ids[i])
+      wet_die (WET_ESYS, "failed to allocate memory");
+  }
+  wet_context_init (&ctx);
+  if (wet_locate (&ctx, location_ids, locations, n_locations))
+    wet_die_error (&ctx.error);
+}
 
-  if (x.current_conditions.feels_like)
-    wet_puts ("currently feels like - %sº%s\n",
-              w.current_conditions.feels_like, w.units.temperature);
+/* Looks up every location and fetches its weather data, handing each
+   document to POOL as it arrives. The documents and the scratch of the
+   fetch come from ARENA, which only this thread allocates from; the
+   workers giving a document back does nothing, so ARENA has to outlive
+   the pool. */
+static void
+fetch_locations (struct wet_pool *pool, struct wet_arena *arena)
+{
+  struct wet_context ctx;
+
+  resolve_locations ();
+  wet_context_init (&ctx);
+  ctx.forecast_days = forecast_days;
+  ctx.allocator = &arena->allocator;
+  if (wet_fetch_documents (&ctx, (const char **) location_ids, n_locations,
+                           queue_location, pool))
+    wet_die_error (&ctx.error);
+}
 
-  if (x.current_conditions.wind) {
-    wet_puts ("current wind conditions - ");
-    __display_wind (w.current_conditions.wind);
+/* Hands each --from-file document to POOL without touching the network. */
+static void
+replay_documents (struct wet_pool *pool)
+{
+  size_t i;
+  struct render_job *j;
+
+  for (i = 0; i < n_replay_files; ++i) {
+    j = (struct render_job *) wet_slab_get (&job_slab);
+    if (!j)
+      wet_die (WET_ESYS, "failed to allocate memory");
+    j->index = i;
+    j->location_id = "";
+    if (!wet_buffer_map (&j->content, replay_files[i]))
+      wet_die (WET_ESYS, "failed to read `%s': %s", replay_files[i],
+               strerror (errno));
+    wet_pool_push (pool, j);
   }
+}
 
-  if (x.current_conditions.moon_phase)
-    wet_puts ("current moon phase - %s\n",
-              w.current_conditions.moon_phase.text);
+static void
+remember_place_names (void)
+{
+  struct wet_name *names;
+  size_t i;
 
-  if (x.current_conditions.uv) {
-    wet_puts ("current uv index - ");
-    __display_uv (w.current_conditions.uv);
+  if (!n_seen_places)
+    return;
+  names = (struct wet_name *) malloc (n_seen_places *
+                                     sizeof (struct wet_name));
+  if (!names)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  for (i = 0; i < n_seen_places; ++i) {
+    strcpy (names[i].id, seen_places[i].id);
+    strcpy (names[i].name, seen_places[i].name);
   }
+  if (!wet_names_add (names, n_seen_places))
+    wet_debug ("failed to update the name index");
+  free (names);
+}
 
-  if (x.current_conditions.barometer) {
-    wet_puts ("current barometric pressure - ");
-    __display_barometer (w.current_conditions.barometer);
+/* Returns the start of the hourly or daily bucket after the one that
+   time T falls in (buckets follow local time). */
+static int64_t
+next_bucket (int64_t t)
+{
+  struct tm tm;
+  time_t tt;
+
+  if (history_bucket == HISTORY_ALL)
+    return INT64_MAX;
+  tt = (time_t) t;
+  localtime_r (&tt, &tm);
+  tm.tm_sec = 0;
+  tm.tm_min = 0;
+  if (history_bucket == HISTORY_HOURLY)
+    tm.tm_hour++;
+  else {
+    tm.tm_hour = 0;
+    tm.tm_mday++;
   }
+  tm.tm_isdst = -1;
+  return (int64_t) mktime (&tm);
+}
 
-  if (x.location.lat)
-    wet_puts ("latitude - %s\n", w.location.lat);
-
-  if (x.location.lon)
-    wet_puts ("longitude - %s\n", w.location.lon);
+/* Prints the statistics of column C of H, one line per bucket, in the
+   units that were asked for (history is stored in metric units). */
+static void
+print_history_column (const struct wet_history *h, int c, size_t first,
+                      float *scratch)
+{
+  static const char *metric_units[WET_HISTORY_COLUMNS] = {
+    "ºC", "ºC", "%", "mb", "km/h", "km/h", "km"
+  };
+  static const char *imperial_units[WET_HISTORY_COLUMNS] = {
+    "ºF", "ºF", "%", "in", "mph", "mph", "mi"
+  };
+  static const float imperial_scale[WET_HISTORY_COLUMNS] = {
+    1.8f, 1.8f, 1.0f, 1.0f / 33.8638866667f,
+    1.0f / 1.609344f, 1.0f / 1.609344f, 1.0f / 1.609344f
+  };
+  static const float imperial_offset[WET_HISTORY_COLUMNS] = {
+    32.0f, 32.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f
+  };
+  struct wet_history_stats st;
+  size_t lo;
+  size_t hi;
+  float scale;
+  float offset;
+  char label[32];
+  struct tm tm;
+  time_t t;
+
+  scale = metric ? 1.0f : imperial_scale[c];
+  offset = metric ? 0.0f : imperial_offset[c];
+
+  wet_puts ("%s (%s)\n", wet_history_column_name (c),
+            metric ? metric_units[c] : imperial_units[c]);
+  wet_puts ("%-17s %8s %8s %8s %8s %8s %8s\n",
+            "", "samples", "min", "mean", "p50", "p95", "max");
+  for (lo = first; lo < h->n; lo = hi) {
+    hi = wet_history_lower_bound (h, next_bucket (h->time[lo]));
+    wet_history_aggregate (h, c, lo, hi, scratch, &st);
+    if (!st.n)
+      continue;
 
-  if (x.location.name)
-    wet_puts ("location name - %s\n", w.location.name);
+    t = (time_t) h->time[lo];
+    localtime_r (&t, &tm);
+    if (history_bucket == HISTORY_HOURLY)
+      strftime (label, sizeof (label), "%Y-%m-%d %H:00", &tm);
+    else if (history_bucket == HISTORY_DAILY)
+      strftime (label, sizeof (label), "%Y-%m-%d", &tm);
+    else
+      strftime (label, sizeof (label), "since %Y-%m-%d", &tm);
+    wet_puts ("%-17s %8zu %8.1f %8.1f %8.1f %8.1f %8.1f\n", label, st.n,
+              st.min * scale + offset, st.mean * scale + offset,
+              st.p50 * scale + offset, st.p95 * scale + offset,
+              st.max * scale + offset);
+  }
+}
 
-  for (day = 0; day < WET_FORECAST_DAYS; ++day) {
-    if (x.forecasts[day].all) {
-      wet_puts ("Forecast for ");
-      if (day == 0)
-        wet_puts ("today (%s)", w.forecasts[day].day_of_week);
-      else if (day == 1)
-        wet_puts ("tomorrow (%s)", w.forecasts[day].day_of_week);
-      else
-        wet_puts (w.forecasts[day].day_of_week);
-      if (*w.forecasts[day].text)
-        wet_puts (" - %s", w.forecasts[day].text);
-      wet_puts ("\n--------------\n"
-                "high                    - %sº%s\n"
-                "low                     - %sº%s\n"
-                "sunset                  - %s\n"
-                "sunrise                 - %s\n"
-                "chance of precipitation - %s%%\n"
-                "humidity                - %s%%\n"
-                "wind                    - ",
-                w.forecasts[day].high, w.units.temperature,
-                w.forecasts[day].low, w.units.temperature,
-                w.forecasts[day].sunset,
-                w.forecasts[day].sunrise,
-                w.forecasts[day].chance_precip,
-                w.forecasts[day].humidity);
-      __display_wind (w.forecasts[day].wind);
-      wet_putc ('\n');
-      if (day == 0)
-        wet_puts ("  Tonight");
-      else if (day == 1)
-        wet_puts ("  Tomorrow night");
-      else
-        wet_puts ("  %s night", w.forecasts[day].day_of_week);
-      if (*w.forecasts[day].night.text)
-        wet_puts (" - %s", w.forecasts[day].night.text);
-      wet_puts ("\n  --------------\n"
-                "  chance of precipitation - %s%%\n"
-                "  humidity                - %s%%\n"
-                "  wind                    - ",
-                w.forecasts[day].night.chance_precip,
-                w.forecasts[day].night.humidity);
-      __display_wind (w.forecasts[day].night.wind);
+/* Summarizes the stored observation history of every location. */
+static void
+show_histories (void)
+{
+  size_t i;
+  size_t first;
+  int64_t since;
+  int c;
+  bool separate;
+  struct wet_history h;
+  float *scratch;
+
+  resolve_locations ();
+
+  for (i = 0; i < n_locations; ++i) {
+    since = history_window ? time (NULL) - history_window : INT64_MIN;
+    if (!wet_history_open (&h, location_ids[i], since))
+      wet_die (WET_EWEATHER,
+               "no history recorded for '%s' (set WET_HISTORY to record "
+               "it)", locations[i]);
+    scratch = (float *) malloc ((h.n + 1) * sizeof (float));
+    if (!scratch)
+      wet_die (WET_ESYS, "failed to allocate memory");
+    first = wet_history_lower_bound (&h, since);
+
+    if (i)
       wet_putc ('\n');
-      continue;
-    }
-    if (x.forecasts[day].day_of_week)
-      wet_puts ("%s\n", w.forecasts[day].day_of_week);
-    if (x.forecasts[day].high)
-      print_forecast_data (day, false, "high - %sº%s",
-                           w.forecasts[day].high, w.units.temperature);
-    if (x.forecasts[day].low)
-      print_forecast_data (day, false, "low - %sº%s",
-                           w.forecasts[day].low, w.units.temperature);
-    if (x.forecasts[day].sunset)
-      print_forecast_data (day, false, "sunset - %s",
-                           w.forecasts[day].sunset);
-    if (x.forecasts[day].sunrise)
-      print_forecast_data (day, false, "sunrise - %s",
-                           w.forecasts[day].sunrise);
-    if (x.forecasts[day].text)
-      print_forecast_data (day, false, "%s", w.forecasts[day].text);
-    if (x.forecasts[day].chance_precip)
-      print_forecast_data (day, false, "chance of precipitation - %s%%",
-                           w.forecasts[day].chance_precip);
-    if (x.forecasts[day].humidity)
-      print_forecast_data (day, false, "humidity - %s%%",
-                           w.forecasts[day].humidity);
-    if (x.forecasts[day].wind) {
-      if (day == 0)
-        wet_puts ("today's wind - ");
-      else
-        wet_puts ("%s's wind - ", w.forecasts[day].day_of_week);
-      __display_wind (w.forecasts[day].wind);
-    }
-    if (x.forecasts[day].night.all) {
-      wet_puts ("Forecast for ");
-      if (day == 0)
-        wet_puts ("tonight");
-      else if (day == 1)
-        wet_puts ("tomorrow night");
-      else
-        wet_puts ("%s night", w.forecasts[day].day_of_week);
-      if (*w.forecasts[day].night.text)
-        wet_puts (" - %s\n", w.forecasts[day].night.text);
-      wet_puts ("--------------\n"
-                "chance of precipitation - %s%%\n"
-                "humidity                - %s%%\n"
-                "wind                    - ",
-                w.forecasts[day].night.chance_precip,
-                w.forecasts[day].night.humidity);
-      __display_wind (w.forecasts[day].night.wind);
-      continue;
-    }
-    if (x.forecasts[day].night.text)
-      print_forecast_data (day, true, "%s", w.forecasts[day].night.text);
-    if (x.forecasts[day].night.chance_precip)
-      print_forecast_data (day, true, "chance of precipitation - %s%%",
-                           w.forecasts[day].night.chance_precip);
-    if (x.forecasts[day].night.humidity)
-      print_forecast_data (day, true, "humidity - %s%%",
-                           w.forecasts[day].night.humidity);
-    if (x.forecasts[day].night.wind) {
-      if (day == 0)
-        wet_puts ("tonight");
-      else if (day == 1)
-        wet_puts ("tomorrow night");
-      else
-        wet_puts ("%s night", w.forecasts[day].day_of_week);
-      wet_puts ("'s wind - ");
-      __display_wind (w.forecasts[day].night.wind);
+    wet_puts ("history of %s (%s)\n", locations[i], location_ids[i]);
+    separate = false;
+    for (c = 0; c < WET_HISTORY_COLUMNS; ++c) {
+      if (!history_columns[c])
+        continue;
+      if (separate)
+        wet_putc ('\n');
+      print_history_column (&h, c, first, scratch);
+      separate = true;
     }
+    free (scratch);
+    wet_history_close (&h);
   }
-
-#undef __display_wind
 }
 
 int
 main (int argc, char **argv)
 {
+  size_t n;
+  struct wet_pool *pool;
+  struct wet_reorder *reorder;
+  struct wet_arena documents;
+
   parse_opt (argc, argv);
 
-  if (!wet_weather (&w, location, metric)) {
-    if (*w.error.text)
-      wet_die (WET_EWEATHER, "weather: %s", w.error.text);
-    wet_die (WET_ENET, "failed to retrieve weather data");
+  if (show_history) {
+    show_histories ();
+    exit (WET_ESUCCESS);
+  }
+
+  if (batch_source) {
+    batch.metric = metric;
+    batch.forecast_days = forecast_days;
+    batch.display = &x;
+    batch.template = output_template;
+    exit (wet_batch_run (batch_source, &batch));
+  }
+
+  if (serve_metrics) {
+    resolve_locations ();
+    wet_metrics_serve ((const char **) location_ids, n_locations,
+                       metrics_listen, metrics_interval);
+  }
+
+  /* Parsing and rendering happen on a pool of workers while the rest of
+     the documents are still arriving; the reorder stage puts the output
+     back into the order the locations (or files) were given in. */
+  n = (n_replay_files) ? n_replay_files : n_locations;
+  seen_places = (struct wet_place *) malloc (n * sizeof (struct wet_place));
+  if (!seen_places)
+    wet_die (WET_ESYS, "failed to allocate memory");
+  reorder = wet_reorder_new (n, emit_location, NULL);
+  pool = wet_pool_new (wet_pool_default_workers (n),
+                       WET_ARENA_DOCUMENT_LIMIT, render_location, reorder);
+  /* the documents are all kept until the end of the run, so they get
+     the room of as many arenas as there are of them */
+  wet_arena_init (&documents,
+                  (n <= SIZE_MAX / WET_ARENA_DOCUMENT_LIMIT) ?
+                  n * WET_ARENA_DOCUMENT_LIMIT : 0);
+  if (n_replay_files)
+    replay_documents (pool);
+  else {
+    record_history = wet_history_enabled ();
+    fetch_time = time (NULL);
+    fetch_locations (pool, &documents);
   }
-  display ();
+  wet_pool_finish (pool);
+  wet_arena_destroy (&documents);
+  wet_reorder_free (reorder);
+
+  /* remember where every location we just fetched is, and what it is
+     called, so `@LAT,LON' and its name can be resolved later without a
+     search */
+  if (!wet_geo_add (seen_places, n_seen_places))
+    wet_debug ("failed to update the location index");
+  remember_place_names ();
+
   exit (WET_ESUCCESS);
   return 0; /* for compiler */
 }
-
@@ -36,7 +36,8 @@
 # define WET_VERSION "1.5.6"
 #endif
 
-#ifdef HAVE_STDBOOL_H
+#if defined (HAVE_STDBOOL_H) || \
+    (defined (__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L))
 # include <stdbool.h>
 #else
 # ifndef __cplusplus